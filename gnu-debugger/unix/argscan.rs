@@ -0,0 +1,343 @@
+use super::ESP_DEBUG_TRACE;
+use std::env;
+use std::fs;
+use std::path::{Path, PathBuf};
+
+/* Commands and convenience functions implemented in Python or running Python code.
+ * "python" and "python-interactive" may be abbreviated down to "py", "pi" is an alias */
+const PYTHON_COMMAND_PREFIX: &str = "py";
+const PYTHON_COMMAND_ALIAS: &str = "pi";
+const PYTHON_IMPLEMENTED_NAMES: [&str; 16] = [
+    "explore",
+    "pretty-printer",
+    "frame-filter",
+    "unwinder",
+    "xmethod",
+    "type-printer",
+    "missing-debug-handler",
+    "$_memeq",
+    "$_streq",
+    "$_strlen",
+    "$_regex",
+    "$_as_string",
+    "$_caller_is",
+    "$_caller_matches",
+    "$_any_caller_is",
+    "$_any_caller_matches",
+];
+
+/* GDB options taking a value in the next argument (unless given as --opt=value) */
+const OPTIONS_WITH_VALUE: [&str; 26] = [
+    "x",
+    "command",
+    "ix",
+    "init-command",
+    "ex",
+    "eval-command",
+    "iex",
+    "init-eval-command",
+    "e",
+    "exec",
+    "s",
+    "symbols",
+    "se",
+    "c",
+    "core",
+    "p",
+    "pid",
+    "cd",
+    "d",
+    "directory",
+    "b",
+    "l",
+    "i",
+    "interpreter",
+    "tty",
+    "data-directory",
+];
+
+/* Options without a value, anything else makes the detection give up */
+const KNOWN_FLAGS: [&str; 16] = [
+    "q",
+    "quiet",
+    "silent",
+    "readnow",
+    "readnever",
+    "write",
+    "return-child-result",
+    "w",
+    "nw",
+    "nowindows",
+    "tui",
+    "fullname",
+    "f",
+    "dbx",
+    "statistics",
+    "configuration",
+];
+const MAX_SOURCE_DEPTH: u32 = 8;
+
+/* Decide whether the GDB session can use Python. Only batch sessions are
+ * checked: -x/-ix scripts, -ex/-iex commands, init files and auto-load
+ * scripts of the loaded objfiles must not contain Python. Anything that
+ * can not be checked counts as Python usage.
+ * ESP_GDB_WRAPPER_PYTHON=on|off overrides the detection. */
+pub fn python_required(args: &[String]) -> bool {
+    match env::var("ESP_GDB_WRAPPER_PYTHON").as_deref() {
+        Ok("on") | Ok("1") => return true,
+        Ok("off") | Ok("0") => return false,
+        _ => (),
+    }
+    match find_python_usage(args) {
+        Some(reason) => {
+            esp_debug_trace!("GDB session requires Python: {}", reason);
+            true
+        }
+        None => {
+            esp_debug_trace!("GDB session does not use Python");
+            false
+        }
+    }
+}
+
+fn find_python_usage(args: &[String]) -> Option<String> {
+    let mut batch = false;
+    let mut read_home_init = true;
+    let mut read_local_init = true;
+    let mut objfiles: Vec<PathBuf> = vec![];
+    let mut positional = 0;
+
+    let mut i = 0;
+    while i < args.len() {
+        let arg = &args[i];
+        i += 1;
+        if !arg.starts_with('-') || arg == "-" {
+            /* gdb [options] [executable [core-file|pid]] */
+            if positional == 0 {
+                objfiles.push(PathBuf::from(arg));
+            }
+            positional += 1;
+            continue;
+        }
+        let option = arg.trim_start_matches('-');
+        let (name, inline_value) = match option.split_once('=') {
+            Some((n, v)) => (n, Some(v.to_string())),
+            None => (option, None),
+        };
+        let value = if OPTIONS_WITH_VALUE.contains(&name) && inline_value.is_none() {
+            i += 1;
+            match args.get(i - 1) {
+                Some(v) => Some(v.clone()),
+                None => return Some(format!("no value for {}", arg)),
+            }
+        } else {
+            inline_value
+        };
+
+        match name {
+            "batch" | "batch-silent" => batch = true,
+            "nx" | "n" => {
+                read_home_init = false;
+                read_local_init = false;
+            }
+            "nh" => read_home_init = false,
+            "x" | "command" | "ix" | "init-command" => {
+                let script = PathBuf::from(value.unwrap_or_default());
+                if let Some(reason) = script_uses_python(&script, 0) {
+                    return Some(reason);
+                }
+            }
+            "ex" | "eval-command" | "iex" | "init-eval-command" => {
+                let command = value.unwrap_or_default();
+                if let Some(reason) = command_uses_python(&command, Path::new("."), 0) {
+                    return Some(reason);
+                }
+            }
+            "e" | "exec" | "s" | "symbols" | "se" => {
+                objfiles.push(PathBuf::from(value.unwrap_or_default()))
+            }
+            "args" => {
+                if let Some(program) = args.get(i) {
+                    objfiles.push(PathBuf::from(program));
+                }
+                break;
+            }
+            "python" | "P" => return Some(format!("option {}", arg)),
+            _ => {
+                if !OPTIONS_WITH_VALUE.contains(&name) && !KNOWN_FLAGS.contains(&name) {
+                    return Some(format!("unknown option {}", arg));
+                }
+            }
+        }
+    }
+
+    if !batch {
+        return Some("interactive session".to_string());
+    }
+
+    let mut init_files = vec![];
+    if let Some(home) = env::var_os("HOME") {
+        let home = PathBuf::from(home);
+        init_files.push(home.join(".gdbearlyinit"));
+        if read_home_init {
+            init_files.push(home.join(".gdbinit"));
+            let config = match env::var_os("XDG_CONFIG_HOME") {
+                Some(dir) => PathBuf::from(dir),
+                None => home.join(".config"),
+            };
+            init_files.push(config.join("gdb").join("gdbinit"));
+        }
+    }
+    if read_local_init {
+        init_files.push(PathBuf::from(".gdbinit"));
+    }
+    for init_file in init_files.iter().filter(|f| f.is_file()) {
+        if let Some(reason) = script_uses_python(init_file, 0) {
+            return Some(reason);
+        }
+    }
+
+    for objfile in objfiles {
+        let mut auto_load = objfile.clone().into_os_string();
+        auto_load.push("-gdb.py");
+        if Path::new(&auto_load).exists() {
+            return Some(format!("auto-load script {:?}", auto_load));
+        }
+        let mut auto_load = objfile.into_os_string();
+        auto_load.push("-gdb.gdb");
+        let auto_load = PathBuf::from(auto_load);
+        if auto_load.is_file() {
+            if let Some(reason) = script_uses_python(&auto_load, 0) {
+                return Some(reason);
+            }
+        }
+    }
+    None
+}
+
+fn script_uses_python(script: &Path, depth: u32) -> Option<String> {
+    if script.extension().is_some_and(|ext| ext == "py") {
+        return Some(format!("Python script {:?}", script));
+    }
+    if depth > MAX_SOURCE_DEPTH {
+        return Some(format!("too deep source nesting in {:?}", script));
+    }
+    let content = match fs::read_to_string(script) {
+        Ok(c) => c,
+        Err(e) => return Some(format!("can not read {:?}: {}", script, e)),
+    };
+    let dir = script.parent().unwrap_or(Path::new("."));
+    content
+        .lines()
+        .find_map(|line| command_uses_python(line, dir, depth))
+}
+
+fn command_uses_python(command: &str, dir: &Path, depth: u32) -> Option<String> {
+    let command = command.trim();
+    let first_word = command.split_whitespace().next().unwrap_or("");
+    if first_word.starts_with(PYTHON_COMMAND_PREFIX)
+        || first_word == PYTHON_COMMAND_ALIAS
+        || PYTHON_IMPLEMENTED_NAMES.iter().any(|n| command.contains(n))
+    {
+        return Some(format!("command \"{}\"", command));
+    }
+    if first_word == "source" || first_word == "so" {
+        let file = match command.split_whitespace().last() {
+            Some(f) if f != first_word && !f.starts_with('-') => f,
+            _ => return Some(format!("command \"{}\"", command)),
+        };
+        /* GDB looks for relative names in the current directory */
+        let file = Path::new(file);
+        let file = if file.exists() {
+            file.to_path_buf()
+        } else {
+            dir.join(file)
+        };
+        return script_uses_python(&file, depth + 1);
+    }
+    None
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::process;
+
+    fn args(args: &[&str]) -> Vec<String> {
+        args.iter().map(|a| a.to_string()).collect()
+    }
+
+    /* Batch session without init files, so only the arguments are checked */
+    fn batch(extra: &[&str]) -> Option<String> {
+        let mut all = args(&["-batch", "-nx"]);
+        all.extend(args(extra));
+        find_python_usage(&all)
+    }
+
+    fn scripts_dir(name: &str) -> PathBuf {
+        let dir = env::temp_dir().join(format!("esp-gdb-argscan-{}-{}", process::id(), name));
+        fs::create_dir_all(&dir).unwrap();
+        dir
+    }
+
+    #[test]
+    fn interactive_session_uses_python() {
+        assert!(find_python_usage(&args(&["-nx", "-ex", "bt"])).is_some());
+    }
+
+    #[test]
+    fn batch_commands() {
+        assert_eq!(batch(&["-ex", "bt", "-iex", "set pagination off"]), None);
+        assert_eq!(batch(&["--eval-command=info threads", "-q"]), None);
+        assert!(batch(&["-ex", "py print(1)"]).is_some());
+        assert!(batch(&["-ex", "pi"]).is_some());
+        assert!(batch(&["-ex", "python-interactive"]).is_some());
+        assert!(batch(&["--eval-command=python print(1)"]).is_some());
+        assert!(batch(&["-ex", "p $_streq(\"a\", \"b\")"]).is_some());
+        assert!(batch(&["-ex", "source"]).is_some());
+    }
+
+    #[test]
+    fn options() {
+        assert!(batch(&["--python"]).is_some());
+        assert!(batch(&["--unknown-option"]).is_some());
+        assert!(batch(&["-ex"]).is_some());
+        /* Options after --args belong to the inferior */
+        assert_eq!(
+            batch(&["--args", "/nonexistent/app", "-ex", "python"]),
+            None
+        );
+    }
+
+    #[test]
+    fn scripts() {
+        let dir = scripts_dir("scripts");
+        fs::write(dir.join("plain.gdb"), "set pagination off\nbt\n").unwrap();
+        fs::write(
+            dir.join("nested.gdb"),
+            "source plain.gdb\nsource python.gdb\n",
+        )
+        .unwrap();
+        fs::write(dir.join("python.gdb"), "bt\npython print(1)\n").unwrap();
+        let script = |name: &str| dir.join(name).display().to_string();
+
+        assert_eq!(batch(&["-x", &script("plain.gdb")]), None);
+        assert!(batch(&["-x", &script("python.gdb")]).is_some());
+        /* Nested scripts are found relative to the sourcing one */
+        assert!(batch(&["-x", &script("nested.gdb")]).is_some());
+        assert!(batch(&["-x", &script("script.py")]).is_some());
+        assert!(batch(&["-x", &script("missing.gdb")]).is_some());
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn auto_load_scripts() {
+        let dir = scripts_dir("auto-load");
+        let elf = dir.join("app.elf").display().to_string();
+        fs::write(&elf, "").unwrap();
+        assert_eq!(batch(&[&elf]), None);
+        fs::write(dir.join("app.elf-gdb.py"), "").unwrap();
+        assert!(batch(&[&elf]).is_some());
+        fs::remove_dir_all(&dir).unwrap();
+    }
+}
@@ -0,0 +1,512 @@
+use super::dwarf::{self, FrameTable, Rule, StringSections};
+use super::elf::{Elf, ProgramHeader};
+use super::{cache, ESP_DEBUG_TRACE};
+use std::collections::hash_map::DefaultHasher;
+use std::fs;
+use std::hash::{Hash, Hasher};
+use std::os::unix::fs::MetadataExt;
+use std::path::Path;
+use std::time::Instant;
+
+const EM_XTENSA: u16 = 94;
+const EM_RISCV: u16 = 243;
+const ET_CORE: u16 = 4;
+const PT_NOTE: u32 = 4;
+const SHT_SYMTAB: u32 = 2;
+const STT_FUNC: u8 = 2;
+
+/* Notes of ESP-IDF ELF core dumps */
+const NT_PRSTATUS: u32 = 1;
+const PRSTATUS_OWNER: &[u8] = b"CORE";
+const EXTRA_INFO_OWNER: &[u8] = b"EXTRA_INFO";
+const EXTRA_INFO_TYPE: u32 = 677;
+const PANIC_DETAILS_OWNER: &[u8] = b"ESP_PANIC_DETAILS";
+const PANIC_DETAILS_TYPE: u32 = 4660;
+/* elf_prstatus of 32-bit targets: the core dump puts the task handle into
+ * pr_pid, pr_reg holds pc followed by x1-x31 on RISC-V */
+const PRSTATUS_PID_OFFSET: usize = 24;
+const PRSTATUS_REGS_OFFSET: usize = 72;
+/* pcTaskName in the FreeRTOS TCB of ESP-IDF */
+const TCB_NAME_OFFSET: u64 = 52;
+const TCB_NAME_LEN: u64 = 16;
+
+const RISCV_REGISTERS: usize = 32;
+const RISCV_SP: u16 = 2;
+const RISCV_CSR_NAMES: [(u32, &str); 6] = [
+    (0x300, "mstatus"),
+    (0x305, "mtvec"),
+    (0x341, "mepc"),
+    (0x342, "mcause"),
+    (0x343, "mtval"),
+    (0xf14, "mhartid"),
+];
+const RISCV_MCAUSE: u32 = 0x342;
+const RISCV_EXCEPTIONS: [&str; 12] = [
+    "Instruction address misaligned",
+    "Instruction access fault",
+    "Illegal instruction",
+    "Breakpoint",
+    "Load address misaligned",
+    "Load access fault",
+    "Store address misaligned",
+    "Store access fault",
+    "Environment call from U-mode",
+    "Environment call from S-mode",
+    "Reserved",
+    "Environment call from M-mode",
+];
+
+const MAX_FRAMES: usize = 64;
+const INDEX_CACHE: &str = "backtrace-index";
+const INDEX_HEADER: &str = "esp-fast-backtrace index 1";
+
+struct Function {
+    start: u64,
+    end: u64,
+    name: String,
+}
+
+struct LineRow {
+    address: u64,
+    file: u32,
+    /* 0 ends a sequence */
+    line: u32,
+}
+
+/* Address to function and source line of the application ELF, from .symtab
+ * and the DWARF line tables. Inlined calls are not expanded, that takes
+ * .debug_info. */
+struct Index {
+    functions: Vec<Function>,
+    files: Vec<String>,
+    lines: Vec<LineRow>,
+}
+
+impl Index {
+    fn build(elf: &Elf) -> Index {
+        let sections = elf.section_headers();
+        let section = |name: &str| {
+            sections
+                .iter()
+                .find(|sh| sh.name == name)
+                .and_then(|sh| elf.section_data(sh))
+                .unwrap_or_default()
+        };
+
+        let mut functions = vec![];
+        if let Some(symtab) = sections.iter().find(|sh| sh.sh_type == SHT_SYMTAB) {
+            let strtab = sections.get(symtab.link as usize).map_or(0, |sh| sh.offset);
+            let entry_size = if elf.class64 { 24 } else { 16 };
+            for i in 0..symtab.size / entry_size {
+                let sym = symtab.offset + i * entry_size;
+                let fields = if elf.class64 {
+                    (
+                        elf.u32(sym),
+                        elf.data().get(sym as usize + 4),
+                        elf.u64(sym + 8),
+                        elf.u64(sym + 16),
+                    )
+                } else {
+                    (
+                        elf.u32(sym),
+                        elf.data().get(sym as usize + 12),
+                        elf.u32(sym + 4).map(u64::from),
+                        elf.u32(sym + 8).map(u64::from),
+                    )
+                };
+                let (name, value, size) = match fields {
+                    (Some(name), Some(info), Some(value), Some(size))
+                        if info & 0xf == STT_FUNC && value != 0 =>
+                    {
+                        (name, value, size)
+                    }
+                    _ => continue,
+                };
+                if let Some(name) = elf.c_str(strtab + u64::from(name)) {
+                    functions.push(Function {
+                        start: value,
+                        end: value + size,
+                        name: name.to_string(),
+                    });
+                }
+            }
+        }
+        functions.sort_by_key(|f| f.start);
+        functions.dedup_by_key(|f| f.start);
+        /* Functions of unknown size end where the next one starts */
+        for i in 0..functions.len() {
+            if functions[i].end == functions[i].start {
+                functions[i].end = functions.get(i + 1).map_or(u64::MAX, |f| f.start);
+            }
+        }
+
+        let table = dwarf::line_table(
+            section(".debug_line"),
+            &StringSections {
+                debug_str: section(".debug_str"),
+                debug_line_str: section(".debug_line_str"),
+            },
+        );
+        let mut lines: Vec<LineRow> = table
+            .rows
+            .into_iter()
+            .map(|r| LineRow {
+                address: r.address,
+                file: r.file,
+                line: if r.end_sequence { 0 } else { r.line.max(1) },
+            })
+            .collect();
+        /* A sequence may end where the next one starts */
+        lines.sort_by_key(|r| (r.address, r.line != 0));
+        Index {
+            functions,
+            files: table.files,
+            lines,
+        }
+    }
+
+    fn serialize(&self) -> String {
+        let mut s = String::new();
+        for f in &self.functions {
+            s += &format!("F\t{:x}\t{:x}\t{}\n", f.start, f.end, f.name);
+        }
+        for file in &self.files {
+            s += &format!("S\t{}\n", file);
+        }
+        for r in &self.lines {
+            s += &format!("L\t{:x}\t{}\t{}\n", r.address, r.file, r.line);
+        }
+        s
+    }
+
+    fn deserialize(content: &str) -> Option<Index> {
+        let mut index = Index {
+            functions: vec![],
+            files: vec![],
+            lines: vec![],
+        };
+        let hex = |s: &str| u64::from_str_radix(s, 16).ok();
+        for line in content.lines() {
+            let fields: Vec<&str> = line.splitn(4, '\t').collect();
+            match fields[..] {
+                ["F", start, end, name] => index.functions.push(Function {
+                    start: hex(start)?,
+                    end: hex(end)?,
+                    name: name.to_string(),
+                }),
+                ["S", ..] => index.files.push(line[2..].to_string()),
+                ["L", address, file, line] => index.lines.push(LineRow {
+                    address: hex(address)?,
+                    file: file.parse().ok()?,
+                    line: line.parse().ok()?,
+                }),
+                _ => return None,
+            }
+        }
+        Some(index)
+    }
+
+    /* Cached per build-id, or per path and modification time for ELFs
+     * linked without one */
+    fn load(elf: &Elf, path: &Path) -> Index {
+        let (name, key) = match elf.build_id() {
+            Some(id) => (format!("{}-{}", INDEX_CACHE, id), INDEX_HEADER.to_string()),
+            None => {
+                let path = fs::canonicalize(path).unwrap_or_else(|_| path.to_path_buf());
+                let mut hasher = DefaultHasher::new();
+                path.hash(&mut hasher);
+                let stamp = path
+                    .metadata()
+                    .map(|m| format!("{}\t{}\t{}", m.len(), m.mtime(), m.mtime_nsec()))
+                    .unwrap_or_default();
+                (
+                    format!("{}-{:016x}", INDEX_CACHE, hasher.finish()),
+                    format!("{}\t{}", INDEX_HEADER, stamp),
+                )
+            }
+        };
+        if let Some(index) = cache::read(&name, &key).and_then(|s| Index::deserialize(&s)) {
+            esp_debug_trace!("Backtrace index {} loaded from cache", name);
+            return index;
+        }
+        let index = Index::build(elf);
+        cache::write(&name, &key, &index.serialize());
+        index
+    }
+
+    fn function(&self, pc: u64) -> Option<&str> {
+        let i = self
+            .functions
+            .partition_point(|f| f.start <= pc)
+            .checked_sub(1)?;
+        let f = &self.functions[i];
+        (pc < f.end).then_some(f.name.as_str())
+    }
+
+    fn line(&self, pc: u64) -> Option<(&str, u32)> {
+        let i = self
+            .lines
+            .partition_point(|r| r.address <= pc)
+            .checked_sub(1)?;
+        let r = &self.lines[i];
+        if r.line == 0 {
+            return None;
+        }
+        Some((self.files.get(r.file as usize)?.as_str(), r.line))
+    }
+}
+
+struct Task {
+    tcb: u64,
+    pc: u64,
+    /* x0-x31 */
+    registers: [u64; RISCV_REGISTERS],
+}
+
+/* ESP-IDF core dump in ELF format: task stacks and TCBs in PT_LOAD segments,
+ * registers of every task in NT_PRSTATUS notes */
+struct Core {
+    elf: Elf,
+    phdrs: Vec<ProgramHeader>,
+    tasks: Vec<Task>,
+    crashed_tcb: Option<u64>,
+    /* (register number, value) pairs of the exception */
+    exception: Vec<(u32, u32)>,
+    panic_details: Option<String>,
+}
+
+fn le_u32(data: &[u8], offset: usize) -> Option<u32> {
+    Some(u32::from_le_bytes(
+        data.get(offset..offset + 4)?.try_into().ok()?,
+    ))
+}
+
+impl Core {
+    fn open(path: &Path) -> Result<Core, String> {
+        let elf = Elf::open(path).map_err(|e| format!("{:?}: {}", path, e))?;
+        if elf.file_type() != Some(ET_CORE) {
+            return Err(format!("{:?} is not an ELF core dump", path));
+        }
+        let phdrs = elf.program_headers();
+        let mut core = Core {
+            phdrs: vec![],
+            tasks: vec![],
+            crashed_tcb: None,
+            exception: vec![],
+            panic_details: None,
+            elf,
+        };
+        for ph in phdrs.iter().filter(|ph| ph.p_type == PT_NOTE) {
+            for note in core.elf.notes(ph.offset, ph.filesz) {
+                match (note.name, note.n_type) {
+                    (PRSTATUS_OWNER, NT_PRSTATUS) => {
+                        let mut registers = [0u64; RISCV_REGISTERS];
+                        for (i, r) in registers.iter_mut().enumerate() {
+                            *r = u64::from(
+                                le_u32(note.desc, PRSTATUS_REGS_OFFSET + 4 * i).unwrap_or(0),
+                            );
+                        }
+                        let pc = registers[0];
+                        registers[0] = 0; // x0
+                        core.tasks.push(Task {
+                            tcb: u64::from(le_u32(note.desc, PRSTATUS_PID_OFFSET).unwrap_or(0)),
+                            pc,
+                            registers,
+                        });
+                    }
+                    (EXTRA_INFO_OWNER, EXTRA_INFO_TYPE) => {
+                        core.crashed_tcb = le_u32(note.desc, 0).map(u64::from);
+                        core.exception = (4..note.desc.len())
+                            .step_by(8)
+                            .filter_map(|i| {
+                                Some((le_u32(note.desc, i)?, le_u32(note.desc, i + 4)?))
+                            })
+                            .collect();
+                    }
+                    (PANIC_DETAILS_OWNER, PANIC_DETAILS_TYPE) => {
+                        let details = note.desc.split(|&b| b == 0).next().unwrap_or_default();
+                        core.panic_details =
+                            Some(String::from_utf8_lossy(details).trim_end().to_string());
+                    }
+                    _ => (),
+                }
+            }
+        }
+        core.phdrs = phdrs;
+        Ok(core)
+    }
+
+    fn read(&self, address: u64, len: u64) -> Option<&[u8]> {
+        let offset = self.elf.vaddr_to_offset(&self.phdrs, address)?;
+        let start = usize::try_from(offset).ok()?;
+        self.elf
+            .data()
+            .get(start..start + usize::try_from(len).ok()?)
+    }
+
+    fn read_u32(&self, address: u64) -> Option<u64> {
+        le_u32(self.read(address, 4)?, 0).map(u64::from)
+    }
+
+    /* Task name from the TCB, None when it does not look like one */
+    fn task_name(&self, tcb: u64) -> Option<String> {
+        let name = self.read(tcb + TCB_NAME_OFFSET, TCB_NAME_LEN)?;
+        let name = &name[..name.iter().position(|&b| b == 0)?];
+        if name.is_empty() || !name.iter().all(|b| b.is_ascii_graphic() || *b == b' ') {
+            return None;
+        }
+        Some(String::from_utf8_lossy(name).to_string())
+    }
+
+    fn exception_summary(&self) -> Option<String> {
+        let registers: Vec<String> = self
+            .exception
+            .iter()
+            .filter_map(|(number, value)| {
+                let (_, name) = RISCV_CSR_NAMES.iter().find(|(n, _)| n == number)?;
+                let mut s = format!("{} 0x{:08x}", name, value);
+                if *number == RISCV_MCAUSE && value & 0x8000_0000 == 0 {
+                    if let Some(cause) = RISCV_EXCEPTIONS.get(*value as usize) {
+                        s += &format!(" ({})", cause);
+                    }
+                }
+                Some(s)
+            })
+            .collect();
+        (!registers.is_empty()).then(|| registers.join(", "))
+    }
+}
+
+/* Return addresses of the task's frames, unwound with .debug_frame. The
+ * innermost frame may be in code without CFI (ROM functions), it is taken
+ * as a leaf that has not saved ra yet. An outer frame without CFI or with a
+ * CFA that can not be computed is an error, GDB has other unwinders. */
+fn unwind(frames: &FrameTable, core: &Core, task: &Task) -> Result<Vec<u64>, String> {
+    let mut pcs = vec![];
+    let mut registers: [Option<u64>; RISCV_REGISTERS] = task.registers.map(Some);
+    registers[0] = Some(0);
+    let mut pc = task.pc;
+    while pc != 0 && pcs.len() < MAX_FRAMES {
+        pcs.push(pc);
+        let innermost = pcs.len() == 1;
+        /* Return addresses point after the call, which may be another line */
+        let frame = match frames.frame(if innermost { pc } else { pc - 1 }) {
+            Some(frame) => frame,
+            None if innermost => {
+                pc = registers[1].unwrap_or(0);
+                continue;
+            }
+            None => return Err(format!("No CFI for 0x{:08x}", pc)),
+        };
+        let cfa = match registers
+            .get(usize::from(frame.cfa_register))
+            .copied()
+            .flatten()
+        {
+            Some(base) => base.wrapping_add(frame.cfa_offset as u64) & 0xffff_ffff,
+            None => return Err(format!("CFA of 0x{:08x} is unknown", pc)),
+        };
+        let value = |register: u16| -> Option<u64> {
+            match frame.rule(register) {
+                Rule::Undefined => None,
+                Rule::SameValue => *registers.get(usize::from(register))?,
+                Rule::Offset(offset) => {
+                    core.read_u32(cfa.wrapping_add(offset as u64) & 0xffff_ffff)
+                }
+                Rule::ValOffset(offset) => Some(cfa.wrapping_add(offset as u64) & 0xffff_ffff),
+                Rule::Register(source) => *registers.get(usize::from(source))?,
+            }
+        };
+        let return_address = value(frame.return_address);
+        let mut caller = [None; RISCV_REGISTERS];
+        for (i, r) in caller.iter_mut().enumerate().skip(1) {
+            *r = value(i as u16);
+        }
+        caller[0] = Some(0);
+        caller[usize::from(RISCV_SP)] = Some(cfa);
+        let sp = registers[usize::from(RISCV_SP)].unwrap_or(0);
+        match return_address {
+            /* No progress, the rules do not describe this frame */
+            Some(ra) if ra == pc && cfa <= sp => break,
+            Some(ra) => pc = ra,
+            None => break,
+        }
+        registers = caller;
+    }
+    Ok(pcs)
+}
+
+fn format_frame(index: &Index, n: usize, pc: u64) -> String {
+    let lookup = if n == 0 { pc } else { pc - 1 };
+    let mut frame = format!(
+        "#{:<3}0x{:08x} in {} ()",
+        n,
+        pc,
+        index.function(lookup).unwrap_or("??")
+    );
+    if let Some((file, line)) = index.line(lookup) {
+        frame += &format!(" at {}:{}", file, line);
+    }
+    frame
+}
+
+pub fn panic_details(core: &Path) -> Option<String> {
+    Core::open(core).ok()?.panic_details
+}
+
+/* Panic reason and backtraces of all tasks in the core dump. Err is returned
+ * for what only GDB handles: Xtensa windowed frames, core dumps in the
+ * binary format, ELFs without .debug_frame and frames it does not describe. */
+pub fn summary(elf_path: &Path, core_path: &Path) -> Result<String, String> {
+    let start = Instant::now();
+    let elf = Elf::open(elf_path).map_err(|e| format!("{:?}: {}", elf_path, e))?;
+    match elf.machine() {
+        Some(EM_RISCV) if !elf.class64 && elf.little_endian => (),
+        Some(EM_XTENSA) => return Err("Xtensa register windows are not unwound".to_string()),
+        machine => return Err(format!("Unsupported ELF machine {:?}", machine)),
+    }
+    let core = Core::open(core_path)?;
+    if core.tasks.is_empty() {
+        return Err("No task registers in the core dump".to_string());
+    }
+    let sections = elf.section_headers();
+    let debug_frame = sections
+        .iter()
+        .find(|sh| sh.name == ".debug_frame")
+        .and_then(|sh| elf.section_data(sh))
+        .unwrap_or_default();
+    let frames = FrameTable::new(debug_frame, 4);
+    if frames.is_empty() {
+        return Err("No .debug_frame in the ELF".to_string());
+    }
+    let index = Index::load(&elf, elf_path);
+    esp_debug_trace!("Backtrace index ready in {:?}", start.elapsed());
+
+    let mut out = String::new();
+    if let Some(details) = &core.panic_details {
+        out += &format!("Panic reason: {}\n", details);
+    }
+    if let Some(exception) = core.exception_summary() {
+        out += &format!("Exception: {}\n", exception);
+    }
+    let mut tasks: Vec<&Task> = core.tasks.iter().collect();
+    tasks.sort_by_key(|t| Some(t.tcb) != core.crashed_tcb);
+    for task in tasks {
+        out += &format!("\nTask 0x{:08x}", task.tcb);
+        if let Some(name) = core.task_name(task.tcb) {
+            out += &format!(" \"{}\"", name);
+        }
+        if Some(task.tcb) == core.crashed_tcb {
+            out += " (crashed)";
+        }
+        out += "\n";
+        let pcs =
+            unwind(&frames, &core, task).map_err(|e| format!("Task 0x{:08x}: {}", task.tcb, e))?;
+        for (n, pc) in pcs.into_iter().enumerate() {
+            out += &format_frame(&index, n, pc);
+            out += "\n";
+        }
+    }
+    esp_debug_trace!("Backtraces decoded in {:?}", start.elapsed());
+    Ok(out)
+}
@@ -0,0 +1,97 @@
+/* Start-up cost of the Python probe of the GDB wrapper: the probe python.rs
+ * runs (one interpreter run per candidate, all at once) against the former
+ * one interpreter run per fact:
+ *
+ *   cargo bench --bench python-probe -- [runs] [GDB Python versions...]
+ *
+ * Filesystem discovery and the probe cache are disabled, so every run starts
+ * the interpreters. */
+
+use lazy_static::lazy_static;
+use std::env;
+use std::process::{self, Command, Stdio};
+use std::time::{Duration, Instant};
+
+lazy_static! {
+    static ref ESP_DEBUG_TRACE: bool = env::var("ESP_DEBUG_TRACE").is_ok();
+}
+
+macro_rules! esp_debug_trace {
+    ($($arg:tt)*) => {
+        {
+            if *ESP_DEBUG_TRACE {
+                println!($($arg)*);
+            }
+        }
+    };
+}
+
+#[allow(dead_code)]
+#[path = "../cache.rs"]
+mod cache;
+#[allow(dead_code)]
+#[path = "../python.rs"]
+mod python;
+
+const DEFAULT_RUNS: u32 = 10;
+
+/* Probe programs of the wrapper before the combined probe, run as it did */
+const PER_FACT_PROBES: [&str; 4] = [
+    "import sys; print('{}.{}'.format(sys.version_info.major, sys.version_info.minor))",
+    "import sys, os, sysconfig; print(os.path.join(sys.base_prefix, 'lib'))",
+    "import sys; print(sys.base_prefix)",
+    "import os, sys; print(os.pathsep.join(sys.path[1:]))",
+];
+
+fn per_fact_probe() -> bool {
+    PER_FACT_PROBES.iter().all(|script| {
+        Command::new("python3")
+            .arg("-c")
+            .arg(script)
+            .stdout(Stdio::null())
+            .status()
+            .is_ok_and(|s| s.success())
+    })
+}
+
+fn measure<F: FnMut() -> bool>(runs: u32, mut probe: F) -> Option<Duration> {
+    let start = Instant::now();
+    for _ in 0..runs {
+        if !probe() {
+            return None;
+        }
+    }
+    Some(start.elapsed() / runs)
+}
+
+fn main() {
+    let args: Vec<String> = env::args().skip(1).filter(|a| a != "--bench").collect();
+    let runs = args
+        .first()
+        .and_then(|n| n.parse().ok())
+        .filter(|&n| n > 0)
+        .unwrap_or(DEFAULT_RUNS);
+    let gdb_versions: Vec<String> = args.iter().skip(1).cloned().collect();
+    env::set_var("ESP_GDB_WRAPPER_NO_CACHE", "1");
+    env::set_var("ESP_GDB_WRAPPER_NO_DISCOVERY", "1");
+
+    println!(
+        "{} runs of each probe, GDB Python versions {:?}",
+        runs, gdb_versions
+    );
+    for (name, time) in [
+        ("per-fact probe (4 spawns)", measure(runs, per_fact_probe)),
+        (
+            "wrapper probe",
+            measure(runs, || python::PythonInfo::get(&gdb_versions).is_some()),
+        ),
+    ] {
+        match time {
+            Some(time) => println!("{:<28}{:>12.1?}", name, time),
+            None => {
+                println!("{}: no usable python3", name);
+                process::exit(1);
+            }
+        }
+    }
+}
@@ -0,0 +1,276 @@
+/* Remote protocol throughput of GDB with and without
+ * ESP_GDB_WRAPPER_PROFILE=throughput, against a local RSP stub:
+ *
+ *   cargo bench --bench remote-profile -- <toolchain>/bin/xtensa-esp32-elf-gdb [bytes]
+ *
+ * The GDB wrapper of an installed toolchain is started, so the real GDB it
+ * selects transfers the memory. ESP_GDB_WRAPPER_BENCH_LATENCY_US adds a
+ * delay to every stub reply to model a JTAG adapter. */
+
+use std::env;
+use std::io::{self, BufReader, Read, Write};
+use std::net::{Ipv4Addr, TcpListener, TcpStream};
+use std::path::Path;
+use std::process::{self, Command, Stdio};
+use std::thread;
+use std::time::{Duration, Instant};
+
+const BASE_ADDRESS: u64 = 0x3fc8_0000;
+const DEFAULT_SIZE: u64 = 1024 * 1024;
+/* Reported by OpenOCD */
+const STUB_PACKET_SIZE: usize = 0x3fff;
+
+/* Memory traffic the stub has served */
+#[derive(Default)]
+struct Transfer {
+    bytes: u64,
+    packets: u64,
+    first: Option<Instant>,
+    last: Option<Instant>,
+}
+
+impl Transfer {
+    fn add(&mut self, bytes: u64) {
+        let now = Instant::now();
+        self.bytes += bytes;
+        self.packets += 1;
+        self.first.get_or_insert(now);
+        self.last = Some(now);
+    }
+
+    fn rate(&self) -> String {
+        match (self.first, self.last) {
+            (Some(first), Some(last)) if last > first => format!(
+                "{:.0} B/s",
+                self.bytes as f64 / (last - first).as_secs_f64()
+            ),
+            _ => "-".to_string(),
+        }
+    }
+}
+
+#[derive(Default)]
+struct StubStats {
+    read: Transfer,
+    write: Transfer,
+}
+
+/* Remote serial protocol stub with memory that reads back a pattern and
+ * ignores writes, enough for GDB to connect and transfer memory.
+ * "latency" is added to every reply to model a JTAG adapter. */
+struct Stub {
+    stream: TcpStream,
+    ack: bool,
+    latency: Duration,
+    stats: StubStats,
+}
+
+const HEX_DIGITS: &[u8; 16] = b"0123456789abcdef";
+
+fn hex_value(s: &str) -> Option<u64> {
+    u64::from_str_radix(s, 16).ok()
+}
+
+impl Stub {
+    fn send(&mut self, data: &str) -> io::Result<()> {
+        if !self.latency.is_zero() {
+            thread::sleep(self.latency);
+        }
+        let checksum = data.bytes().fold(0u8, |sum, b| sum.wrapping_add(b));
+        /* One write, a packet split over segments costs a round trip */
+        let packet = format!("${}#{:02x}", data, checksum);
+        self.stream.write_all(packet.as_bytes())
+    }
+
+    /* Packet data, None when GDB has disconnected */
+    fn receive(reader: &mut impl Read, ack: bool, stream: &mut TcpStream) -> Option<Vec<u8>> {
+        let mut byte = [0u8];
+        loop {
+            reader.read_exact(&mut byte).ok()?;
+            if byte[0] == b'$' {
+                break;
+            }
+        }
+        let mut data = vec![];
+        loop {
+            reader.read_exact(&mut byte).ok()?;
+            if byte[0] == b'#' {
+                break;
+            }
+            data.push(byte[0]);
+        }
+        let mut checksum = [0u8; 2];
+        reader.read_exact(&mut checksum).ok()?;
+        if ack {
+            stream.write_all(b"+").ok()?;
+        }
+        Some(data)
+    }
+
+    fn respond(&mut self, packet: &[u8]) -> Option<()> {
+        /* Data of X packets is binary, only the header is text */
+        let header = packet.split(|&b| b == b':').next()?;
+        let text = std::str::from_utf8(header).ok()?;
+        let reply = match packet.first()? {
+            b'm' => {
+                let (address, length) = text[1..].split_once(',')?;
+                let (address, length) = (hex_value(address)?, hex_value(length)?);
+                self.stats.read.add(length);
+                let mut reply = String::with_capacity(2 * length as usize);
+                for a in address..address + length {
+                    reply.push(HEX_DIGITS[(a as usize >> 4) & 0xf] as char);
+                    reply.push(HEX_DIGITS[a as usize & 0xf] as char);
+                }
+                reply
+            }
+            b'M' | b'X' => {
+                let (_, length) = text[1..].split_once(',')?;
+                let length = hex_value(length)?;
+                if length > 0 {
+                    self.stats.write.add(length);
+                }
+                "OK".to_string()
+            }
+            b'?' => "S05".to_string(),
+            b'g' => "00".repeat(16),
+            b'H' | b'T' => "OK".to_string(),
+            b'D' => {
+                let _ = self.send("OK");
+                return None;
+            }
+            b'k' => return None,
+            _ if text.starts_with("qSupported") => {
+                format!("PacketSize={:x};QStartNoAckMode+", STUB_PACKET_SIZE)
+            }
+            _ if text == "QStartNoAckMode" => {
+                self.send("OK").ok()?;
+                self.ack = false;
+                return Some(());
+            }
+            _ if text == "qAttached" => "1".to_string(),
+            _ if text == "qfThreadInfo" => "m1".to_string(),
+            _ if text == "qsThreadInfo" => "l".to_string(),
+            _ if text == "qC" => "QC1".to_string(),
+            _ => String::new(),
+        };
+        self.send(&reply).ok()
+    }
+
+    fn serve(listener: TcpListener, latency: Duration) -> io::Result<StubStats> {
+        let (stream, _) = listener.accept()?;
+        stream.set_nodelay(true)?;
+        let mut reader = BufReader::new(stream.try_clone()?);
+        let mut stub = Stub {
+            stream,
+            ack: true,
+            latency,
+            stats: StubStats::default(),
+        };
+        while let Some(packet) = Stub::receive(&mut reader, stub.ack, &mut stub.stream) {
+            if stub.respond(&packet).is_none() {
+                break;
+            }
+        }
+        Ok(stub.stats)
+    }
+}
+
+/* Transfer "size" bytes with "dump memory", "restore" and "x" in batch GDB
+ * connected to the stub, once with GDB defaults and once with the profile */
+fn main() {
+    let args: Vec<String> = env::args().skip(1).filter(|a| a != "--bench").collect();
+    let gdb = match args.first() {
+        Some(gdb) => Path::new(gdb),
+        None => {
+            eprintln!("Usage: remote-profile <xtensa-esp32-elf-gdb> [bytes]");
+            process::exit(1);
+        }
+    };
+    let size = args
+        .get(1)
+        .and_then(|n| n.parse().ok())
+        .unwrap_or(DEFAULT_SIZE);
+    let latency = env::var("ESP_GDB_WRAPPER_BENCH_LATENCY_US")
+        .ok()
+        .and_then(|us| us.parse().ok())
+        .map_or(Duration::ZERO, Duration::from_micros);
+    let dump = env::temp_dir().join(format!("esp-gdb-bench-{}.bin", process::id()));
+    println!(
+        "{} bytes with {:?} against a local RSP stub, {:?} per reply",
+        size, gdb, latency
+    );
+    println!(
+        "{:<12}{:>16}{:>16}{:>14}{:>14}{:>12}",
+        "profile", "read", "write", "read packets", "write packets", "total"
+    );
+    for profile in ["", "throughput"] {
+        let name = if profile.is_empty() {
+            "default"
+        } else {
+            profile
+        };
+        let listener = match TcpListener::bind((Ipv4Addr::LOCALHOST, 0)) {
+            Ok(listener) => listener,
+            Err(e) => {
+                println!("{}: {}", name, e);
+                return;
+            }
+        };
+        let port = listener.local_addr().map(|a| a.port()).unwrap_or_default();
+        let stub = thread::spawn(move || Stub::serve(listener, latency));
+        let start = Instant::now();
+        let end = BASE_ADDRESS + size;
+        let mut command = Command::new(gdb);
+        if profile.is_empty() {
+            command.env_remove("ESP_GDB_WRAPPER_PROFILE");
+        } else {
+            command.env("ESP_GDB_WRAPPER_PROFILE", profile);
+        }
+        let status = command
+            .args(["-nx", "-batch"])
+            .args(["-ex", &format!("target remote 127.0.0.1:{}", port)])
+            .args([
+                "-ex",
+                &format!(
+                    "dump binary memory {} {:#x} {:#x}",
+                    dump.display(),
+                    BASE_ADDRESS,
+                    end
+                ),
+            ])
+            .args([
+                "-ex",
+                &format!("restore {} binary {:#x}", dump.display(), BASE_ADDRESS),
+            ])
+            .args([
+                "-ex",
+                &format!("x/{}xb {:#x}", size.min(4096), end - size.min(4096)),
+            ])
+            .args(["-ex", "detach"])
+            .stdin(Stdio::null())
+            .stdout(Stdio::null())
+            .stderr(Stdio::null())
+            .status();
+        let elapsed = start.elapsed();
+        let _ = TcpStream::connect((Ipv4Addr::LOCALHOST, port)); // unblock if GDB never came
+        let stats = stub.join().ok().and_then(|r| r.ok());
+        match (status, stats) {
+            (Ok(status), Some(stats)) if status.success() && stats.read.packets == 0 => {
+                println!("{:<12}GDB did not read memory", name)
+            }
+            (Ok(status), Some(stats)) if status.success() => {
+                println!(
+                    "{:<12}{:>16}{:>16}{:>14}{:>14}{:>12.3?}",
+                    name,
+                    stats.read.rate(),
+                    stats.write.rate(),
+                    stats.read.packets,
+                    stats.write.packets,
+                    elapsed
+                )
+            }
+            (status, _) => println!("{:<12}GDB failed: {:?}", name, status),
+        }
+    }
+    let _ = std::fs::remove_file(&dump);
+}
@@ -0,0 +1,127 @@
+use super::ESP_DEBUG_TRACE;
+use std::env;
+use std::fs::{self, File, OpenOptions};
+use std::io::Write;
+use std::os::unix::fs::OpenOptionsExt;
+use std::os::unix::io::AsRawFd;
+use std::path::PathBuf;
+use std::process;
+
+const CACHE_DIR_NAME: &str = "esp-gdb-wrapper";
+
+/* Per-user cache directory. Set ESP_GDB_WRAPPER_NO_CACHE to disable caching,
+ * or ESP_GDB_WRAPPER_CACHE_DIR to use another location. */
+pub fn dir() -> Option<PathBuf> {
+    if env::var_os("ESP_GDB_WRAPPER_NO_CACHE").is_some() {
+        return None;
+    }
+    if let Some(d) = env::var_os("ESP_GDB_WRAPPER_CACHE_DIR") {
+        return Some(PathBuf::from(d));
+    }
+    match env::var_os("XDG_CACHE_HOME") {
+        Some(d) if !d.is_empty() => Some(PathBuf::from(d).join(CACHE_DIR_NAME)),
+        _ => Some(
+            PathBuf::from(env::var_os("HOME")?)
+                .join(".cache")
+                .join(CACHE_DIR_NAME),
+        ),
+    }
+}
+
+/* Cache entry is a text file: the first line is the key the value was
+ * computed for, the rest is the value. Entry with another key is a miss. */
+pub fn read(name: &str, key: &str) -> Option<String> {
+    let content = fs::read_to_string(dir()?.join(name)).ok()?;
+    let (entry_key, value) = content.split_once('\n')?;
+    if entry_key != key {
+        esp_debug_trace!("Cache {} is outdated", name);
+        return None;
+    }
+    Some(value.to_string())
+}
+
+/* Write to a temporary file and rename it, so readers never see
+ * a partially written entry. Entries are readable by the user only, the
+ * symbol server one holds its access token. */
+pub fn write(name: &str, key: &str, value: &str) {
+    let dir = match dir() {
+        Some(d) => d,
+        None => return,
+    };
+    if key.contains('\n') {
+        return;
+    }
+    let tmp_path = dir.join(format!(".{}.{}.tmp", name, process::id()));
+    let result = fs::create_dir_all(&dir)
+        .and_then(|_| {
+            OpenOptions::new()
+                .write(true)
+                .create(true)
+                .truncate(true)
+                .mode(0o600)
+                .open(&tmp_path)
+        })
+        .and_then(|mut f| f.write_all(format!("{}\n{}", key, value).as_bytes()))
+        .and_then(|_| fs::rename(&tmp_path, dir.join(name)));
+    if let Err(e) = result {
+        esp_debug_trace!("Failed to write cache {}: {}", name, e);
+        let _ = fs::remove_file(&tmp_path);
+    }
+}
+
+/* Exclusive advisory lock on the entry, released on drop */
+pub struct Lock(File);
+
+impl Lock {
+    pub fn acquire(name: &str) -> Option<Lock> {
+        let dir = dir()?;
+        fs::create_dir_all(&dir).ok()?;
+        let file = OpenOptions::new()
+            .create(true)
+            .truncate(false)
+            .write(true)
+            .open(dir.join(format!(".{}.lock", name)))
+            .ok()?;
+        if unsafe { libc::flock(file.as_raw_fd(), libc::LOCK_EX) } != 0 {
+            return None;
+        }
+        Some(Lock(file))
+    }
+}
+
+impl Drop for Lock {
+    fn drop(&mut self) {
+        unsafe { libc::flock(self.0.as_raw_fd(), libc::LOCK_UN) };
+    }
+}
+
+/* Return cached value or compute it. Computation is single-flight: concurrent
+ * callers wait on the entry lock and then reuse the value written by the first one. */
+pub fn get_or_insert_with<F>(name: &str, key: &str, f: F) -> Option<String>
+where
+    F: FnOnce() -> Option<String>,
+{
+    get_or_refresh_with(name, key, |_| true, f)
+}
+
+/* Same as get_or_insert_with(), a value `current` rejects is computed again */
+pub fn get_or_refresh_with<C, F>(name: &str, key: &str, current: C, f: F) -> Option<String>
+where
+    C: Fn(&str) -> bool,
+    F: FnOnce() -> Option<String>,
+{
+    let read = |name, key| read(name, key).filter(|value| current(value));
+    if let Some(value) = read(name, key) {
+        esp_debug_trace!("Cache {} hit", name);
+        return Some(value);
+    }
+    let _lock = Lock::acquire(name);
+    if let Some(value) = read(name, key) {
+        esp_debug_trace!("Cache {} filled by concurrent process", name);
+        return Some(value);
+    }
+    esp_debug_trace!("Cache {} miss", name);
+    let value = f()?;
+    write(name, key, &value);
+    Some(value)
+}
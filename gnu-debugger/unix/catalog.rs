@@ -0,0 +1,134 @@
+use super::{ESP_DEBUG_TRACE, EXE_EXTENSION, GDB_NOPYTHON_POSTFIX};
+use std::fs;
+use std::path::{Path, PathBuf};
+
+/* GDB binaries installed next to the wrapper "{arch}-{chip}-elf-gdb":
+ * "{arch}-{chip}-elf-gdb-{python}" and "{arch}-{chip}-elf-gdb-no-python".
+ * The directory is listed once, selection and fallback do not touch the
+ * filesystem again (every stat() costs a round trip on network mounts). */
+pub struct Catalog {
+    pub dynconfig: Option<String>,
+    gdb_base: String,
+    no_python: bool,
+    /* Python versions of GDB-with-Python binaries, sorted by (major, minor) */
+    versions: Vec<(u32, u32)>,
+}
+
+/* "3.11" -> (3, 11) */
+fn parse_version(version: &str) -> Option<(u32, u32)> {
+    let (major, minor) = version.split_once('.')?;
+    let is_number = |s: &str| !s.is_empty() && s.chars().all(|c| c.is_ascii_digit());
+    if !is_number(major) || !is_number(minor) {
+        return None;
+    }
+    Some((major.parse().ok()?, minor.parse().ok()?))
+}
+
+impl Catalog {
+    /* Xtensa GDB is common for all chips and loads the chip configuration from
+     * the dynconfig library */
+    pub fn scan(wrapper_path: &Path) -> Catalog {
+        let wrapper_name = wrapper_path
+            .file_name()
+            .expect("Filename in argv[0]")
+            .to_str()
+            .unwrap();
+        let bin_dir = wrapper_path
+            .parent()
+            .expect("Executable must be in some directory");
+
+        let mut arch = "";
+        let mut chip = "";
+        for (i, s) in wrapper_name.split("-").enumerate() {
+            match i {
+                0 => arch = s,
+                1 => chip = s,
+                _ => (),
+            }
+        }
+
+        let mut dynconfig = None;
+        if arch == "xtensa" {
+            let dynconfig_path = bin_dir
+                .parent()
+                .expect("Executable must be in some directory")
+                .join("lib")
+                .join(format!("xtensa_{}.so", chip))
+                .as_path()
+                .display()
+                .to_string();
+            dynconfig = Some(dynconfig_path);
+            chip = "esp";
+        }
+        let gdb_name = format!("{}-{}-elf-gdb-", arch, chip);
+
+        let mut no_python = false;
+        let mut versions = vec![];
+        if let Ok(entries) = fs::read_dir(bin_dir) {
+            for name in entries.filter_map(|e| e.ok()?.file_name().into_string().ok()) {
+                let suffix = match name
+                    .strip_prefix(&gdb_name)
+                    .and_then(|s| s.strip_suffix(EXE_EXTENSION))
+                {
+                    Some(s) => s,
+                    None => continue,
+                };
+                if suffix == GDB_NOPYTHON_POSTFIX {
+                    no_python = true;
+                } else if let Some(version) = parse_version(suffix) {
+                    versions.push(version);
+                }
+            }
+        }
+        versions.sort();
+
+        let catalog = Catalog {
+            dynconfig,
+            gdb_base: bin_dir.join(gdb_name).display().to_string(),
+            no_python,
+            versions,
+        };
+        esp_debug_trace!(
+            "GDB variants in {:?}: no-python: {}, Python {:?}",
+            bin_dir,
+            catalog.no_python,
+            catalog.python_versions()
+        );
+        catalog
+    }
+
+    fn path(&self, suffix: &str) -> PathBuf {
+        PathBuf::from(format!("{}{}{}", self.gdb_base, suffix, EXE_EXTENSION))
+    }
+
+    /* Python versions GDB is built for, oldest first */
+    pub fn python_versions(&self) -> Vec<String> {
+        self.versions
+            .iter()
+            .map(|(major, minor)| format!("{}.{}", major, minor))
+            .collect()
+    }
+
+    /* Assume that gdb-no-python is exist always */
+    pub fn gdb_no_python(&self) -> PathBuf {
+        let path = self.path(GDB_NOPYTHON_POSTFIX);
+        assert!(self.no_python, "Executable {:?} is not exist", path);
+        path
+    }
+
+    /* GDB linked with libpython of the same major.minor version as the Python
+     * environment; libpython ABI is not compatible across minor versions */
+    pub fn gdb_with_python(&self, version: &str) -> Option<PathBuf> {
+        let version = parse_version(version)?;
+        self.versions
+            .contains(&version)
+            .then(|| self.path(&format!("{}.{}", version.0, version.1)))
+    }
+
+    /* If gdb with-python but no binary found switch to gdb-no-python */
+    pub fn select(&self, python_version: Option<&str>) -> PathBuf {
+        let gdb = python_version.and_then(|v| self.gdb_with_python(v));
+        esp_debug_trace!("GDB for Python {:?}: {:?}", python_version, gdb);
+        gdb.unwrap_or_else(|| self.gdb_no_python())
+    }
+}
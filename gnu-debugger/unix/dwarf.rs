@@ -0,0 +1,876 @@
+use std::collections::HashMap;
+
+/* Line tables of .debug_line (DWARF 2 to 5) and call frame information of
+ * .debug_frame, what a backtrace needs without .debug_info. ESP chips are
+ * little-endian. */
+
+const DW_LNS_COPY: u8 = 1;
+const DW_LNS_ADVANCE_PC: u8 = 2;
+const DW_LNS_ADVANCE_LINE: u8 = 3;
+const DW_LNS_SET_FILE: u8 = 4;
+const DW_LNS_CONST_ADD_PC: u8 = 8;
+const DW_LNS_FIXED_ADVANCE_PC: u8 = 9;
+const DW_LNE_END_SEQUENCE: u8 = 1;
+const DW_LNE_SET_ADDRESS: u8 = 2;
+const DW_LNE_DEFINE_FILE: u8 = 3;
+
+const DW_LNCT_PATH: u64 = 1;
+const DW_LNCT_DIRECTORY_INDEX: u64 = 2;
+
+const DW_FORM_BLOCK2: u64 = 0x03;
+const DW_FORM_BLOCK4: u64 = 0x04;
+const DW_FORM_DATA2: u64 = 0x05;
+const DW_FORM_DATA4: u64 = 0x06;
+const DW_FORM_DATA8: u64 = 0x07;
+const DW_FORM_STRING: u64 = 0x08;
+const DW_FORM_BLOCK: u64 = 0x09;
+const DW_FORM_BLOCK1: u64 = 0x0a;
+const DW_FORM_DATA1: u64 = 0x0b;
+const DW_FORM_STRP: u64 = 0x0e;
+const DW_FORM_UDATA: u64 = 0x0f;
+const DW_FORM_DATA16: u64 = 0x1e;
+const DW_FORM_LINE_STRP: u64 = 0x1f;
+
+const DW_CFA_ADVANCE_LOC: u8 = 0x40;
+const DW_CFA_OFFSET: u8 = 0x80;
+const DW_CFA_RESTORE: u8 = 0xc0;
+const DW_CFA_NOP: u8 = 0x00;
+const DW_CFA_SET_LOC: u8 = 0x01;
+const DW_CFA_ADVANCE_LOC1: u8 = 0x02;
+const DW_CFA_ADVANCE_LOC2: u8 = 0x03;
+const DW_CFA_ADVANCE_LOC4: u8 = 0x04;
+const DW_CFA_OFFSET_EXTENDED: u8 = 0x05;
+const DW_CFA_RESTORE_EXTENDED: u8 = 0x06;
+const DW_CFA_UNDEFINED: u8 = 0x07;
+const DW_CFA_SAME_VALUE: u8 = 0x08;
+const DW_CFA_REGISTER: u8 = 0x09;
+const DW_CFA_REMEMBER_STATE: u8 = 0x0a;
+const DW_CFA_RESTORE_STATE: u8 = 0x0b;
+const DW_CFA_DEF_CFA: u8 = 0x0c;
+const DW_CFA_DEF_CFA_REGISTER: u8 = 0x0d;
+const DW_CFA_DEF_CFA_OFFSET: u8 = 0x0e;
+const DW_CFA_OFFSET_EXTENDED_SF: u8 = 0x11;
+const DW_CFA_DEF_CFA_SF: u8 = 0x12;
+const DW_CFA_DEF_CFA_OFFSET_SF: u8 = 0x13;
+const DW_CFA_VAL_OFFSET: u8 = 0x14;
+const DW_CFA_VAL_OFFSET_SF: u8 = 0x15;
+const DW_CFA_GNU_ARGS_SIZE: u8 = 0x2e;
+
+const CIE_ID_32: u64 = 0xffff_ffff;
+const CIE_ID_64: u64 = u64::MAX;
+
+struct Reader<'a> {
+    data: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Reader<'a> {
+    fn new(data: &'a [u8]) -> Reader<'a> {
+        Reader { data, pos: 0 }
+    }
+
+    fn at_end(&self) -> bool {
+        self.pos >= self.data.len()
+    }
+
+    fn bytes(&mut self, n: usize) -> Option<&'a [u8]> {
+        let bytes = self.data.get(self.pos..self.pos.checked_add(n)?)?;
+        self.pos += n;
+        Some(bytes)
+    }
+
+    fn u8(&mut self) -> Option<u8> {
+        Some(self.bytes(1)?[0])
+    }
+
+    fn u16(&mut self) -> Option<u16> {
+        Some(u16::from_le_bytes(self.bytes(2)?.try_into().ok()?))
+    }
+
+    fn u32(&mut self) -> Option<u32> {
+        Some(u32::from_le_bytes(self.bytes(4)?.try_into().ok()?))
+    }
+
+    fn u64(&mut self) -> Option<u64> {
+        Some(u64::from_le_bytes(self.bytes(8)?.try_into().ok()?))
+    }
+
+    /* Field of "size" bytes: addresses and section offsets */
+    fn sized(&mut self, size: u8) -> Option<u64> {
+        match size {
+            1 => self.u8().map(u64::from),
+            2 => self.u16().map(u64::from),
+            4 => self.u32().map(u64::from),
+            8 => self.u64(),
+            _ => None,
+        }
+    }
+
+    fn uleb(&mut self) -> Option<u64> {
+        let mut value = 0u64;
+        let mut shift = 0;
+        loop {
+            let b = self.u8()?;
+            if shift < 64 {
+                value |= u64::from(b & 0x7f) << shift;
+            }
+            shift += 7;
+            if b & 0x80 == 0 {
+                return Some(value);
+            }
+        }
+    }
+
+    fn sleb(&mut self) -> Option<i64> {
+        let mut value = 0i64;
+        let mut shift = 0;
+        loop {
+            let b = self.u8()?;
+            if shift < 64 {
+                value |= i64::from(b & 0x7f) << shift;
+            }
+            shift += 7;
+            if b & 0x80 == 0 {
+                if shift < 64 && b & 0x40 != 0 {
+                    value |= -1 << shift;
+                }
+                return Some(value);
+            }
+        }
+    }
+
+    fn c_str(&mut self) -> Option<&'a str> {
+        let tail = self.data.get(self.pos..)?;
+        let end = tail.iter().position(|&c| c == 0)?;
+        self.pos += end + 1;
+        std::str::from_utf8(&tail[..end]).ok()
+    }
+
+    /* Unit length: 32-bit DWARF, or 64-bit after the 0xffffffff escape.
+     * Returns the unit contents and the size of section offsets in it. */
+    fn unit(&mut self) -> Option<(Reader<'a>, u8)> {
+        let (length, offset_size) = match self.u32()? {
+            0xffff_ffff => (self.u64()?, 8),
+            length => (u64::from(length), 4),
+        };
+        let unit = self.bytes(usize::try_from(length).ok()?)?;
+        Some((Reader::new(unit), offset_size))
+    }
+}
+
+fn c_str_at(section: &[u8], offset: u64) -> Option<&str> {
+    let mut reader = Reader::new(section);
+    reader.pos = usize::try_from(offset).ok()?;
+    reader.c_str()
+}
+
+/* Row of a line table, rows of "end_sequence" end the previous range */
+pub struct LineRow {
+    pub address: u64,
+    pub file: u32,
+    pub line: u32,
+    pub end_sequence: bool,
+}
+
+/* Line tables of all compilation units. File names are merged into one list,
+ * sequences of code discarded by the linker (resolved to 0) are skipped. */
+pub struct LineTable {
+    pub files: Vec<String>,
+    pub rows: Vec<LineRow>,
+}
+
+/* String sections DWARF 5 line table headers refer to */
+pub struct StringSections<'a> {
+    pub debug_str: &'a [u8],
+    pub debug_line_str: &'a [u8],
+}
+
+struct EntryFormat {
+    content: u64,
+    form: u64,
+}
+
+fn read_form<'a>(
+    reader: &mut Reader<'a>,
+    form: u64,
+    offset_size: u8,
+    strings: &StringSections<'a>,
+) -> Option<(Option<&'a str>, u64)> {
+    Some(match form {
+        DW_FORM_STRING => (Some(reader.c_str()?), 0),
+        DW_FORM_LINE_STRP => (
+            c_str_at(strings.debug_line_str, reader.sized(offset_size)?),
+            0,
+        ),
+        DW_FORM_STRP => (c_str_at(strings.debug_str, reader.sized(offset_size)?), 0),
+        DW_FORM_UDATA => (None, reader.uleb()?),
+        DW_FORM_DATA1 => (None, reader.sized(1)?),
+        DW_FORM_DATA2 => (None, reader.sized(2)?),
+        DW_FORM_DATA4 => (None, reader.sized(4)?),
+        DW_FORM_DATA8 => (None, reader.sized(8)?),
+        DW_FORM_DATA16 => {
+            reader.bytes(16)?;
+            (None, 0)
+        }
+        DW_FORM_BLOCK | DW_FORM_BLOCK1 | DW_FORM_BLOCK2 | DW_FORM_BLOCK4 => {
+            let length = match form {
+                DW_FORM_BLOCK1 => reader.sized(1)?,
+                DW_FORM_BLOCK2 => reader.sized(2)?,
+                DW_FORM_BLOCK4 => reader.sized(4)?,
+                _ => reader.uleb()?,
+            };
+            reader.bytes(usize::try_from(length).ok()?)?;
+            (None, 0)
+        }
+        _ => return None,
+    })
+}
+
+/* DWARF 5 directory and file name tables: (path, directory index) */
+fn read_entries<'a>(
+    reader: &mut Reader<'a>,
+    offset_size: u8,
+    strings: &StringSections<'a>,
+) -> Option<Vec<(&'a str, u64)>> {
+    let formats: Vec<EntryFormat> = (0..reader.u8()?)
+        .map(|_| {
+            Some(EntryFormat {
+                content: reader.uleb()?,
+                form: reader.uleb()?,
+            })
+        })
+        .collect::<Option<_>>()?;
+    let count = reader.uleb()?;
+    let mut entries = vec![];
+    for _ in 0..count {
+        let mut entry = ("", 0);
+        for format in &formats {
+            let (string, value) = read_form(reader, format.form, offset_size, strings)?;
+            match format.content {
+                DW_LNCT_PATH => entry.0 = string?,
+                DW_LNCT_DIRECTORY_INDEX => entry.1 = value,
+                _ => (),
+            }
+        }
+        entries.push(entry);
+    }
+    Some(entries)
+}
+
+fn join_path(dir: Option<&str>, name: &str) -> String {
+    match dir {
+        Some(dir) if !dir.is_empty() && !name.starts_with('/') => format!("{}/{}", dir, name),
+        _ => name.to_string(),
+    }
+}
+
+/* Parse one line number program, adding its rows to "table". File indices
+ * of the unit are mapped to the merged file list through "file_ids". */
+fn parse_unit<'a>(
+    mut unit: Reader<'a>,
+    offset_size: u8,
+    strings: &StringSections<'a>,
+    table: &mut LineTable,
+    file_ids: &mut HashMap<String, u32>,
+) -> Option<()> {
+    let version = unit.u16()?;
+    if version >= 5 {
+        unit.u8()?; // address size, DW_LNE_set_address tells it too
+        unit.u8()?; // segment selector size
+    }
+    let header_length = unit.sized(offset_size)?;
+    let program_start = unit.pos.checked_add(usize::try_from(header_length).ok()?)?;
+    let min_inst_length = u64::from(unit.u8()?);
+    if version >= 4 {
+        unit.u8()?; // maximum operations per instruction, 1 for non-VLIW
+    }
+    unit.u8()?; // default_is_stmt, all rows are used
+    let line_base = unit.u8()? as i8;
+    let line_range = unit.u8()?;
+    let opcode_base = unit.u8()?;
+    if line_range == 0 {
+        return None;
+    }
+    let opcode_lengths = unit.bytes(usize::from(opcode_base.saturating_sub(1)))?;
+
+    let mut unit_files: Vec<String> = vec![];
+    if version >= 5 {
+        let dirs = read_entries(&mut unit, offset_size, strings)?;
+        for (name, dir) in read_entries(&mut unit, offset_size, strings)? {
+            let dir = dirs.get(dir as usize).map(|d| d.0);
+            unit_files.push(join_path(dir, name));
+        }
+    } else {
+        let mut dirs = vec![];
+        loop {
+            let dir = unit.c_str()?;
+            if dir.is_empty() {
+                break;
+            }
+            dirs.push(dir);
+        }
+        /* File 0 is not used before DWARF 5 */
+        unit_files.push(String::new());
+        loop {
+            let name = unit.c_str()?;
+            if name.is_empty() {
+                break;
+            }
+            let dir = unit.uleb()?;
+            unit.uleb()?; // modification time
+            unit.uleb()?; // length
+            let dir = dir
+                .checked_sub(1)
+                .and_then(|d| dirs.get(d as usize).copied());
+            unit_files.push(join_path(dir, name));
+        }
+    }
+
+    unit.pos = program_start;
+    let (mut address, mut file, mut line) = (0u64, 1u64, 1i64);
+    /* Rows with file indices of the unit */
+    let mut rows: Vec<LineRow> = vec![];
+    let mut sequence: Vec<LineRow> = vec![];
+    let row = |sequence: &mut Vec<LineRow>, address: u64, file: u64, line: i64, end: bool| {
+        sequence.push(LineRow {
+            address,
+            file: u32::try_from(file).unwrap_or(u32::MAX),
+            line: line.clamp(0, i64::from(u32::MAX)) as u32,
+            end_sequence: end,
+        });
+    };
+    while !unit.at_end() {
+        let opcode = unit.u8()?;
+        if opcode >= opcode_base {
+            let adjusted = opcode - opcode_base;
+            address += u64::from(adjusted / line_range) * min_inst_length;
+            line += i64::from(line_base) + i64::from(adjusted % line_range);
+            row(&mut sequence, address, file, line, false);
+            continue;
+        }
+        match opcode {
+            0 => {
+                let length = unit.uleb()?;
+                let end = unit.pos.checked_add(usize::try_from(length).ok()?)?;
+                match unit.u8()? {
+                    DW_LNE_END_SEQUENCE => {
+                        row(&mut sequence, address, file, line, true);
+                        /* Code the linker discarded keeps its lines at address 0 */
+                        if sequence.first().is_some_and(|r| r.address != 0) {
+                            rows.append(&mut sequence);
+                        }
+                        sequence.clear();
+                        (address, file, line) = (0, 1, 1);
+                    }
+                    DW_LNE_SET_ADDRESS => {
+                        address = unit.sized(u8::try_from(length - 1).ok()?)?;
+                    }
+                    DW_LNE_DEFINE_FILE => {
+                        unit_files.push(unit.c_str()?.to_string());
+                    }
+                    _ => (),
+                }
+                unit.pos = end;
+            }
+            DW_LNS_COPY => row(&mut sequence, address, file, line, false),
+            DW_LNS_ADVANCE_PC => address += unit.uleb()? * min_inst_length,
+            DW_LNS_ADVANCE_LINE => line += unit.sleb()?,
+            DW_LNS_SET_FILE => file = unit.uleb()?,
+            DW_LNS_CONST_ADD_PC => {
+                address += u64::from((255 - opcode_base) / line_range) * min_inst_length
+            }
+            DW_LNS_FIXED_ADVANCE_PC => address += u64::from(unit.u16()?),
+            _ => {
+                /* Other standard opcodes only change registers a backtrace does not use */
+                for _ in 0..opcode_lengths[usize::from(opcode - 1)] {
+                    unit.uleb()?;
+                }
+            }
+        }
+    }
+    for mut r in rows {
+        let name = unit_files.get(r.file as usize).cloned().unwrap_or_default();
+        r.file = *file_ids.entry(name.clone()).or_insert_with(|| {
+            table.files.push(name);
+            (table.files.len() - 1) as u32
+        });
+        table.rows.push(r);
+    }
+    Some(())
+}
+
+/* All line tables of .debug_line. A malformed unit ends the parsing, rows of
+ * the units before it are kept. */
+pub fn line_table(debug_line: &[u8], strings: &StringSections) -> LineTable {
+    let mut table = LineTable {
+        files: vec![],
+        rows: vec![],
+    };
+    let mut file_ids = HashMap::new();
+    let mut reader = Reader::new(debug_line);
+    while !reader.at_end() {
+        let (unit, offset_size) = match reader.unit() {
+            Some(unit) => unit,
+            None => break,
+        };
+        if parse_unit(unit, offset_size, strings, &mut table, &mut file_ids).is_none() {
+            break;
+        }
+    }
+    table
+}
+
+/* How the caller's value of a register is found */
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum Rule {
+    Undefined,
+    SameValue,
+    /* Saved at CFA + offset */
+    Offset(i64),
+    /* The value is CFA + offset */
+    ValOffset(i64),
+    Register(u16),
+}
+
+/* Unwind rules at an address: CFA is "register" + "offset" */
+#[derive(Clone)]
+pub struct Frame {
+    pub cfa_register: u16,
+    pub cfa_offset: i64,
+    pub return_address: u16,
+    rules: HashMap<u16, Rule>,
+}
+
+impl Frame {
+    /* Registers without a rule keep their values, what GCC expects for
+     * callee-saved registers */
+    pub fn rule(&self, register: u16) -> Rule {
+        self.rules
+            .get(&register)
+            .copied()
+            .unwrap_or(Rule::SameValue)
+    }
+}
+
+struct Cie<'a> {
+    code_align: u64,
+    data_align: i64,
+    return_address: u16,
+    address_size: u8,
+    instructions: &'a [u8],
+}
+
+struct Fde {
+    start: u64,
+    end: u64,
+    cie: usize,
+    instructions: (usize, usize),
+}
+
+/* Frame description entries of .debug_frame sorted by address, their
+ * instructions are run only for the frames being unwound */
+pub struct FrameTable<'a> {
+    section: &'a [u8],
+    address_size: u8,
+    fdes: Vec<Fde>,
+}
+
+impl<'a> FrameTable<'a> {
+    pub fn new(debug_frame: &'a [u8], address_size: u8) -> FrameTable<'a> {
+        let mut table = FrameTable {
+            section: debug_frame,
+            address_size,
+            fdes: vec![],
+        };
+        let mut reader = Reader::new(debug_frame);
+        while !reader.at_end() {
+            let (mut entry, offset_size) = match reader.unit() {
+                Some(entry) => entry,
+                None => break,
+            };
+            let entry_start = reader.pos - entry.data.len();
+            let id = match entry.sized(offset_size) {
+                Some(id) => id,
+                None => break,
+            };
+            if id == CIE_ID_32 && offset_size == 4 || id == CIE_ID_64 {
+                continue;
+            }
+            let cie = match table.cie(id as usize) {
+                Some(cie) => cie,
+                None => continue,
+            };
+            let (start, range) =
+                match (entry.sized(cie.address_size), entry.sized(cie.address_size)) {
+                    (Some(start), Some(range)) => (start, range),
+                    _ => continue,
+                };
+            table.fdes.push(Fde {
+                start,
+                end: start.saturating_add(range),
+                cie: id as usize,
+                instructions: (entry_start + entry.pos, entry_start + entry.data.len()),
+            });
+        }
+        /* Discarded functions keep FDEs at address 0 */
+        table.fdes.retain(|f| f.start != 0 && f.end > f.start);
+        table.fdes.sort_by_key(|f| f.start);
+        table
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.fdes.is_empty()
+    }
+
+    fn cie(&self, offset: usize) -> Option<Cie<'a>> {
+        let mut reader = Reader::new(self.section);
+        reader.pos = offset;
+        let (mut cie, offset_size) = reader.unit()?;
+        cie.sized(offset_size)?;
+        let version = cie.u8()?;
+        let augmentation = cie.c_str()?;
+        /* No augmentation data in .debug_frame, GCC writes none there */
+        if !augmentation.is_empty() {
+            return None;
+        }
+        let mut address_size = self.address_size;
+        if version >= 4 {
+            address_size = cie.u8()?;
+            cie.u8()?; // segment selector size
+        }
+        let code_align = cie.uleb()?;
+        let data_align = cie.sleb()?;
+        let return_address = if version == 1 {
+            u16::from(cie.u8()?)
+        } else {
+            u16::try_from(cie.uleb()?).ok()?
+        };
+        Some(Cie {
+            code_align,
+            data_align,
+            return_address,
+            address_size,
+            instructions: &cie.data[cie.pos..],
+        })
+    }
+
+    /* Rules to unwind the frame executing at "pc". None when there is no FDE
+     * for it, or when the rules use DWARF expressions. */
+    pub fn frame(&self, pc: u64) -> Option<Frame> {
+        let i = self
+            .fdes
+            .partition_point(|f| f.start <= pc)
+            .checked_sub(1)?;
+        let fde = &self.fdes[i];
+        if pc >= fde.end {
+            return None;
+        }
+        let cie = self.cie(fde.cie)?;
+        let mut frame = Frame {
+            cfa_register: 0,
+            cfa_offset: 0,
+            return_address: cie.return_address,
+            rules: HashMap::new(),
+        };
+        let mut location = u64::MAX;
+        execute(&cie, cie.instructions, &mut frame, None, &mut location, pc)?;
+        let initial = frame.clone();
+        location = fde.start;
+        let instructions = self.section.get(fde.instructions.0..fde.instructions.1)?;
+        execute(
+            &cie,
+            instructions,
+            &mut frame,
+            Some(&initial),
+            &mut location,
+            pc,
+        )?;
+        Some(frame)
+    }
+}
+
+/* Run CFA instructions up to the row covering "pc". "initial" holds the
+ * rules after the CIE instructions, DW_CFA_restore returns to them. */
+fn execute(
+    cie: &Cie,
+    instructions: &[u8],
+    frame: &mut Frame,
+    initial: Option<&Frame>,
+    location: &mut u64,
+    pc: u64,
+) -> Option<()> {
+    let mut reader = Reader::new(instructions);
+    let mut stack: Vec<Frame> = vec![];
+    let restore =
+        |frame: &mut Frame, register: u16| match initial.and_then(|i| i.rules.get(&register)) {
+            Some(rule) => {
+                frame.rules.insert(register, *rule);
+            }
+            None => {
+                frame.rules.remove(&register);
+            }
+        };
+    while !reader.at_end() {
+        let instruction = reader.u8()?;
+        let (high, low) = (instruction & 0xc0, instruction & 0x3f);
+        let advance = match (high, instruction) {
+            (DW_CFA_ADVANCE_LOC, _) => Some(u64::from(low)),
+            (0, DW_CFA_ADVANCE_LOC1) => Some(reader.sized(1)?),
+            (0, DW_CFA_ADVANCE_LOC2) => Some(reader.sized(2)?),
+            (0, DW_CFA_ADVANCE_LOC4) => Some(reader.sized(4)?),
+            _ => None,
+        };
+        if let Some(delta) = advance {
+            *location = location.saturating_add(delta * cie.code_align);
+            if *location > pc {
+                break;
+            }
+            continue;
+        }
+        match (high, instruction) {
+            (DW_CFA_OFFSET, _) => {
+                let offset = reader.uleb()? as i64 * cie.data_align;
+                frame.rules.insert(u16::from(low), Rule::Offset(offset));
+            }
+            (DW_CFA_RESTORE, _) => restore(frame, u16::from(low)),
+            (_, DW_CFA_NOP) | (_, DW_CFA_GNU_ARGS_SIZE) => {
+                if instruction == DW_CFA_GNU_ARGS_SIZE {
+                    reader.uleb()?;
+                }
+            }
+            (_, DW_CFA_SET_LOC) => {
+                *location = reader.sized(cie.address_size)?;
+                if *location > pc {
+                    break;
+                }
+            }
+            (_, DW_CFA_OFFSET_EXTENDED) => {
+                let register = u16::try_from(reader.uleb()?).ok()?;
+                let offset = reader.uleb()? as i64 * cie.data_align;
+                frame.rules.insert(register, Rule::Offset(offset));
+            }
+            (_, DW_CFA_OFFSET_EXTENDED_SF) => {
+                let register = u16::try_from(reader.uleb()?).ok()?;
+                let offset = reader.sleb()? * cie.data_align;
+                frame.rules.insert(register, Rule::Offset(offset));
+            }
+            (_, DW_CFA_VAL_OFFSET) => {
+                let register = u16::try_from(reader.uleb()?).ok()?;
+                let offset = reader.uleb()? as i64 * cie.data_align;
+                frame.rules.insert(register, Rule::ValOffset(offset));
+            }
+            (_, DW_CFA_VAL_OFFSET_SF) => {
+                let register = u16::try_from(reader.uleb()?).ok()?;
+                let offset = reader.sleb()? * cie.data_align;
+                frame.rules.insert(register, Rule::ValOffset(offset));
+            }
+            (_, DW_CFA_RESTORE_EXTENDED) => restore(frame, u16::try_from(reader.uleb()?).ok()?),
+            (_, DW_CFA_UNDEFINED) => {
+                frame
+                    .rules
+                    .insert(u16::try_from(reader.uleb()?).ok()?, Rule::Undefined);
+            }
+            (_, DW_CFA_SAME_VALUE) => {
+                frame
+                    .rules
+                    .insert(u16::try_from(reader.uleb()?).ok()?, Rule::SameValue);
+            }
+            (_, DW_CFA_REGISTER) => {
+                let register = u16::try_from(reader.uleb()?).ok()?;
+                let source = u16::try_from(reader.uleb()?).ok()?;
+                frame.rules.insert(register, Rule::Register(source));
+            }
+            (_, DW_CFA_REMEMBER_STATE) => stack.push(frame.clone()),
+            /* The CFA is restored too, as GDB and libgcc do */
+            (_, DW_CFA_RESTORE_STATE) => *frame = stack.pop()?,
+            (_, DW_CFA_DEF_CFA) => {
+                frame.cfa_register = u16::try_from(reader.uleb()?).ok()?;
+                frame.cfa_offset = reader.uleb()? as i64;
+            }
+            (_, DW_CFA_DEF_CFA_SF) => {
+                frame.cfa_register = u16::try_from(reader.uleb()?).ok()?;
+                frame.cfa_offset = reader.sleb()? * cie.data_align;
+            }
+            (_, DW_CFA_DEF_CFA_REGISTER) => {
+                frame.cfa_register = u16::try_from(reader.uleb()?).ok()?;
+            }
+            (_, DW_CFA_DEF_CFA_OFFSET) => frame.cfa_offset = reader.uleb()? as i64,
+            (_, DW_CFA_DEF_CFA_OFFSET_SF) => {
+                frame.cfa_offset = reader.sleb()? * cie.data_align;
+            }
+            /* DW_CFA_def_cfa_expression, DW_CFA_expression and vendor extensions */
+            _ => return None,
+        }
+    }
+    Some(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /* 32-bit DWARF unit: length, then "body" */
+    fn unit(body: &[u8]) -> Vec<u8> {
+        let mut unit = (body.len() as u32).to_le_bytes().to_vec();
+        unit.extend_from_slice(body);
+        unit
+    }
+
+    /* DWARF 4 line program of "src/main.c" */
+    fn line_unit(program: &[u8]) -> Vec<u8> {
+        let mut header = vec![
+            1,    // minimum instruction length
+            1,    // maximum operations per instruction
+            1,    // default_is_stmt
+            0xfb, // line_base -5
+            14,   // line_range
+            13,   // opcode_base
+        ];
+        header.extend_from_slice(&[0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1]);
+        header.extend_from_slice(b"src\0\0");
+        header.extend_from_slice(b"main.c\0\x01\0\0\0");
+        let mut body = 4u16.to_le_bytes().to_vec();
+        body.extend_from_slice(&(header.len() as u32).to_le_bytes());
+        body.extend_from_slice(&header);
+        body.extend_from_slice(program);
+        unit(&body)
+    }
+
+    fn set_address(address: u32) -> Vec<u8> {
+        let mut op = vec![0, 5, DW_LNE_SET_ADDRESS];
+        op.extend_from_slice(&address.to_le_bytes());
+        op
+    }
+
+    const END_SEQUENCE: [u8; 3] = [0, 1, DW_LNE_END_SEQUENCE];
+
+    const NO_STRINGS: StringSections = StringSections {
+        debug_str: &[],
+        debug_line_str: &[],
+    };
+
+    #[test]
+    fn leb128() {
+        let mut reader = Reader::new(&[0xe5, 0x8e, 0x26, 0xc0, 0xbb, 0x78, 0x7f, 0x80]);
+        assert_eq!(reader.uleb(), Some(624485));
+        assert_eq!(reader.sleb(), Some(-123456));
+        assert_eq!(reader.sleb(), Some(-1));
+        /* Truncated */
+        assert_eq!(reader.uleb(), None);
+    }
+
+    #[test]
+    fn line_rows() {
+        let mut program = set_address(0x4008_0000);
+        program.extend_from_slice(&[DW_LNS_ADVANCE_LINE, 9, DW_LNS_COPY]);
+        /* Special opcode: address + 4, line + 1 */
+        program.push(13 + (1 + 5) + 14 * 4);
+        program.extend_from_slice(&[DW_LNS_ADVANCE_PC, 4]);
+        program.extend_from_slice(&END_SEQUENCE);
+        /* Discarded by the linker */
+        program.extend_from_slice(&set_address(0));
+        program.push(DW_LNS_COPY);
+        program.extend_from_slice(&END_SEQUENCE);
+
+        let mut second = set_address(0x4009_0000);
+        second.push(DW_LNS_COPY);
+        second.extend_from_slice(&END_SEQUENCE);
+
+        let mut section = line_unit(&program);
+        section.extend_from_slice(&line_unit(&second));
+        /* A malformed unit keeps the rows read before it */
+        section.extend_from_slice(&[0xff, 0, 0]);
+
+        let table = line_table(&section, &NO_STRINGS);
+        assert_eq!(table.files, vec!["src/main.c"]);
+        let rows: Vec<_> = table
+            .rows
+            .iter()
+            .map(|r| (r.address, r.file, r.line, r.end_sequence))
+            .collect();
+        assert_eq!(
+            rows,
+            vec![
+                (0x4008_0000, 0, 10, false),
+                (0x4008_0004, 0, 11, false),
+                (0x4008_0008, 0, 11, true),
+                (0x4009_0000, 0, 1, false),
+                (0x4009_0000, 0, 1, true),
+            ]
+        );
+    }
+
+    fn fde(start: u32, range: u32, instructions: &[u8]) -> Vec<u8> {
+        let mut body = 0u32.to_le_bytes().to_vec();
+        body.extend_from_slice(&start.to_le_bytes());
+        body.extend_from_slice(&range.to_le_bytes());
+        body.extend_from_slice(instructions);
+        unit(&body)
+    }
+
+    /* Version 1 CIE at offset 0: code alignment 1, data alignment -4,
+     * return address in register 0, CFA is register 1 */
+    fn debug_frame() -> Vec<u8> {
+        let mut cie = CIE_ID_32.to_le_bytes()[..4].to_vec();
+        cie.extend_from_slice(&[1, 0]); // version, augmentation
+        cie.extend_from_slice(&[1, 0x7c, 0]);
+        cie.extend_from_slice(&[DW_CFA_DEF_CFA, 1, 0]);
+        let mut section = unit(&cie);
+        section.extend_from_slice(&fde(
+            0x4008_0000,
+            0x20,
+            &[
+                DW_CFA_ADVANCE_LOC | 3,
+                DW_CFA_DEF_CFA_OFFSET,
+                32,
+                DW_CFA_OFFSET,
+                3,
+                DW_CFA_ADVANCE_LOC | 5,
+                DW_CFA_REMEMBER_STATE,
+                DW_CFA_DEF_CFA_REGISTER,
+                7,
+                DW_CFA_ADVANCE_LOC | 4,
+                DW_CFA_RESTORE_STATE,
+            ],
+        ));
+        /* DW_CFA_def_cfa_expression */
+        section.extend_from_slice(&fde(0x4009_0000, 0x10, &[0x0f, 1, 0x50]));
+        /* Discarded by the linker */
+        section.extend_from_slice(&fde(0, 0x10, &[]));
+        section
+    }
+
+    #[test]
+    fn frame_rules() {
+        let section = debug_frame();
+        let table = FrameTable::new(&section, 4);
+        assert!(!table.is_empty());
+
+        let frame = table.frame(0x4008_0000).unwrap();
+        assert_eq!((frame.cfa_register, frame.cfa_offset), (1, 0));
+        assert_eq!(frame.return_address, 0);
+        assert_eq!(frame.rule(0), Rule::SameValue);
+
+        let frame = table.frame(0x4008_0003).unwrap();
+        assert_eq!((frame.cfa_register, frame.cfa_offset), (1, 32));
+        assert_eq!(frame.rule(0), Rule::Offset(-12));
+
+        let frame = table.frame(0x4008_0008).unwrap();
+        assert_eq!((frame.cfa_register, frame.cfa_offset), (7, 32));
+
+        /* DW_CFA_restore_state brings the CFA back too */
+        let frame = table.frame(0x4008_000c).unwrap();
+        assert_eq!((frame.cfa_register, frame.cfa_offset), (1, 32));
+        assert_eq!(frame.rule(0), Rule::Offset(-12));
+    }
+
+    #[test]
+    fn frame_not_found() {
+        let section = debug_frame();
+        let table = FrameTable::new(&section, 4);
+        assert!(table.frame(0x4007_ffff).is_none());
+        assert!(table.frame(0x4008_0020).is_none());
+        assert!(table.frame(0x4009_0000).is_none());
+        assert!(table.frame(0x8).is_none());
+    }
+}
@@ -0,0 +1,420 @@
+use std::fs::File;
+use std::io;
+use std::ops::Deref;
+use std::os::unix::io::AsRawFd;
+use std::path::Path;
+use std::ptr;
+use std::slice;
+
+const ELF_MAGIC: &[u8] = b"\x7fELF";
+const ELFCLASS64: u8 = 2;
+const ELFDATA2LSB: u8 = 1;
+
+const PT_LOAD: u32 = 1;
+const PT_DYNAMIC: u32 = 2;
+const PT_NOTE: u32 = 4;
+
+const SHT_NOTE: u32 = 7;
+const SHT_NOBITS: u32 = 8;
+
+const NT_GNU_BUILD_ID: u32 = 3;
+
+const DT_NULL: u64 = 0;
+const DT_NEEDED: u64 = 1;
+const DT_STRTAB: u64 = 5;
+const DT_STRSZ: u64 = 10;
+const DT_RPATH: u64 = 15;
+const DT_RUNPATH: u64 = 29;
+
+/* Read-only private mapping of the whole file */
+pub struct Mmap {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+impl Mmap {
+    pub fn open(path: &Path) -> io::Result<Mmap> {
+        let file = File::open(path)?;
+        let len = file.metadata()?.len() as usize;
+        if len == 0 {
+            return Err(io::Error::new(io::ErrorKind::InvalidData, "empty file"));
+        }
+        let ptr = unsafe {
+            libc::mmap(
+                ptr::null_mut(),
+                len,
+                libc::PROT_READ,
+                libc::MAP_PRIVATE,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(Mmap { ptr, len })
+    }
+}
+
+impl Deref for Mmap {
+    type Target = [u8];
+    fn deref(&self) -> &[u8] {
+        unsafe { slice::from_raw_parts(self.ptr as *const u8, self.len) }
+    }
+}
+
+impl Drop for Mmap {
+    fn drop(&mut self) {
+        unsafe { libc::munmap(self.ptr, self.len) };
+    }
+}
+
+pub struct ProgramHeader {
+    pub p_type: u32,
+    pub offset: u64,
+    pub vaddr: u64,
+    pub filesz: u64,
+}
+
+pub struct SectionHeader {
+    pub name: String,
+    pub sh_type: u32,
+    pub offset: u64,
+    pub size: u64,
+    pub link: u32,
+}
+
+pub struct Note<'a> {
+    pub name: &'a [u8],
+    pub n_type: u32,
+    pub desc: &'a [u8],
+}
+
+/* Dynamic section entries the dynamic loader uses to find dependencies */
+pub struct Dynamic {
+    pub needed: Vec<String>,
+    pub rpath: Vec<String>,
+    pub runpath: Vec<String>,
+}
+
+pub struct Elf {
+    data: Mmap,
+    pub class64: bool,
+    pub little_endian: bool,
+}
+
+impl Elf {
+    pub fn open(path: &Path) -> io::Result<Elf> {
+        let data = Mmap::open(path)?;
+        if data.len() < 0x40 || &data[..4] != ELF_MAGIC {
+            return Err(io::Error::new(io::ErrorKind::InvalidData, "not an ELF"));
+        }
+        let class64 = data[4] == ELFCLASS64;
+        let little_endian = data[5] == ELFDATA2LSB;
+        Ok(Elf {
+            data,
+            class64,
+            little_endian,
+        })
+    }
+
+    pub fn data(&self) -> &[u8] {
+        &self.data
+    }
+
+    /* e_machine: EM_XTENSA, EM_RISCV */
+    pub fn machine(&self) -> Option<u16> {
+        self.u16(0x12)
+    }
+
+    /* e_type: ET_EXEC, ET_CORE */
+    pub fn file_type(&self) -> Option<u16> {
+        self.u16(0x10)
+    }
+
+    fn bytes<const N: usize>(&self, offset: u64) -> Option<[u8; N]> {
+        let start = usize::try_from(offset).ok()?;
+        self.data.get(start..start.checked_add(N)?)?.try_into().ok()
+    }
+
+    pub fn u16(&self, offset: u64) -> Option<u16> {
+        let b = self.bytes(offset)?;
+        Some(if self.little_endian {
+            u16::from_le_bytes(b)
+        } else {
+            u16::from_be_bytes(b)
+        })
+    }
+
+    pub fn u32(&self, offset: u64) -> Option<u32> {
+        let b = self.bytes(offset)?;
+        Some(if self.little_endian {
+            u32::from_le_bytes(b)
+        } else {
+            u32::from_be_bytes(b)
+        })
+    }
+
+    pub fn u64(&self, offset: u64) -> Option<u64> {
+        let b = self.bytes(offset)?;
+        Some(if self.little_endian {
+            u64::from_le_bytes(b)
+        } else {
+            u64::from_be_bytes(b)
+        })
+    }
+
+    /* Address-sized field: 4 bytes for ELFCLASS32, 8 for ELFCLASS64 */
+    pub fn word(&self, offset: u64) -> Option<u64> {
+        if self.class64 {
+            self.u64(offset)
+        } else {
+            self.u32(offset).map(u64::from)
+        }
+    }
+
+    fn word_size(&self) -> u64 {
+        if self.class64 {
+            8
+        } else {
+            4
+        }
+    }
+
+    pub fn program_headers(&self) -> Vec<ProgramHeader> {
+        let (phoff, phentsize, phnum) = if self.class64 {
+            (self.u64(0x20), self.u16(0x36), self.u16(0x38))
+        } else {
+            (
+                self.u32(0x1c).map(u64::from),
+                self.u16(0x2a),
+                self.u16(0x2c),
+            )
+        };
+        let (phoff, phentsize, phnum) = match (phoff, phentsize, phnum) {
+            (Some(o), Some(s), Some(n)) => (o, u64::from(s), u64::from(n)),
+            _ => return vec![],
+        };
+        (0..phnum)
+            .filter_map(|i| {
+                let ph = phoff.checked_add(i * phentsize)?;
+                Some(if self.class64 {
+                    ProgramHeader {
+                        p_type: self.u32(ph)?,
+                        offset: self.u64(ph + 0x08)?,
+                        vaddr: self.u64(ph + 0x10)?,
+                        filesz: self.u64(ph + 0x20)?,
+                    }
+                } else {
+                    ProgramHeader {
+                        p_type: self.u32(ph)?,
+                        offset: u64::from(self.u32(ph + 0x04)?),
+                        vaddr: u64::from(self.u32(ph + 0x08)?),
+                        filesz: u64::from(self.u32(ph + 0x10)?),
+                    }
+                })
+            })
+            .collect()
+    }
+
+    /* Translate virtual address to file offset using PT_LOAD segments */
+    pub fn vaddr_to_offset(&self, phdrs: &[ProgramHeader], vaddr: u64) -> Option<u64> {
+        phdrs
+            .iter()
+            .find(|ph| ph.p_type == PT_LOAD && vaddr >= ph.vaddr && vaddr - ph.vaddr < ph.filesz)
+            .map(|ph| ph.offset + (vaddr - ph.vaddr))
+    }
+
+    pub fn c_str(&self, offset: u64) -> Option<&str> {
+        let start = usize::try_from(offset).ok()?;
+        let tail = self.data.get(start..)?;
+        let end = tail.iter().position(|&c| c == 0)?;
+        std::str::from_utf8(&tail[..end]).ok()
+    }
+
+    pub fn dynamic(&self) -> Option<Dynamic> {
+        let phdrs = self.program_headers();
+        let dynamic = phdrs.iter().find(|ph| ph.p_type == PT_DYNAMIC)?;
+        let entry_size = 2 * self.word_size();
+
+        let mut entries = vec![];
+        let mut strtab = None;
+        let mut strsz = None;
+        for i in 0..dynamic.filesz / entry_size {
+            let entry = dynamic.offset + i * entry_size;
+            let tag = self.word(entry)?;
+            let value = self.word(entry + self.word_size())?;
+            match tag {
+                DT_NULL => break,
+                DT_STRTAB => strtab = Some(value),
+                DT_STRSZ => strsz = Some(value),
+                DT_NEEDED | DT_RPATH | DT_RUNPATH => entries.push((tag, value)),
+                _ => (),
+            }
+        }
+        let strtab = self.vaddr_to_offset(&phdrs, strtab?)?;
+
+        let mut result = Dynamic {
+            needed: vec![],
+            rpath: vec![],
+            runpath: vec![],
+        };
+        for (tag, value) in entries {
+            if strsz.is_some_and(|size| value >= size) {
+                return None;
+            }
+            let s = self.c_str(strtab + value)?.to_string();
+            match tag {
+                DT_NEEDED => result.needed.push(s),
+                DT_RPATH => result.rpath.extend(s.split(':').map(String::from)),
+                _ => result.runpath.extend(s.split(':').map(String::from)),
+            }
+        }
+        Some(result)
+    }
+
+    /* Section headers with names resolved from the section header string table */
+    pub fn section_headers(&self) -> Vec<SectionHeader> {
+        let (shoff, shentsize, shnum, shstrndx) = if self.class64 {
+            (
+                self.u64(0x28),
+                self.u16(0x3a),
+                self.u16(0x3c),
+                self.u16(0x3e),
+            )
+        } else {
+            (
+                self.u32(0x20).map(u64::from),
+                self.u16(0x2e),
+                self.u16(0x30),
+                self.u16(0x32),
+            )
+        };
+        let (shoff, shentsize, shnum, shstrndx) = match (shoff, shentsize, shnum, shstrndx) {
+            (Some(o), Some(s), Some(n), Some(i)) if o != 0 => {
+                (o, u64::from(s), u64::from(n), u64::from(i))
+            }
+            _ => return vec![],
+        };
+        let headers: Vec<(u32, SectionHeader)> = (0..shnum)
+            .filter_map(|i| {
+                let sh = shoff.checked_add(i * shentsize)?;
+                let name = self.u32(sh)?;
+                Some((
+                    name,
+                    if self.class64 {
+                        SectionHeader {
+                            name: String::new(),
+                            sh_type: self.u32(sh + 0x04)?,
+                            offset: self.u64(sh + 0x18)?,
+                            size: self.u64(sh + 0x20)?,
+                            link: self.u32(sh + 0x28)?,
+                        }
+                    } else {
+                        SectionHeader {
+                            name: String::new(),
+                            sh_type: self.u32(sh + 0x04)?,
+                            offset: u64::from(self.u32(sh + 0x10)?),
+                            size: u64::from(self.u32(sh + 0x14)?),
+                            link: self.u32(sh + 0x18)?,
+                        }
+                    },
+                ))
+            })
+            .collect();
+        let strtab = headers.get(shstrndx as usize).map(|(_, sh)| sh.offset);
+        headers
+            .into_iter()
+            .map(|(name, mut sh)| {
+                if let Some(strtab) = strtab {
+                    sh.name = self
+                        .c_str(strtab + u64::from(name))
+                        .unwrap_or_default()
+                        .to_string();
+                }
+                sh
+            })
+            .collect()
+    }
+
+    /* Contents of the section in the file, SHT_NOBITS sections have none */
+    pub fn section_data(&self, sh: &SectionHeader) -> Option<&[u8]> {
+        if sh.sh_type == SHT_NOBITS {
+            return None;
+        }
+        let start = usize::try_from(sh.offset).ok()?;
+        self.data
+            .get(start..start.checked_add(usize::try_from(sh.size).ok()?)?)
+    }
+
+    /* Notes in the range of a PT_NOTE segment or SHT_NOTE section, up to the
+     * first malformed one */
+    pub fn notes(&self, offset: u64, size: u64) -> Vec<Note<'_>> {
+        let align = |n: u64| (n + 3) & !3;
+        let mut notes = vec![];
+        let end = match offset.checked_add(size) {
+            Some(end) => end,
+            None => return notes,
+        };
+        let mut note = offset;
+        while note + 12 <= end {
+            let (namesz, descsz, n_type) =
+                match (self.u32(note), self.u32(note + 4), self.u32(note + 8)) {
+                    (Some(namesz), Some(descsz), Some(n_type)) => {
+                        (u64::from(namesz), u64::from(descsz), n_type)
+                    }
+                    _ => break,
+                };
+            let name = note + 12;
+            let desc = name + align(namesz);
+            if desc + descsz > end {
+                break;
+            }
+            let (name, desc) = match (
+                self.data.get(name as usize..(name + namesz) as usize),
+                self.data.get(desc as usize..(desc + descsz) as usize),
+            ) {
+                (Some(name), Some(desc)) => (name, desc),
+                _ => break,
+            };
+            notes.push(Note {
+                name: name.strip_suffix(b"\0").unwrap_or(name),
+                n_type,
+                desc,
+            });
+            note += 12 + align(namesz) + align(descsz);
+        }
+        notes
+    }
+
+    /* Descriptor of the first note of the given owner and type in the range */
+    fn find_note(&self, offset: u64, size: u64, owner: &[u8], n_type: u32) -> Option<&[u8]> {
+        self.notes(offset, size)
+            .into_iter()
+            .find(|note| note.n_type == n_type && note.name == owner)
+            .map(|note| note.desc)
+    }
+
+    /* GNU build-id in hex, the same for the ELF and its core dumps, and what
+     * GDB and debuginfod look debug info up by. The note is searched in
+     * sections first, then in segments for ELFs with section headers stripped. */
+    pub fn build_id(&self) -> Option<String> {
+        let sections = self
+            .section_headers()
+            .into_iter()
+            .filter(|sh| sh.sh_type == SHT_NOTE)
+            .map(|sh| (sh.offset, sh.size));
+        let segments = self
+            .program_headers()
+            .into_iter()
+            .filter(|ph| ph.p_type == PT_NOTE)
+            .map(|ph| (ph.offset, ph.filesz));
+        let id = sections
+            .chain(segments)
+            .find_map(|(offset, size)| self.find_note(offset, size, b"GNU", NT_GNU_BUILD_ID))?;
+        if id.is_empty() {
+            return None;
+        }
+        Some(id.iter().map(|b| format!("{:02x}", b)).collect())
+    }
+}
@@ -0,0 +1,318 @@
+use super::{argscan, ESP_DEBUG_TRACE};
+use std::env;
+use std::fs::{self, File};
+use std::io::{self, BufRead, BufReader, Write};
+use std::os::unix::io::OwnedFd;
+use std::os::unix::net::UnixStream;
+use std::os::unix::process::ExitStatusExt;
+use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+
+/* Printed by the first -ex command, GDB has loaded the ELF and local .gdbinit */
+const STARTED_MARKER: &str = "esp-gdb-fanout: started";
+
+/* Line of the session list: "<elf>\t<remote>[\t<script>]", empty lines and
+ * lines starting with "#" are skipped */
+pub struct Session {
+    elf: String,
+    remote: String,
+    script: Option<String>,
+}
+
+impl Session {
+    fn args(&self) -> Vec<String> {
+        let mut args = vec![
+            "-ex".to_string(),
+            format!("echo {}\\n", STARTED_MARKER),
+            "-ex".to_string(),
+            format!("target remote {}", self.remote),
+        ];
+        if let Some(script) = &self.script {
+            args.extend(["-x".to_string(), script.clone()]);
+        }
+        args.push(self.elf.clone());
+        args
+    }
+
+    /* Arguments of the batch GDB that runs the session */
+    fn command(&self, gdb_args: &[String]) -> Vec<String> {
+        let mut command = vec!["-batch".to_string()];
+        command.extend_from_slice(gdb_args);
+        command.extend(self.args());
+        command
+    }
+}
+
+pub fn parse(list: &Path) -> Result<Vec<Session>, String> {
+    let content = fs::read_to_string(list).map_err(|e| format!("{:?}: {}", list, e))?;
+    let mut sessions = vec![];
+    for (n, line) in content.lines().enumerate() {
+        if line.trim().is_empty() || line.starts_with('#') {
+            continue;
+        }
+        let fields: Vec<&str> = line.split('\t').collect();
+        match fields[..] {
+            [elf, remote] | [elf, remote, ""] => sessions.push(Session {
+                elf: elf.to_string(),
+                remote: remote.to_string(),
+                script: None,
+            }),
+            [elf, remote, script] => sessions.push(Session {
+                elf: elf.to_string(),
+                remote: remote.to_string(),
+                script: Some(script.to_string()),
+            }),
+            _ => {
+                return Err(format!(
+                    "{:?}:{}: expected <elf>\\t<remote>[\\t<script>]",
+                    list,
+                    n + 1
+                ))
+            }
+        }
+    }
+    Ok(sessions)
+}
+
+/* One resolution serves all sessions, GDB-with-Python if any of them needs it */
+pub fn python_required(gdb_args: &[String], sessions: &[Session]) -> bool {
+    sessions
+        .iter()
+        .any(|s| argscan::python_required(&s.command(gdb_args)))
+}
+
+/* Sessions in start-up, symbol loading and DWARF indexing are CPU bound */
+struct StartupSlots {
+    used: Mutex<usize>,
+    released: Condvar,
+    limit: usize,
+}
+
+impl StartupSlots {
+    fn acquire(self: &Arc<Self>) -> StartupSlot {
+        let mut used = self.used.lock().unwrap();
+        while *used >= self.limit {
+            used = self.released.wait(used).unwrap();
+        }
+        *used += 1;
+        StartupSlot(self.clone())
+    }
+}
+
+struct StartupSlot(Arc<StartupSlots>);
+
+impl Drop for StartupSlot {
+    fn drop(&mut self) {
+        *self.0.used.lock().unwrap() -= 1;
+        self.0.released.notify_one();
+    }
+}
+
+struct Outcome {
+    code: i32,
+    elapsed: Duration,
+}
+
+/* Batch GDB of the session. The start-up slot is released when the session
+ * prints STARTED_MARKER, its output is copied to the log without it. */
+fn run_session(
+    gdb: &str,
+    gdb_args: &[String],
+    session: &Session,
+    log: &Path,
+    slot: StartupSlot,
+) -> io::Result<Outcome> {
+    let start = Instant::now();
+    let mut log = File::create(log)?;
+    /* Both GDB output streams go to one socket, so the log keeps their order */
+    let (reader, writer) = UnixStream::pair()?;
+    let mut child = {
+        let mut command = Command::new(gdb);
+        command
+            .args(session.command(gdb_args))
+            .stdin(Stdio::null())
+            .stdout(OwnedFd::from(writer.try_clone()?))
+            .stderr(OwnedFd::from(writer));
+        command.spawn()?
+    };
+    let mut slot = Some(slot);
+    let mut reader = BufReader::new(reader);
+    let mut line = vec![];
+    while reader.read_until(b'\n', &mut line)? > 0 {
+        if slot.is_some() && line.strip_suffix(b"\n") == Some(STARTED_MARKER.as_bytes()) {
+            slot = None;
+        } else {
+            log.write_all(&line)?;
+        }
+        line.clear();
+    }
+    drop(slot);
+    let status = child.wait()?;
+    Ok(Outcome {
+        code: status
+            .code()
+            .unwrap_or_else(|| 128 + status.signal().unwrap_or(0)),
+        elapsed: start.elapsed(),
+    })
+}
+
+/* Start all sessions with the same GDB and options, at most
+ * ESP_GDB_WRAPPER_FANOUT_STARTUPS (default: the number of CPUs) of them in
+ * start-up at once. Every session writes "<n>-<elf name>.log" in "log_dir".
+ * Returns 0 when all sessions exited with 0. */
+pub fn run(gdb: &str, gdb_args: &[String], sessions: Vec<Session>, log_dir: &Path) -> i32 {
+    if let Err(e) = fs::create_dir_all(log_dir) {
+        eprintln!("{:?}: {}", log_dir, e);
+        return 1;
+    }
+    let slots = Arc::new(StartupSlots {
+        used: Mutex::new(0),
+        released: Condvar::new(),
+        limit: env::var("ESP_GDB_WRAPPER_FANOUT_STARTUPS")
+            .ok()
+            .and_then(|n| n.parse().ok())
+            .unwrap_or_else(|| thread::available_parallelism().map_or(1, |n| n.get()))
+            .max(1),
+    });
+    esp_debug_trace!(
+        "Starting {} GDB sessions with {}, {} at once",
+        sessions.len(),
+        gdb,
+        slots.limit
+    );
+    let sessions: Vec<(Session, PathBuf)> = sessions
+        .into_iter()
+        .enumerate()
+        .map(|(i, s)| {
+            let name = Path::new(&s.elf)
+                .file_stem()
+                .unwrap_or_default()
+                .to_string_lossy()
+                .to_string();
+            let log = log_dir.join(format!("{}-{}.log", i + 1, name));
+            (s, log)
+        })
+        .collect();
+    let outcomes: Vec<io::Result<Outcome>> = thread::scope(|scope| {
+        let handles: Vec<_> = sessions
+            .iter()
+            .map(|(session, log)| {
+                let slot = slots.acquire();
+                scope.spawn(move || run_session(gdb, gdb_args, session, log, slot))
+            })
+            .collect();
+        handles
+            .into_iter()
+            .map(|h| {
+                h.join()
+                    .unwrap_or_else(|_| Err(io::ErrorKind::Other.into()))
+            })
+            .collect()
+    });
+
+    println!(
+        "{:>3} {:>5} {:>10}  {:<32} {:<24} log",
+        "#", "exit", "time", "elf", "remote"
+    );
+    let mut failed = 0;
+    for (i, ((session, log), outcome)) in sessions.iter().zip(&outcomes).enumerate() {
+        let (code, elapsed) = match outcome {
+            Ok(o) => (o.code.to_string(), format!("{:.1?}", o.elapsed)),
+            Err(e) => (e.to_string(), "-".to_string()),
+        };
+        if !matches!(outcome, Ok(Outcome { code: 0, .. })) {
+            failed += 1;
+        }
+        println!(
+            "{:>3} {:>5} {:>10}  {:<32} {:<24} {}",
+            i + 1,
+            code,
+            elapsed,
+            session.elf,
+            session.remote,
+            log.display()
+        );
+    }
+    println!("{} of {} sessions failed", failed, sessions.len());
+    i32::from(failed > 0)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::process;
+
+    fn list(name: &str, content: &str) -> PathBuf {
+        let file = env::temp_dir().join(format!("esp-gdb-fanout-{}-{}", process::id(), name));
+        fs::write(&file, content).unwrap();
+        file
+    }
+
+    #[test]
+    fn sessions() {
+        let file = list(
+            "sessions",
+            "# elf\tremote\tscript\n\
+             \n\
+             app.elf\tlocalhost:3333\n\
+             app.elf\tlocalhost:3334\t\n\
+             other.elf\t/dev/ttyUSB0\tinit.gdb\n",
+        );
+        let sessions = parse(&file).unwrap();
+        fs::remove_file(&file).unwrap();
+        let fields: Vec<_> = sessions
+            .iter()
+            .map(|s| (s.elf.as_str(), s.remote.as_str(), s.script.as_deref()))
+            .collect();
+        assert_eq!(
+            fields,
+            vec![
+                ("app.elf", "localhost:3333", None),
+                ("app.elf", "localhost:3334", None),
+                ("other.elf", "/dev/ttyUSB0", Some("init.gdb")),
+            ]
+        );
+        assert_eq!(
+            sessions[2].args(),
+            vec![
+                "-ex",
+                &format!("echo {}\\n", STARTED_MARKER),
+                "-ex",
+                "target remote /dev/ttyUSB0",
+                "-x",
+                "init.gdb",
+                "other.elf",
+            ]
+        );
+    }
+
+    #[test]
+    fn plain_sessions_do_not_use_python() {
+        let file = list("plain", "app.elf\tlocalhost:3333\n");
+        let sessions = parse(&file).unwrap();
+        fs::remove_file(&file).unwrap();
+        /* Init files of the user running the tests are not checked */
+        let gdb_args = vec!["-nx".to_string()];
+        assert_eq!(sessions[0].command(&gdb_args)[..2], ["-batch", "-nx"]);
+        assert!(!python_required(&gdb_args, &sessions));
+    }
+
+    #[test]
+    fn malformed() {
+        let file = list(
+            "malformed",
+            "app.elf\tlocalhost:3333\napp.elf localhost:3334\n",
+        );
+        let error = parse(&file).err().unwrap();
+        fs::remove_file(&file).unwrap();
+        assert!(
+            error.ends_with(":2: expected <elf>\\t<remote>[\\t<script>]"),
+            "{}",
+            error
+        );
+        assert!(parse(Path::new("/nonexistent/list")).is_err());
+    }
+}
@@ -0,0 +1,107 @@
+use super::{cache, ESP_DEBUG_TRACE};
+use std::env;
+use std::fs;
+use std::os::unix::fs::MetadataExt;
+use std::path::{Path, PathBuf};
+use std::thread;
+use std::time::{Duration, SystemTime};
+
+const INDEX_CACHE_DIR_NAME: &str = "index-cache";
+const INDEX_CACHE_MAX_MB_DEFAULT: u64 = 1024;
+/* Eviction lists the whole directory, do it not more often than that */
+const EVICTION_INTERVAL: Duration = Duration::from_secs(3600);
+const EVICTION_STAMP: &str = ".last-eviction";
+
+/* GDB index cache keeps the symbol index of every ELF GDB has loaded, named by
+ * build-id. Next load of the same ELF skips DWARF indexing, which takes seconds
+ * for a large application. Kept in the per-user cache directory, disabled by
+ * ESP_GDB_WRAPPER_NO_INDEX_CACHE or when caching is disabled. */
+pub fn dir() -> Option<PathBuf> {
+    if env::var_os("ESP_GDB_WRAPPER_NO_INDEX_CACHE").is_some() {
+        return None;
+    }
+    let dir = cache::dir()?.join(INDEX_CACHE_DIR_NAME);
+    fs::create_dir_all(&dir).ok()?;
+    Some(dir)
+}
+
+/* DWARF indexing threads, the number of CPUs the process may run on (cgroup
+ * CPU quota and affinity mask are taken into account) */
+fn worker_threads() -> usize {
+    thread::available_parallelism().map_or(1, |n| n.get())
+}
+
+/* Options passed before user arguments, so user -iex/-ex commands override them */
+pub fn gdb_args() -> Vec<String> {
+    let mut args = vec![
+        "-iex".to_string(),
+        format!("maint set worker-threads {}", worker_threads()),
+    ];
+    if let Some(dir) = dir() {
+        evict_if_due(&dir);
+        args.extend([
+            "-iex".to_string(),
+            format!("set index-cache directory {}", dir.display()),
+            "-iex".to_string(),
+            "set index-cache enabled on".to_string(),
+        ]);
+    }
+    args
+}
+
+fn evict_if_due(dir: &Path) {
+    let stamp = dir.join(EVICTION_STAMP);
+    let due = match stamp.metadata().and_then(|m| m.modified()) {
+        Ok(t) => SystemTime::now()
+            .duration_since(t)
+            .is_ok_and(|age| age > EVICTION_INTERVAL),
+        Err(_) => true,
+    };
+    if due {
+        let _ = fs::write(&stamp, "");
+        evict(dir);
+    }
+}
+
+/* Remove least recently used indices until the cache fits into
+ * ESP_GDB_WRAPPER_INDEX_CACHE_MAX_MB */
+fn evict(dir: &Path) {
+    let max_size = env::var("ESP_GDB_WRAPPER_INDEX_CACHE_MAX_MB")
+        .ok()
+        .and_then(|mb| mb.parse().ok())
+        .unwrap_or(INDEX_CACHE_MAX_MB_DEFAULT)
+        * 1024
+        * 1024;
+    let entries = match fs::read_dir(dir) {
+        Ok(entries) => entries,
+        Err(_) => return,
+    };
+    /* (last use, size, path), the access time is not updated on noatime mounts */
+    let mut files: Vec<(i64, u64, PathBuf)> = entries
+        .filter_map(|e| e.ok())
+        .filter(|e| !e.file_name().to_string_lossy().starts_with('.'))
+        .filter_map(|e| {
+            let m = e.metadata().ok()?;
+            m.is_file()
+                .then(|| (m.atime().max(m.mtime()), m.len(), e.path()))
+        })
+        .collect();
+    let mut size: u64 = files.iter().map(|f| f.1).sum();
+    esp_debug_trace!(
+        "Index cache {:?}: {} files, {} of {} bytes",
+        dir,
+        files.len(),
+        size,
+        max_size
+    );
+    files.sort();
+    for (_, file_size, path) in files {
+        if size <= max_size {
+            break;
+        }
+        if fs::remove_file(&path).is_ok() {
+            esp_debug_trace!("Evicted {:?}", path);
+            size -= file_size;
+        }
+    }
+}
@@ -0,0 +1,126 @@
+use super::elf::{Dynamic, Elf};
+use std::env;
+use std::fs;
+use std::io::Read;
+use std::path::{Path, PathBuf};
+
+const LD_SO_CACHE: &str = "/etc/ld.so.cache";
+const LD_SO_CACHE_OLD_MAGIC: &[u8] = b"ld.so-1.7.0";
+const LD_SO_CACHE_NEW_MAGIC: &[u8] = b"glibc-ld.so.cache1.1";
+const LD_SO_CACHE_OLD_HEADER_SIZE: usize = 16;
+const LD_SO_CACHE_OLD_ENTRY_SIZE: usize = 12;
+const LD_SO_CACHE_NEW_HEADER_SIZE: usize = 48;
+const LD_SO_CACHE_NEW_ENTRY_SIZE: usize = 24;
+
+const DEFAULT_LIB_DIRS_64: [&str; 4] = ["/lib64", "/usr/lib64", "/lib", "/usr/lib"];
+const DEFAULT_LIB_DIRS_32: [&str; 2] = ["/lib", "/usr/lib"];
+
+/* Find the library the way glibc's ld.so does for a DT_NEEDED entry of `binary`:
+ * DT_RPATH (only without DT_RUNPATH), LD_LIBRARY_PATH, DT_RUNPATH,
+ * /etc/ld.so.cache and the default directories. Candidates of another
+ * ELF class or machine are skipped as the loader does. */
+pub fn find_library(binary: &Path, elf: &Elf, dynamic: &Dynamic, name: &str) -> Option<PathBuf> {
+    if name.contains('/') {
+        let path = PathBuf::from(name);
+        return is_compatible(&path, elf).then_some(path);
+    }
+
+    let origin = binary.canonicalize().ok()?.parent()?.to_path_buf();
+    let expand = |dirs: &[String]| -> Vec<PathBuf> {
+        dirs.iter()
+            .filter(|d| !d.is_empty())
+            .map(|d| d.replace("${ORIGIN}", "$ORIGIN"))
+            .map(|d| d.replace("$ORIGIN", &origin.display().to_string()))
+            .filter(|d| !d.contains('$')) /* $LIB and $PLATFORM are not supported */
+            .map(PathBuf::from)
+            .collect()
+    };
+
+    let mut search_dirs = vec![];
+    if dynamic.runpath.is_empty() {
+        search_dirs.extend(expand(&dynamic.rpath));
+    }
+    if let Ok(ld_library_path) = env::var("LD_LIBRARY_PATH") {
+        let dirs: Vec<String> = ld_library_path
+            .split([':', ';'])
+            .map(String::from)
+            .collect();
+        search_dirs.extend(expand(&dirs));
+    }
+    search_dirs.extend(expand(&dynamic.runpath));
+
+    let found = search_dirs
+        .into_iter()
+        .map(|d| d.join(name))
+        .chain(ld_so_cache_lookup(name))
+        .find(|p| is_compatible(p, elf));
+    if found.is_some() {
+        return found;
+    }
+
+    let default_dirs: &[&str] = if elf.class64 {
+        &DEFAULT_LIB_DIRS_64
+    } else {
+        &DEFAULT_LIB_DIRS_32
+    };
+    default_dirs
+        .iter()
+        .map(|d| Path::new(d).join(name))
+        .find(|p| is_compatible(p, elf))
+}
+
+/* ELF header of the candidate must have the same class, data encoding and machine */
+fn is_compatible(path: &Path, elf: &Elf) -> bool {
+    let mut header = [0u8; 20];
+    let read = fs::File::open(path).and_then(|mut f| f.read_exact(&mut header));
+    if read.is_err() {
+        return false;
+    }
+    let binary = elf.data();
+    header[..6] == binary[..6] && header[18..20] == binary[18..20]
+}
+
+/* Paths registered for the library name in glibc's ld.so.cache (new format) */
+fn ld_so_cache_lookup(name: &str) -> Vec<PathBuf> {
+    let data = match fs::read(LD_SO_CACHE) {
+        Ok(d) => d,
+        Err(_) => return vec![],
+    };
+    let u32_at = |offset: usize| -> Option<usize> {
+        let b = data.get(offset..offset + 4)?;
+        Some(u32::from_ne_bytes(b.try_into().ok()?) as usize)
+    };
+    let c_str_at = |offset: usize| -> Option<&[u8]> {
+        let tail = data.get(offset..)?;
+        Some(&tail[..tail.iter().position(|&c| c == 0)?])
+    };
+
+    /* Old format cache may be followed by the new format one, aligned to 8 bytes */
+    let mut base = 0;
+    if data.starts_with(LD_SO_CACHE_OLD_MAGIC) {
+        let nlibs = match u32_at(LD_SO_CACHE_OLD_MAGIC.len() + 1) {
+            Some(n) => n,
+            None => return vec![],
+        };
+        base = (LD_SO_CACHE_OLD_HEADER_SIZE + nlibs * LD_SO_CACHE_OLD_ENTRY_SIZE + 7) & !7;
+    }
+    if !data[base.min(data.len())..].starts_with(LD_SO_CACHE_NEW_MAGIC) {
+        return vec![];
+    }
+    let nlibs = u32_at(base + LD_SO_CACHE_NEW_MAGIC.len()).unwrap_or(0);
+
+    let mut result = vec![];
+    for i in 0..nlibs {
+        let entry = base + LD_SO_CACHE_NEW_HEADER_SIZE + i * LD_SO_CACHE_NEW_ENTRY_SIZE;
+        let (key, value) = match (u32_at(entry + 4), u32_at(entry + 8)) {
+            (Some(k), Some(v)) => (k, v),
+            _ => break,
+        };
+        if c_str_at(base + key) == Some(name.as_bytes()) {
+            if let Some(path) = c_str_at(base + value).and_then(|p| std::str::from_utf8(p).ok()) {
+                result.push(PathBuf::from(path));
+            }
+        }
+    }
+    result
+}
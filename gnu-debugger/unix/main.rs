@@ -1,23 +1,19 @@
 use lazy_static::lazy_static;
+use std::collections::hash_map::DefaultHasher;
+use std::collections::HashMap;
 use std::env;
 use std::ffi::CString;
+use std::fs;
+use std::hash::{Hash, Hasher};
 use std::iter::once;
-use std::process::{Command, Output, Stdio};
+use std::os::unix::fs::MetadataExt;
+use std::os::unix::process::CommandExt;
+use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
 use std::ptr::null;
-
-const PYTHON_EXECUTABLE: &str = "python3";
-const PYTHON_GET_VERSION: &str =
-    "import sys; print('{}.{}'.format(sys.version_info.major, sys.version_info.minor))";
-const PYTHON_GET_PYTHONHOME: &str = "import sys; print(sys.base_prefix)";
-const PYTHON_GET_PYTHONPATH: &str = "import os, sys; print(os.pathsep.join(sys.path[1:]))";
-
-const PYTHON_GET_LIBDIR: &str = if cfg!(unix) {
-    "import sys, os, sysconfig; print(os.path.join(sys.base_prefix, 'lib'))"
-} else if cfg!(windows) {
-    "import sys; print(sys.base_prefix)"
-} else {
-    panic!("OS is not supported")
-};
+use std::sync::mpsc;
+use std::thread;
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
 
 const PYTHON_LD_LIBRARY_PATH_VARIABLE: &str = if cfg!(all(unix, not(target_os = "macos"))) {
     "LD_LIBRARY_PATH"
@@ -32,12 +28,18 @@ const PYTHON_LD_LIBRARY_PATH_VARIABLE: &str = if cfg!(all(unix, not(target_os =
 const PYTHON_ENV_DELIMETER: &str = if cfg!(windows) { ";" } else { ":" };
 const EXE_EXTENSION: &str = if cfg!(windows) { ".exe" } else { "" };
 const GDB_NOPYTHON_POSTFIX: &str = "no-python";
+const GDB_TEST_CACHE: &str = "gdb-test";
+const GDB_TEST_PASSED: &str = "passed";
+const GDB_TEST_FAILED: &str = "failed";
+const GDB_TEST_TIMED_OUT: &str = "timed-out";
+/* A timed out test may be caused by a temporary condition, it is retried then */
+const GDB_TEST_TIMED_OUT_TTL: Duration = Duration::from_secs(60 * 60);
+const GDB_TEST_TIMEOUT_DEFAULT: Duration = Duration::from_secs(5);
+const GDB_TEST_REAP_TIMEOUT: Duration = Duration::from_millis(100);
+const STARTUP_WINDOW_DEFAULT: Duration = Duration::from_millis(1000);
 
 lazy_static! {
-    static ref ESP_DEBUG_TRACE: bool = match env::var("ESP_DEBUG_TRACE") {
-        Ok(_) => true,
-        Err(_) => false,
-    };
+    static ref ESP_DEBUG_TRACE: bool = env::var("ESP_DEBUG_TRACE").is_ok();
 }
 
 macro_rules! esp_debug_trace {
@@ -50,26 +52,28 @@ macro_rules! esp_debug_trace {
     };
 }
 
-fn exec_python_script(script: &str) -> Result<String, String> {
-    let mut command = Command::new(PYTHON_EXECUTABLE);
-    command.arg("-c").arg(script);
-
-    let output: Output = match command.output() {
-        Ok(o) => o,
-        Err(e) => return Err(format!("Failed to execute process: {}", e)),
-    };
-
-    if !output.status.success() {
-        esp_debug_trace!(
-            "Error {:#?} while executing Python script:\n\t{}",
-            String::from_utf8_lossy(&output.stderr),
-            script
-        );
-        return Err("Python script execution failed".to_string());
-    }
+mod argscan;
+mod backtrace;
+mod cache;
+mod catalog;
+mod dwarf;
+mod elf;
+mod fanout;
+mod indexcache;
+mod ld;
+mod manifest;
+mod pool;
+mod prefetch;
+mod python;
+mod remote;
+mod resolver;
+mod startup;
+mod supervise;
+mod symserver;
 
-    return Ok(String::from_utf8_lossy(&output.stdout).trim().to_string());
-}
+use catalog::Catalog;
+use esp_wrapper_common::{exe, layout, trace};
+use python::PythonInfo;
 
 fn add_to_environment(var_name: &str, new_value: String, append: bool) {
     let mut value = new_value.clone();
@@ -84,127 +88,463 @@ fn add_to_environment(var_name: &str, new_value: String, append: bool) {
     env::set_var(var_name, value);
 }
 
-fn update_environment_variables() {
-    esp_debug_trace!("Update environment variables ...");
-    add_to_environment(
-        PYTHON_LD_LIBRARY_PATH_VARIABLE,
-        exec_python_script(PYTHON_GET_LIBDIR).unwrap(),
-        true,
-    );
-    add_to_environment(
-        "PYTHONHOME",
-        exec_python_script(PYTHON_GET_PYTHONHOME).unwrap(),
-        false,
-    );
-    add_to_environment(
-        "PYTHONPATH",
-        exec_python_script(PYTHON_GET_PYTHONPATH).unwrap(),
-        true,
-    );
+/* Symbol server options, the environment they need is exported */
+fn symserver_args() -> Vec<String> {
+    let (args, environment) = symserver::gdb_args();
+    for (var_name, value) in environment {
+        add_to_environment(var_name, value, false);
+    }
+    args
 }
 
-fn get_exec_argv(no_python: bool) -> Vec<String> {
-    esp_debug_trace!("Building base argv to execute GDB ...");
-    let wrapper_path = env::current_exe().expect("Get exec full path");
-    let wrapper_name = wrapper_path
-        .file_name()
-        .expect("Filename in argv[0]")
-        .to_str()
-        .unwrap();
-    let bin_dir = wrapper_path
-        .parent()
-        .expect("Executable must be in some directory");
-
-    let mut arch = "";
-    let mut chip = "";
-    for (i, s) in wrapper_name.split("-").enumerate() {
-        match i {
-            0 => arch = s,
-            1 => chip = s,
-            _ => (),
-        }
+/* Variable, value and whether the value is prepended to the existing one */
+fn python_environment(python: &PythonInfo) -> Vec<(&'static str, String, bool)> {
+    vec![
+        (PYTHON_LD_LIBRARY_PATH_VARIABLE, python.libdir.clone(), true),
+        ("PYTHONHOME", python.home.clone(), false),
+        ("PYTHONPATH", python::import_path(&python.path), false),
+    ]
+}
+
+/* The bytecode cache is per user and follows ESP_GDB_WRAPPER_NO_CACHE, it is
+ * exported on every launch and never stored in a manifest */
+fn export_pycache_prefix() {
+    if let Some(prefix) = python::pycache_prefix() {
+        add_to_environment("PYTHONPYCACHEPREFIX", prefix, false);
     }
+}
 
-    if arch == "xtensa" {
-        let dynconfig_path = bin_dir
-            .parent()
-            .expect("Executable must be in some directory")
-            .join("lib")
-            .join(format!("xtensa_{}.so", chip))
-            .as_path()
-            .display()
-            .to_string();
-        add_to_environment("XTENSA_GNU_CONFIG", dynconfig_path, false);
-        chip = "esp";
-    }
-    let python_version = if no_python {
-        GDB_NOPYTHON_POSTFIX.to_string()
-    } else {
-        exec_python_script(PYTHON_GET_VERSION).unwrap_or_else(|_| GDB_NOPYTHON_POSTFIX.to_string())
-    };
-    let exec_path = bin_dir.join(format!(
-        "{}-{}-elf-gdb-{}{}",
-        arch, chip, python_version, EXE_EXTENSION
-    ));
-
-    /* If gdb with-python but no binary found switch to gdb-no-python.
-     * Assume that gdb-no-python is exist always */
-    let exec_exist = exec_path.try_exists().unwrap();
-    esp_debug_trace!("Executable {:?} exist: {}", exec_path, exec_exist);
-    let exec_path = if !no_python && !exec_exist {
-        bin_dir.join(format!(
-            "{}-{}-elf-gdb-{}{}",
-            arch,
-            chip,
-            GDB_NOPYTHON_POSTFIX.to_string(),
-            EXE_EXTENSION
-        ))
-    } else {
-        exec_path
-    };
-    assert!(
-        exec_path.try_exists().unwrap(),
-        "Executable {:?} is not exist",
-        exec_path
-    );
-    let exec_path = exec_path.as_path().display().to_string();
+fn update_environment_variables(python: &PythonInfo) {
+    esp_debug_trace!("Update environment variables ...");
+    for (var_name, value, append) in python_environment(python) {
+        add_to_environment(var_name, value, append);
+    }
+    export_pycache_prefix();
+}
 
-    let argv = vec![exec_path];
+/* Wrapper "{arch}-{chip}-elf-gdb" runs "{arch}-{chip}-elf-gdb-{python}" binaries
+ * from its directory */
+fn get_exec_argv(catalog: &Catalog, python: Option<&PythonInfo>) -> Vec<String> {
+    esp_debug_trace!("Building base argv to execute GDB ...");
+    if let Some(dynconfig_path) = &catalog.dynconfig {
+        add_to_environment("XTENSA_GNU_CONFIG", dynconfig_path.clone(), false);
+    }
+    let exec_path = catalog.select(python.map(|p| p.version.as_str()));
+    let argv = vec![exec_path.display().to_string()];
     esp_debug_trace!("Base argv is: {:?}", argv);
-    return argv;
+    argv
 }
 
-fn exec_gdb_test(mut argv: Vec<String>) -> bool {
+/* Test run of GDB limited by ESP_GDB_WRAPPER_TEST_TIMEOUT_MS: GDB-with-Python
+ * may hang in site initialization (network home directories, .pth hooks).
+ * GDB runs in its own process group, so children it started are killed with
+ * it. Returns GDB_TEST_PASSED, GDB_TEST_FAILED or GDB_TEST_TIMED_OUT. */
+fn exec_gdb_test(mut argv: Vec<String>) -> &'static str {
     argv.extend(vec!["--batch-silent".to_string()]);
+    let timeout = env::var("ESP_GDB_WRAPPER_TEST_TIMEOUT_MS")
+        .ok()
+        .and_then(|ms| ms.parse().ok())
+        .map_or(GDB_TEST_TIMEOUT_DEFAULT, Duration::from_millis);
 
     esp_debug_trace!("Test execution of GDB with argv: {:?}", argv);
-    match Command::new(argv.get(0).unwrap())
+    let start = Instant::now();
+    let mut child = match Command::new(argv.first().unwrap())
         .args(&argv[1..])
+        .stdin(Stdio::null())
         .stdout(Stdio::null())
         .stderr(Stdio::null())
-        .status()
+        .process_group(0)
+        .spawn()
     {
-        Ok(s) => {
-            if s.success() {
-                esp_debug_trace!("Test execution of GDB is OK!");
-                return true;
-            } else {
-                esp_debug_trace!(
-                    "Test execution of GDB has non-zero exit code: {}",
-                    s.code().unwrap_or(-1)
-                );
-                return false;
-            }
-        }
+        Ok(c) => c,
         Err(e) => {
             esp_debug_trace!("GDB executed with error {}", e);
-            return false;
+            return GDB_TEST_FAILED;
+        }
+    };
+    let pid = child.id() as libc::pid_t;
+    let (tx, rx) = mpsc::channel();
+    thread::spawn(move || {
+        let _ = tx.send(child.wait());
+    });
+
+    match rx.recv_timeout(timeout) {
+        Ok(Ok(s)) if s.success() => {
+            esp_debug_trace!("Test execution of GDB is OK! ({:?})", start.elapsed());
+            GDB_TEST_PASSED
+        }
+        Ok(Ok(s)) => {
+            esp_debug_trace!("Test execution of GDB has non-zero exit code: {}", s);
+            GDB_TEST_FAILED
+        }
+        Ok(Err(e)) => {
+            esp_debug_trace!("GDB executed with error {}", e);
+            GDB_TEST_FAILED
+        }
+        Err(_) => {
+            unsafe { libc::kill(-pid, libc::SIGKILL) };
+            let reaped = rx.recv_timeout(GDB_TEST_REAP_TIMEOUT).is_ok();
+            esp_debug_trace!(
+                "Test execution of GDB is not finished in {:?}, killed (reaped: {})",
+                timeout,
+                reaped
+            );
+            GDB_TEST_TIMED_OUT
+        }
+    }
+}
+
+/* Check without executing GDB that its libpython resolves with the updated
+ * environment and PYTHONHOME has the standard library Python needs on start-up.
+ * None means the binary can not be inspected and GDB has to be test-run. */
+fn gdb_python_loadable(gdb_path: &Path, python: &PythonInfo) -> Option<bool> {
+    let elf = elf::Elf::open(gdb_path).ok()?;
+    let dynamic = elf.dynamic()?;
+    let libpython: Vec<&String> = dynamic
+        .needed
+        .iter()
+        .filter(|lib| lib.starts_with("libpython"))
+        .collect();
+    if libpython.is_empty() {
+        return None;
+    }
+    for lib in libpython {
+        match ld::find_library(gdb_path, &elf, &dynamic, lib) {
+            Some(path) => esp_debug_trace!("{} resolved to {:?}", lib, path),
+            None => {
+                esp_debug_trace!("{} can not be found by dynamic loader", lib);
+                return Some(false);
+            }
+        }
+    }
+
+    let stdlib = Path::new(&python.home)
+        .join("lib")
+        .join(format!("python{}", python.version));
+    if stdlib.join("encodings").is_dir() {
+        return Some(true);
+    }
+    let stdlib_zip = Path::new(&python.home)
+        .join("lib")
+        .join(format!("python{}.zip", python.version.replace('.', "")));
+    if stdlib_zip.is_file() {
+        return None;
+    }
+    esp_debug_trace!("No Python standard library in {:?}", stdlib);
+    Some(false)
+}
+
+/* The test result only depends on the GDB binary and the Python installation
+ * it is going to load, so keep it in cache until one of them changes.
+ * Returns the cache entry name and key. */
+fn gdb_test_cache_entry(gdb_path: &Path, python: &PythonInfo) -> Option<(String, String)> {
+    let m = gdb_path.metadata().ok()?;
+    let key = format!(
+        "{}\t{}\t{}\t{}\t{}\t{}",
+        gdb_path.display(),
+        m.len(),
+        m.mtime(),
+        m.mtime_nsec(),
+        python.home,
+        python.version
+    );
+    let mut hasher = DefaultHasher::new();
+    gdb_path.hash(&mut hasher);
+    let cache_name = format!("{}-{:016x}", GDB_TEST_CACHE, hasher.finish());
+    Some((cache_name, key))
+}
+
+/* Cached test result, a timed out one is recorded with its time:
+ * "timed-out {seconds since the epoch}" */
+fn gdb_test_record(result: &str) -> String {
+    if result != GDB_TEST_TIMED_OUT {
+        return result.to_string();
+    }
+    let now = SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .unwrap_or_default();
+    format!("{} {}", result, now.as_secs())
+}
+
+/* False for a timed out result older than GDB_TEST_TIMED_OUT_TTL */
+fn gdb_test_record_current(record: &str) -> bool {
+    let time = match record.strip_prefix(GDB_TEST_TIMED_OUT) {
+        Some(time) => time.trim(),
+        None => return true,
+    };
+    let recorded = UNIX_EPOCH + Duration::from_secs(time.parse().unwrap_or(0));
+    SystemTime::now()
+        .duration_since(recorded)
+        .is_ok_and(|age| age < GDB_TEST_TIMED_OUT_TTL)
+}
+
+fn gdb_test_passed(argv: &[String], python: &PythonInfo) -> bool {
+    let gdb_path = Path::new(&argv[0]);
+    if env::var_os("ESP_GDB_WRAPPER_EXEC_TEST").is_none() {
+        if let Some(loadable) = gdb_python_loadable(gdb_path, python) {
+            esp_debug_trace!("GDB can load Python: {}", loadable);
+            return loadable;
+        }
+    }
+    let (cache_name, key) = match gdb_test_cache_entry(gdb_path, python) {
+        Some(entry) => entry,
+        None => return exec_gdb_test(argv.to_vec()) == GDB_TEST_PASSED,
+    };
+
+    /* A timed out test is recorded too, the next launches go straight to
+     * no-python GDB until GDB_TEST_TIMED_OUT_TTL has passed */
+    let result = cache::get_or_refresh_with(&cache_name, &key, gdb_test_record_current, || {
+        Some(gdb_test_record(exec_gdb_test(argv.to_vec())))
+    });
+    esp_debug_trace!("GDB test result: {:?}", result);
+    result.as_deref() == Some(GDB_TEST_PASSED)
+}
+
+/* Start GDB-with-Python right away instead of testing it first. Returns only
+ * if GDB failed on start-up; the outcome is recorded as the test result so the
+ * next launch goes straight to no-python GDB. */
+fn launch_optimistic(argv: &[String], python: &PythonInfo) {
+    let entry = gdb_test_cache_entry(Path::new(&argv[0]), python);
+    if let Some((cache_name, key)) = &entry {
+        if let Some(result) = cache::read(cache_name, key)
+            .filter(|r| r != GDB_TEST_PASSED && gdb_test_record_current(r))
+        {
+            esp_debug_trace!("GDB-with-Python is known to fail: {}", result);
+            return;
+        }
+    }
+
+    let window = env::var("ESP_GDB_WRAPPER_STARTUP_WINDOW_MS")
+        .ok()
+        .and_then(|ms| ms.parse().ok())
+        .map_or(STARTUP_WINDOW_DEFAULT, Duration::from_millis);
+    let mut full_argv = argv.to_vec();
+    let user_args = user_args();
+    let (stats_before, stats_after) = startup::gdb_args(&argv[0], &user_args);
+    full_argv.extend(indexcache::gdb_args());
+    full_argv.extend(remote::profile_args());
+    full_argv.extend(symserver_args());
+    full_argv.extend(stats_before);
+    let user_start = full_argv.len();
+    full_argv.extend(user_args);
+    startup::insert_options(&mut full_argv, user_start, stats_after);
+    esp_debug_trace!("Launch GDB optimistically: {:?}", full_argv);
+    trace::exec(&full_argv[0]);
+
+    match supervise::run(&full_argv, window) {
+        Ok(supervise::Outcome::Exited(status)) => {
+            esp_debug_trace!("GDB exited: {}", status);
+            supervise::exit_like(status);
+        }
+        Ok(supervise::Outcome::StartupFailed) => {
+            if let Some((cache_name, key)) = &entry {
+                cache::write(cache_name, key, GDB_TEST_FAILED);
+            }
+        }
+        Err(e) => esp_debug_trace!("Failed to start GDB: {}", e),
+    }
+}
+
+/* Files GDB start-up pages in that are known before Python is resolved: the
+ * dynconfig and no-python GDB, or GDB and libpython of the guessed version */
+fn prefetch_candidates(catalog: &Catalog, python_required: bool) -> Vec<PathBuf> {
+    let mut files: Vec<PathBuf> = catalog.dynconfig.iter().map(PathBuf::from).collect();
+    if !python_required {
+        files.push(catalog.gdb_no_python());
+    } else if let Some((version, libpython)) = python::guess_installation() {
+        files.extend(catalog.gdb_with_python(&version));
+        files.push(libpython);
+    }
+    files.into_iter().filter(|f| f.is_file()).collect()
+}
+
+/* Files GDB-with-Python start-up depends on: the interpreter the environment
+ * was taken from, its virtualenv config, site directories whose .pth files
+ * extend PYTHONPATH and libpython the dynamic loader picks for GDB */
+fn python_dependencies(gdb_path: &Path, python: &PythonInfo) -> Vec<PathBuf> {
+    let mut files = vec![];
+    if let Some(interpreter) = python::interpreter() {
+        if let Some(venv_dir) = interpreter.parent().and_then(Path::parent) {
+            files.push(venv_dir.join("pyvenv.cfg"));
+        }
+        files.push(interpreter);
+    }
+    files.extend(
+        env::split_paths(&python.path)
+            .filter(|p| p.ends_with("site-packages"))
+            .collect::<Vec<_>>(),
+    );
+    if let Ok(elf) = elf::Elf::open(gdb_path) {
+        if let Some(dynamic) = elf.dynamic() {
+            for lib in dynamic.needed.iter().filter(|l| l.starts_with("libpython")) {
+                files.extend(ld::find_library(gdb_path, &elf, &dynamic, lib));
+            }
+        }
+    }
+    files
+}
+
+/* Run the whole resolution, including the GDB-with-Python test run. The result
+ * is saved next to the wrapper by --esp-wrapper-install or kept by the daemon. */
+fn resolve_manifest(wrapper: &Path) -> manifest::Manifest {
+    let fingerprint = manifest::fingerprint();
+    let catalog = Catalog::scan(wrapper);
+    let python = PythonInfo::get(&catalog.python_versions());
+    let gdb_no_python = get_exec_argv(&catalog, None).remove(0);
+    let mut gdb = get_exec_argv(&catalog, python.as_ref()).remove(0);
+
+    let mut env_deltas = vec![];
+    if let Some(dynconfig) = &catalog.dynconfig {
+        env_deltas.push(manifest::EnvDelta {
+            name: "XTENSA_GNU_CONFIG".to_string(),
+            value: dynconfig.clone(),
+            append: false,
+            python: false,
+        });
+    }
+    let mut files = vec![wrapper.to_path_buf(), PathBuf::from(&gdb_no_python)];
+    if let Some(delta) = env_deltas.first() {
+        files.push(PathBuf::from(&delta.value));
+    }
+
+    if gdb != gdb_no_python {
+        let python = python.as_ref().unwrap();
+        /* Taken before it is exported, the values depend on the environment */
+        let environment = python_environment(python);
+        for (var_name, value, append) in environment.iter().cloned() {
+            add_to_environment(var_name, value, append);
         }
+        if exec_gdb_test(vec![gdb.clone()]) == GDB_TEST_PASSED {
+            for (name, value, append) in environment {
+                env_deltas.push(manifest::EnvDelta {
+                    name: name.to_string(),
+                    value,
+                    append,
+                    python: true,
+                });
+            }
+            files.push(PathBuf::from(&gdb));
+            files.extend(python_dependencies(Path::new(&gdb), python));
+        } else {
+            gdb = gdb_no_python.clone();
+        }
+    }
+
+    manifest::Manifest::new(gdb, gdb_no_python, env_deltas, &files, fingerprint)
+}
+
+fn install_manifest() -> Result<PathBuf, String> {
+    let manifest_path = manifest::path().ok_or("Can not locate the wrapper")?;
+    let wrapper = exe::wrapper_path().map_err(|e| e.to_string())?;
+    resolve_manifest(&wrapper)
+        .write(&manifest_path)
+        .map_err(|e| format!("Failed to write {:?}: {}", manifest_path, e))?;
+    Ok(manifest_path)
+}
+
+/* Export the environment of the resolved GDB and return its path */
+fn apply_manifest(manifest: manifest::Manifest, python_required: bool) -> String {
+    let with_python = python_required && manifest.gdb != manifest.gdb_no_python;
+    for delta in manifest
+        .env
+        .into_iter()
+        .filter(|d| with_python || !d.python)
+    {
+        add_to_environment(&delta.name, delta.value, delta.append);
+    }
+    if with_python {
+        export_pycache_prefix();
+        manifest.gdb
+    } else {
+        manifest.gdb_no_python
+    }
+}
+
+fn exec_from_manifest(manifest: manifest::Manifest, python_required: bool) {
+    exec_gdb(vec![apply_manifest(manifest, python_required)]);
+}
+
+/* GDB resolved once for the processes the wrapper starts itself, pool
+ * workers and fan-out sessions */
+fn shared_gdb(wrapper: &Path, python_required: bool) -> String {
+    if let Some(manifest) = manifest::Manifest::load().or_else(|| resolver::query_gdb(wrapper)) {
+        return apply_manifest(manifest, python_required);
+    }
+    let catalog = Catalog::scan(wrapper);
+    let python = if python_required {
+        PythonInfo::get(&catalog.python_versions())
+    } else {
+        None
     };
+    let mut argv = get_exec_argv(&catalog, python.as_ref());
+    if let Some(python) = python
+        .as_ref()
+        .filter(|_| !argv[0].contains(GDB_NOPYTHON_POSTFIX))
+    {
+        update_environment_variables(python);
+        if !gdb_test_passed(&argv, python) {
+            argv = get_exec_argv(&catalog, None);
+        }
+    }
+    argv.remove(0)
+}
+
+/* --esp-wrapper-pool-run <elf> <core> [-x <script>|-ex <command>]... */
+fn pool_job_commands(args: &[String]) -> Option<Vec<String>> {
+    let mut commands = vec![];
+    let mut args = args.iter();
+    while let Some(option) = args.next() {
+        let value = args.next()?;
+        match option.as_str() {
+            "-x" => commands.push(format!("source {}", value)),
+            "-ex" => commands.push(value.clone()),
+            _ => return None,
+        }
+    }
+    Some(commands)
+}
+
+/* Load the ELF with no-python GDB in background, so the index cache has its
+ * symbol index when a debug session starts */
+fn prewarm(elf: &str) -> Result<u32, String> {
+    if indexcache::dir().is_none() {
+        return Err("GDB index cache is disabled".to_string());
+    }
+    let elf = fs::canonicalize(elf).map_err(|e| format!("{}: {}", elf, e))?;
+    let wrapper = exe::wrapper_path().map_err(|e| e.to_string())?;
+    let gdb = get_exec_argv(&Catalog::scan(&wrapper), None).remove(0);
+    let child = Command::new(&gdb)
+        .args(["-nx", "-batch"])
+        .args(indexcache::gdb_args())
+        .arg(&elf)
+        .stdin(Stdio::null())
+        .stdout(Stdio::null())
+        .stderr(Stdio::null())
+        .process_group(0)
+        .spawn()
+        .map_err(|e| format!("Failed to start {}: {}", gdb, e))?;
+    Ok(child.id())
+}
+
+/* Arguments for GDB, without the wrapper options in front of them */
+fn user_args() -> Vec<String> {
+    env::args()
+        .skip(if startup::requested() { 2 } else { 1 })
+        .collect()
 }
 
 fn exec_gdb(mut argv: Vec<String>) {
-    argv.extend(std::env::args().peekable().skip(1));
+    let span = trace::span("gdb-options");
+    let user_args = user_args();
+    let (stats_before, stats_after) = startup::gdb_args(&argv[0], &user_args);
+    argv.extend(indexcache::gdb_args());
+    argv.extend(remote::profile_args());
+    argv.extend(symserver_args());
+    argv.extend(stats_before);
+    let user_start = argv.len();
+    argv.extend(user_args);
+    startup::insert_options(&mut argv, user_start, stats_after);
+    drop(span);
     esp_debug_trace!("Execute GDB: {:?}", argv);
 
     // Convert Vec<String> into Vec<CString>
@@ -219,7 +559,8 @@ fn exec_gdb(mut argv: Vec<String>) {
         .chain(once(null()))
         .collect();
 
-    let exec = c_argv.get(0).expect("app in argv[0]").clone();
+    let exec = *c_argv.first().expect("app in argv[0]");
+    trace::exec(&argv[0]);
     unsafe { libc::execv(exec, c_argv.as_ptr()) };
     println!(
         "execv errno ({})",
@@ -228,14 +569,262 @@ fn exec_gdb(mut argv: Vec<String>) {
     unreachable!();
 }
 
-fn main() {
-    let mut argv = get_exec_argv(false);
-    let exec = argv.get(0).expect("app in argv[0]");
+pub fn main() {
+    trace::start();
+    let args: Vec<String> = env::args().collect();
+
+    if args.get(1).map(String::as_str) == Some("--esp-wrapper-install") {
+        match install_manifest() {
+            Ok(path) => println!("Launch manifest is written to {:?}", path),
+            Err(e) => {
+                eprintln!("{}", e);
+                std::process::exit(1);
+            }
+        }
+        return;
+    }
+
+    /* Print the resolution for launchers starting GDB without the wrapper */
+    if args.get(1).map(String::as_str) == Some("--esp-wrapper-resolve") {
+        let original_env: HashMap<String, String> = env::vars().collect();
+        let wrapper = exe::wrapper_path().expect("Get exec full path");
+        let mut manifest = resolve_manifest(&wrapper);
+        /* Exported at launch, it is not a part of the manifest */
+        if manifest.gdb != manifest.gdb_no_python {
+            if let Some(prefix) = python::pycache_prefix() {
+                manifest.env.push(manifest::EnvDelta {
+                    name: "PYTHONPYCACHEPREFIX".to_string(),
+                    value: prefix,
+                    append: false,
+                    python: true,
+                });
+            }
+        }
+        let mut gdb_args = indexcache::gdb_args();
+        gdb_args.extend(remote::profile_args());
+        let (symserver_args, symserver_env) = symserver::gdb_args();
+        gdb_args.extend(symserver_args);
+        for (name, value) in symserver_env {
+            manifest.env.push(manifest::EnvDelta {
+                name: name.to_string(),
+                value,
+                append: false,
+                python: false,
+            });
+        }
+        println!("{}", manifest.to_json(&original_env, &gdb_args));
+        return;
+    }
+
+    if args.get(1).map(String::as_str) == Some("--esp-wrapper-prewarm") {
+        let elf = match args.get(2) {
+            Some(elf) => elf,
+            None => {
+                eprintln!("Usage: {} --esp-wrapper-prewarm <elf>", args[0]);
+                std::process::exit(1);
+            }
+        };
+        match prewarm(elf) {
+            Ok(pid) => println!(
+                "Filling GDB index cache for {} in background (pid {})",
+                elf, pid
+            ),
+            Err(e) => {
+                eprintln!("{}", e);
+                std::process::exit(1);
+            }
+        }
+        return;
+    }
+
+    /* Warm GDB workers for batch core dump analysis */
+    if args.get(1).map(String::as_str) == Some("--esp-wrapper-pool") {
+        let size = args
+            .get(2)
+            .and_then(|n| n.parse().ok())
+            .unwrap_or_else(|| thread::available_parallelism().map_or(1, |n| n.get()));
+        /* Job scripts may use Python */
+        let gdb = shared_gdb(&exe::wrapper_path().expect("Get exec full path"), true);
+        if let Err(e) = pool::serve(gdb, size) {
+            eprintln!("{}", e);
+            std::process::exit(1);
+        }
+        return;
+    }
+
+    /* Batch job for the pool, run by GDB directly when the pool is not running */
+    if args.get(1).map(String::as_str) == Some("--esp-wrapper-pool-run") {
+        let (elf, core, commands) = match (
+            args.get(2),
+            args.get(3),
+            pool_job_commands(args.get(4..).unwrap_or_default()),
+        ) {
+            (Some(elf), Some(core), Some(commands)) => (elf, core, commands),
+            _ => {
+                eprintln!(
+                    "Usage: {} --esp-wrapper-pool-run <elf> <core> [-x <script>|-ex <command>]...",
+                    args[0]
+                );
+                std::process::exit(1);
+            }
+        };
+        if let Some(code) = pool::run(elf, core, &commands) {
+            std::process::exit(code);
+        }
+        esp_debug_trace!("GDB pool is not running, executing the job directly");
+        let err = Command::new(exe::wrapper_path().expect("Get exec full path"))
+            .args(["--batch", "-c", core])
+            .args(&args[4..])
+            .arg(elf)
+            .exec();
+        eprintln!("{}", err);
+        std::process::exit(1);
+    }
+
+    /* Panic reason and task backtraces of a core dump without starting GDB */
+    if args.get(1).map(String::as_str) == Some("--esp-fast-backtrace") {
+        let (elf, core) = match (args.get(2), args.get(3)) {
+            (Some(elf), Some(core)) => (elf, core),
+            _ => {
+                eprintln!("Usage: {} --esp-fast-backtrace <elf> <core>", args[0]);
+                std::process::exit(1);
+            }
+        };
+        match backtrace::summary(Path::new(elf), Path::new(core)) {
+            Ok(summary) => {
+                print!("{}", summary);
+                return;
+            }
+            Err(e) => esp_debug_trace!("Fast backtrace is not possible: {}", e),
+        }
+        if let Some(details) = backtrace::panic_details(Path::new(core)) {
+            println!("Panic reason: {}", details);
+        }
+        let err = Command::new(exe::wrapper_path().expect("Get exec full path"))
+            .args(["--batch", "-c", core])
+            .args(["-ex", "info threads", "-ex", "thread apply all bt"])
+            .arg(elf)
+            .exec();
+        eprintln!("{}", err);
+        std::process::exit(1);
+    }
+
+    /* Concurrent batch sessions of a test rig sharing one resolution */
+    if args.get(1).map(String::as_str) == Some("--esp-wrapper-fanout") {
+        let list = match args.get(2) {
+            Some(list) => list,
+            None => {
+                eprintln!(
+                    "Usage: {} --esp-wrapper-fanout <session list> [log directory]",
+                    args[0]
+                );
+                std::process::exit(1);
+            }
+        };
+        let sessions = match fanout::parse(Path::new(list)) {
+            Ok(sessions) => sessions,
+            Err(e) => {
+                eprintln!("{}", e);
+                std::process::exit(1);
+            }
+        };
+        let log_dir = args
+            .get(3)
+            .map_or_else(|| PathBuf::from(format!("{}.logs", list)), PathBuf::from);
+        let wrapper = exe::wrapper_path().expect("Get exec full path");
+        let mut gdb_args = indexcache::gdb_args();
+        gdb_args.extend(remote::profile_args());
+        gdb_args.extend(symserver_args());
+        let gdb = shared_gdb(&wrapper, fanout::python_required(&gdb_args, &sessions));
+        std::process::exit(fanout::run(&gdb, &gdb_args, sessions, &log_dir));
+    }
+
+    /* Started by the wrapper when ESP_GDB_WRAPPER_SYMBOL_DIRS is set */
+    if args.get(1).map(String::as_str) == Some("--esp-wrapper-symbol-server") {
+        let dirs: Vec<PathBuf> = args[2..].iter().map(PathBuf::from).collect();
+        if let Err(e) = symserver::serve(&dirs) {
+            eprintln!("{}", e);
+            std::process::exit(1);
+        }
+        return;
+    }
+
+    if args.get(1).map(String::as_str) == Some("--esp-wrapper-daemon") {
+        if let Err(e) = resolver::serve() {
+            eprintln!("{}", e);
+            std::process::exit(1);
+        }
+        return;
+    }
+
+    /* Started by the daemon with the environment of its client */
+    if args.get(1).map(String::as_str) == Some(resolver::RESOLVE_OPTION) {
+        let wrapper = exe::wrapper_path().expect("Get exec full path");
+        print!("{}", resolve_manifest(&wrapper).serialize());
+        return;
+    }
+
+    let wrapper_path = exe::wrapper_path().expect("Get exec full path");
+    let python_required = {
+        let _span = trace::span("argscan");
+        argscan::python_required(&user_args())
+    };
+    let manifest = {
+        let _span = trace::span("manifest-load");
+        manifest::Manifest::load()
+    };
+    if let Some(manifest) = manifest {
+        exec_from_manifest(manifest, python_required);
+    }
+    let manifest = {
+        let _span = trace::span("resolver-query");
+        resolver::query_gdb(&wrapper_path)
+    };
+    if let Some(manifest) = manifest {
+        exec_from_manifest(manifest, python_required);
+    }
+    let catalog = {
+        let _span = trace::span("catalog-scan");
+        Catalog::scan(&wrapper_path)
+    };
+    prefetch::start(prefetch_candidates(&catalog, python_required));
+    let python = if python_required {
+        let mut span = trace::span("python-probe");
+        let python = PythonInfo::get(&catalog.python_versions());
+        if let Some(python) = &python {
+            span.detail(&python.version);
+        }
+        python
+    } else {
+        None
+    };
+    let mut span = trace::span("gdb-select");
+    let mut argv = get_exec_argv(&catalog, python.as_ref());
+    span.detail(&argv[0]);
+    drop(span);
+    let exec = argv.first().expect("app in argv[0]");
     if !exec.contains(GDB_NOPYTHON_POSTFIX) {
         esp_debug_trace!("Trying to execute GDB-with-Python");
-        update_environment_variables();
-        if !exec_gdb_test(argv.clone()) {
-            argv = get_exec_argv(true); // fallback to no-python gdb
+        let python = python.as_ref().unwrap();
+        {
+            let _span = trace::span("env-update");
+            update_environment_variables(python);
+        }
+        if env::var_os("ESP_GDB_WRAPPER_OPTIMISTIC").is_some() {
+            launch_optimistic(&argv, python);
+            argv = get_exec_argv(&catalog, None); // GDB failed on start-up
+        } else {
+            let mut span = trace::span("gdb-test");
+            let passed = gdb_test_passed(&argv, python);
+            span.detail(if passed {
+                GDB_TEST_PASSED
+            } else {
+                GDB_TEST_FAILED
+            });
+            drop(span);
+            if !passed {
+                argv = get_exec_argv(&catalog, None); // fallback to no-python gdb
+            }
         }
     }
     exec_gdb(argv);
@@ -0,0 +1,383 @@
+use super::{exe, python, ESP_DEBUG_TRACE, PYTHON_ENV_DELIMETER};
+use std::collections::HashMap;
+use std::env;
+use std::fs::{self, File};
+use std::io::{self, Write};
+use std::iter::once;
+use std::os::unix::fs::MetadataExt;
+use std::path::{Path, PathBuf};
+use std::process;
+
+pub const MANIFEST_HEADER: &str = "esp-gdb-wrapper manifest 1";
+const MANIFEST_SUFFIX: &str = ".manifest";
+/* Environment the resolution depends on besides the files it stamps. HOME
+ * and the cache settings make a manifest resolved by one user or cache
+ * configuration a miss for another. */
+const FINGERPRINT_VARIABLES: [&str; 12] = [
+    "HOME",
+    "XDG_CACHE_HOME",
+    "ESP_GDB_WRAPPER_CACHE_DIR",
+    "ESP_GDB_WRAPPER_NO_CACHE",
+    "IDF_PYTHON_ENV_PATH",
+    "VIRTUAL_ENV",
+    "PYTHONHOME",
+    "PYTHONPATH",
+    "PYTHONNOUSERSITE",
+    "PYTHONUSERBASE",
+    "PYTHONPYCACHEPREFIX",
+    "PYTHONDONTWRITEBYTECODE",
+];
+
+/* Environment variable to set before GDB starts. Variables needed only by
+ * GDB-with-Python are marked, they are skipped when no-python GDB is used. */
+pub struct EnvDelta {
+    pub name: String,
+    pub value: String,
+    pub append: bool,
+    pub python: bool,
+}
+
+/* Result of the whole resolution done by --esp-wrapper-install: GDB binaries,
+ * environment, and the size and modification time of every file the result
+ * was derived from. Manifest is used only while all of them are unchanged. */
+pub struct Manifest {
+    pub gdb: String,
+    pub gdb_no_python: String,
+    pub env: Vec<EnvDelta>,
+    stamps: Vec<String>,
+    fingerprint: String,
+}
+
+/* Hidden file next to the wrapper: bin/.xtensa-esp32-elf-gdb.manifest */
+pub fn path() -> Option<PathBuf> {
+    let wrapper = exe::wrapper_path().ok()?;
+    let name = wrapper.file_name()?.to_str()?.to_string();
+    Some(wrapper.with_file_name(format!(".{}{}", name, MANIFEST_SUFFIX)))
+}
+
+/* Taken before the wrapper exports anything for GDB */
+pub fn fingerprint() -> String {
+    let mut fingerprint = match python::interpreter() {
+        Some(p) => p.display().to_string(),
+        None => String::new(),
+    };
+    for var in FINGERPRINT_VARIABLES {
+        fingerprint += &format!("\t{}={}", var, env::var(var).unwrap_or_default());
+    }
+    fingerprint
+}
+
+fn json_string(s: &str) -> String {
+    let mut json = String::from("\"");
+    for c in s.chars() {
+        match c {
+            '"' => json += "\\\"",
+            '\\' => json += "\\\\",
+            '\n' => json += "\\n",
+            '\t' => json += "\\t",
+            c if (c as u32) < 0x20 => json += &format!("\\u{:04x}", c as u32),
+            c => json.push(c),
+        }
+    }
+    json + "\""
+}
+
+fn stamp(path: &Path) -> Option<String> {
+    let m = path.metadata().ok()?;
+    Some(format!(
+        "{}\t{}\t{}\t{}",
+        path.display(),
+        m.len(),
+        m.mtime(),
+        m.mtime_nsec()
+    ))
+}
+
+impl Manifest {
+    pub fn new(
+        gdb: String,
+        gdb_no_python: String,
+        env: Vec<EnvDelta>,
+        files: &[PathBuf],
+        fingerprint: String,
+    ) -> Manifest {
+        Manifest {
+            gdb,
+            gdb_no_python,
+            env,
+            stamps: files.iter().filter_map(|f| stamp(f)).collect(),
+            fingerprint,
+        }
+    }
+
+    pub fn serialize(&self) -> String {
+        let mut lines = vec![
+            MANIFEST_HEADER.to_string(),
+            format!("fingerprint\t{}", self.fingerprint),
+            format!("gdb\t{}", self.gdb),
+            format!("gdb-no-python\t{}", self.gdb_no_python),
+        ];
+        for delta in &self.env {
+            lines.push(format!(
+                "env\t{}\t{}\t{}\t{}",
+                if delta.python { "python" } else { "all" },
+                if delta.append { "prepend" } else { "set" },
+                delta.name,
+                delta.value
+            ));
+        }
+        for stamp in &self.stamps {
+            lines.push(format!("stamp\t{}", stamp));
+        }
+        lines.join("\n") + "\n"
+    }
+
+    /* Resolution for IDE launchers starting GDB directly: "argv" is GDB and the
+     * options the wrapper passes before user arguments. "env" has final values
+     * for the environment the resolution was done in (prepended values joined
+     * with the original ones). The result stays valid while "fingerprint" of
+     * the launcher environment is the same and every stamped file still has
+     * the recorded size and modification time. */
+    pub fn to_json(&self, original_env: &HashMap<String, String>, gdb_args: &[String]) -> String {
+        let env: Vec<String> = self
+            .env
+            .iter()
+            .map(|d| {
+                let value = match original_env.get(&d.name) {
+                    Some(old) if d.append && !old.is_empty() => {
+                        format!("{}{}{}", d.value, PYTHON_ENV_DELIMETER, old)
+                    }
+                    _ => d.value.clone(),
+                };
+                format!("    {}: {}", json_string(&d.name), json_string(&value))
+            })
+            .collect();
+        let stamps: Vec<String> = self
+            .stamps
+            .iter()
+            .filter_map(|s| {
+                let fields: Vec<&str> = s.split('\t').collect();
+                let [path, size, mtime, nsec] = fields[..] else {
+                    return None;
+                };
+                Some(format!(
+                    "    {{\"path\": {}, \"size\": {}, \"mtime\": {}, \"mtime_nsec\": {}}}",
+                    json_string(path),
+                    size,
+                    mtime,
+                    nsec
+                ))
+            })
+            .collect();
+        let with_python = self.gdb != self.gdb_no_python;
+        format!(
+            "{{\n  \"gdb\": {},\n  \"python\": {},\n  \"argv\": [{}],\n  \"env\": {{\n{}\n  }},\n  \"gdb_no_python\": {},\n  \"fingerprint\": {},\n  \"fingerprint_variables\": [{}],\n  \"stamps\": [\n{}\n  ]\n}}",
+            json_string(&self.gdb),
+            with_python,
+            once(&self.gdb)
+                .chain(gdb_args)
+                .map(|a| json_string(a))
+                .collect::<Vec<String>>()
+                .join(", "),
+            env.join(",\n"),
+            json_string(&self.gdb_no_python),
+            json_string(&self.fingerprint),
+            FINGERPRINT_VARIABLES.map(json_string).join(", "),
+            stamps.join(",\n")
+        )
+    }
+
+    /* Write to a temporary file and rename it, so a concurrently started
+     * wrapper never reads a partially written manifest */
+    pub fn write(&self, path: &Path) -> io::Result<()> {
+        /* Fields are separated by tabs, only the last one of a line may contain them */
+        let well_formed = [&self.gdb, &self.gdb_no_python]
+            .into_iter()
+            .chain(self.env.iter().map(|d| &d.name))
+            .all(|f| !f.contains(['\t', '\n']))
+            && self.env.iter().all(|d| !d.value.contains('\n'))
+            && self
+                .stamps
+                .iter()
+                .all(|s| s.matches('\t').count() == 3 && !s.contains('\n'));
+        if !well_formed {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidData,
+                "unsupported characters in paths",
+            ));
+        }
+        let content = self.serialize();
+        let tmp_path = path.with_extension(format!("{}.tmp", process::id()));
+        let result = File::create(&tmp_path)
+            .and_then(|mut f| f.write_all(content.as_bytes()))
+            .and_then(|_| fs::rename(&tmp_path, path));
+        if result.is_err() {
+            let _ = fs::remove_file(&tmp_path);
+        }
+        result
+    }
+
+    pub fn deserialize(content: &str) -> Option<Manifest> {
+        let mut lines = content.lines();
+        if lines.next()? != MANIFEST_HEADER {
+            return None;
+        }
+        let mut manifest = Manifest {
+            gdb: String::new(),
+            gdb_no_python: String::new(),
+            env: vec![],
+            stamps: vec![],
+            fingerprint: String::new(),
+        };
+        for line in lines {
+            let (key, value) = line.split_once('\t')?;
+            match key {
+                "fingerprint" => manifest.fingerprint = value.to_string(),
+                "gdb" => manifest.gdb = value.to_string(),
+                "gdb-no-python" => manifest.gdb_no_python = value.to_string(),
+                "stamp" => manifest.stamps.push(value.to_string()),
+                "env" => {
+                    let fields: Vec<&str> = value.splitn(4, '\t').collect();
+                    if fields.len() != 4 {
+                        return None;
+                    }
+                    manifest.env.push(EnvDelta {
+                        python: fields[0] == "python",
+                        append: fields[1] == "prepend",
+                        name: fields[2].to_string(),
+                        value: fields[3].to_string(),
+                    });
+                }
+                _ => return None,
+            }
+        }
+        if manifest.gdb.is_empty() || manifest.gdb_no_python.is_empty() {
+            return None;
+        }
+        Some(manifest)
+    }
+
+    /* Read the manifest and check it is still valid for this environment.
+     * That costs a stat() per stamped file and the PATH lookup of python3.
+     * ESP_GDB_WRAPPER_NO_MANIFEST makes the wrapper ignore it. */
+    pub fn load() -> Option<Manifest> {
+        if env::var_os("ESP_GDB_WRAPPER_NO_MANIFEST").is_some() {
+            return None;
+        }
+        let path = path()?;
+        let manifest = Manifest::deserialize(&fs::read_to_string(&path).ok()?);
+        let manifest = match manifest {
+            Some(m) => m,
+            None => {
+                esp_debug_trace!("Manifest {:?} is malformed", path);
+                return None;
+            }
+        };
+        if manifest.fingerprint != fingerprint() {
+            esp_debug_trace!("Manifest {:?} was written for another environment", path);
+            return None;
+        }
+        if !manifest.is_current() {
+            esp_debug_trace!("Manifest {:?} is outdated", path);
+            return None;
+        }
+        esp_debug_trace!("Using manifest {:?}", path);
+        Some(manifest)
+    }
+
+    /* All stamped files still have the recorded size and modification time */
+    pub fn is_current(&self) -> bool {
+        self.stamps.iter().all(|recorded| {
+            let file = Path::new(recorded.split('\t').next().unwrap_or_default());
+            let current = stamp(file).as_ref() == Some(recorded);
+            if !current {
+                esp_debug_trace!("{:?} changed", file);
+            }
+            current
+        })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn delta(name: &str, value: &str, append: bool, python: bool) -> EnvDelta {
+        EnvDelta {
+            name: name.to_string(),
+            value: value.to_string(),
+            append,
+            python,
+        }
+    }
+
+    fn manifest() -> Manifest {
+        Manifest {
+            gdb: "/opt/esp/bin/xtensa-esp-elf-gdb-3.11".to_string(),
+            gdb_no_python: "/opt/esp/bin/xtensa-esp-elf-gdb-no-python".to_string(),
+            env: vec![
+                delta(
+                    "XTENSA_GNU_CONFIG",
+                    "/opt/esp/lib/xtensa_esp32.so",
+                    false,
+                    false,
+                ),
+                delta("LD_LIBRARY_PATH", "/usr/lib", true, true),
+                delta("PYTHONPATH", "/a:/b\twith tab", false, true),
+            ],
+            stamps: vec!["/opt/esp/bin/xtensa-esp32-elf-gdb\t1024\t1700000000\t5".to_string()],
+            fingerprint: "/usr/bin/python3\tHOME=/home/user\tVIRTUAL_ENV=".to_string(),
+        }
+    }
+
+    #[test]
+    fn round_trip() {
+        let original = manifest();
+        let restored = Manifest::deserialize(&original.serialize()).unwrap();
+        assert_eq!(restored.gdb, original.gdb);
+        assert_eq!(restored.gdb_no_python, original.gdb_no_python);
+        assert_eq!(restored.fingerprint, original.fingerprint);
+        assert_eq!(restored.stamps, original.stamps);
+        assert_eq!(restored.env.len(), original.env.len());
+        for (restored, original) in restored.env.iter().zip(&original.env) {
+            assert_eq!(restored.name, original.name);
+            assert_eq!(restored.value, original.value);
+            assert_eq!(restored.append, original.append);
+            assert_eq!(restored.python, original.python);
+        }
+        assert_eq!(restored.serialize(), original.serialize());
+    }
+
+    #[test]
+    fn malformed() {
+        let content = manifest().serialize();
+        assert!(Manifest::deserialize("").is_none());
+        assert!(Manifest::deserialize(&content.replacen("manifest 1", "manifest 2", 1)).is_none());
+        assert!(Manifest::deserialize(&(content.clone() + "unknown\tline\n")).is_none());
+        assert!(Manifest::deserialize(&(content.clone() + "env\tall\tset\n")).is_none());
+        let without_gdb: Vec<&str> = content
+            .lines()
+            .filter(|l| !l.starts_with("gdb\t"))
+            .collect();
+        assert!(Manifest::deserialize(&without_gdb.join("\n")).is_none());
+    }
+
+    #[test]
+    fn stamps() {
+        let file = env::temp_dir().join(format!("esp-gdb-manifest-{}", process::id()));
+        fs::write(&file, "gdb").unwrap();
+        let manifest = Manifest::new(
+            "gdb".to_string(),
+            "gdb-no-python".to_string(),
+            vec![],
+            &[file.clone(), PathBuf::from("/nonexistent/file")],
+            String::new(),
+        );
+        /* Files that do not exist are not stamped */
+        assert_eq!(manifest.stamps.len(), 1);
+        assert!(manifest.is_current());
+        fs::write(&file, "gdb changed").unwrap();
+        assert!(!manifest.is_current());
+        fs::remove_file(&file).unwrap();
+    }
+}
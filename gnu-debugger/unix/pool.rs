@@ -0,0 +1,682 @@
+use super::elf::Elf;
+use super::{indexcache, resolver, ESP_DEBUG_TRACE};
+use std::collections::HashMap;
+use std::env;
+use std::fs;
+use std::io::{self, BufRead, BufReader, Read, Write};
+use std::iter::once;
+use std::os::unix::fs::MetadataExt;
+use std::os::unix::io::AsRawFd;
+use std::os::unix::net::UnixStream;
+use std::os::unix::process::{CommandExt, ExitStatusExt};
+use std::panic;
+use std::path::{Path, PathBuf};
+use std::process::{Child, ChildStdin, ChildStdout, Command, ExitStatus, Stdio};
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+
+const POOL_SOCKET_NAME: &str = "esp-gdb-pool.sock";
+const POOL_IDLE_TIMEOUT_DEFAULT: Duration = Duration::from_secs(300);
+const POOL_JOB_TIMEOUT_DEFAULT: Duration = Duration::from_secs(300);
+const POOL_REAP_INTERVAL: Duration = Duration::from_secs(1);
+const POOL_REQUEST_TIMEOUT: Duration = Duration::from_secs(5);
+/* GDB start-up includes the symbol load of the ELF */
+const WORKER_START_TIMEOUT: Duration = Duration::from_secs(120);
+/* What --batch sets, so console output of a job is the same as of a batch run */
+const WORKER_SETUP: [&str; 4] = [
+    "set pagination off",
+    "set confirm off",
+    "set width 0",
+    "set height 0",
+];
+
+/* Commands that leave nothing behind for the next job: the selected thread and
+ * frame go with the core. print records the value history ("$1 = ..."), list
+ * moves the listing position, x and "info line" set $_, anything else may
+ * change a setting, so a job with any other command retires its worker. */
+const READ_ONLY_COMMANDS: [&str; 11] = [
+    "backtrace",
+    "bt",
+    "where",
+    "ptype",
+    "whatis",
+    "echo",
+    "frame",
+    "f",
+    "up",
+    "down",
+    "disassemble",
+];
+
+/* Nesting of "source" in job scripts, deeper scripts retire their worker */
+const MAX_SOURCE_DEPTH: u32 = 8;
+
+/* ESP_GDB_WRAPPER_POOL_SOCKET overrides the location, empty value disables the pool */
+fn socket_path() -> Option<PathBuf> {
+    match env::var_os("ESP_GDB_WRAPPER_POOL_SOCKET") {
+        Some(p) if p.is_empty() => None,
+        Some(p) => Some(PathBuf::from(p)),
+        None => Some(Path::new(&env::var_os("XDG_RUNTIME_DIR")?).join(POOL_SOCKET_NAME)),
+    }
+}
+
+fn duration_from_env(name: &str, default: Duration) -> Duration {
+    env::var(name)
+        .ok()
+        .and_then(|s| s.parse().ok())
+        .map_or(default, Duration::from_secs)
+}
+
+/* Shell exit code of a process */
+fn exit_code(status: ExitStatus) -> i32 {
+    status
+        .code()
+        .unwrap_or_else(|| 128 + status.signal().unwrap_or(0))
+}
+
+/* MI input is a C string, GDB unescapes it before running the command */
+fn mi_quote(s: &str) -> String {
+    let mut quoted = String::from("\"");
+    for c in s.chars() {
+        match c {
+            '"' => quoted += "\\\"",
+            '\\' => quoted += "\\\\",
+            '\n' => quoted += "\\n",
+            '\t' => quoted += "\\t",
+            c => quoted.push(c),
+        }
+    }
+    quoted + "\""
+}
+
+/* Unescape the C string MI output starts with, non-ASCII bytes are in octal */
+fn mi_unquote(s: &str) -> Vec<u8> {
+    let mut bytes = s.strip_prefix('"').unwrap_or(s).bytes().peekable();
+    let mut result = vec![];
+    while let Some(b) = bytes.next() {
+        match b {
+            b'"' => break,
+            b'\\' => match bytes.next() {
+                Some(b'n') => result.push(b'\n'),
+                Some(b't') => result.push(b'\t'),
+                Some(b'r') => result.push(b'\r'),
+                Some(d @ b'0'..=b'7') => {
+                    let mut value = u32::from(d - b'0');
+                    for _ in 0..2 {
+                        match bytes.peek() {
+                            Some(&d @ b'0'..=b'7') => {
+                                value = value * 8 + u32::from(d - b'0');
+                                bytes.next();
+                            }
+                            _ => break,
+                        }
+                    }
+                    result.push(value as u8);
+                }
+                Some(c) => result.push(c),
+                None => break,
+            },
+            b => result.push(b),
+        }
+    }
+    result
+}
+
+fn read_only(command: &str) -> bool {
+    let words: Vec<&str> = command.split_whitespace().collect();
+    match words[..] {
+        ["info" | "inf" | "i", sub, ..] if "line".starts_with(sub) => false,
+        ["info" | "inf" | "i", ..] => true,
+        ["frame" | "f", "apply", ..] => false,
+        ["thread", "apply", "all", "backtrace" | "bt", ..] => true,
+        [command, ..] => READ_ONLY_COMMANDS.contains(&command),
+        [] => false,
+    }
+}
+
+/* "source <script>" is read-only when every command of the script is. GDB
+ * looks for relative names in the current directory "cwd", nested scripts
+ * are also found relative to the sourcing one in "dir". */
+fn read_only_sourced(command: &str, cwd: &Path, dir: &Path, depth: u32) -> bool {
+    let words: Vec<&str> = command.split_whitespace().collect();
+    let file = match words[..] {
+        ["source" | "so", file] if !file.starts_with('-') => Path::new(file),
+        _ => return read_only(command),
+    };
+    if depth >= MAX_SOURCE_DEPTH {
+        return false;
+    }
+    let script = match cwd.join(file) {
+        script if script.exists() => script,
+        _ => dir.join(file),
+    };
+    let content = match fs::read_to_string(&script) {
+        Ok(c) => c,
+        Err(_) => return false,
+    };
+    let dir = script.parent().unwrap_or(dir);
+    content
+        .lines()
+        .map(str::trim)
+        .filter(|line| !line.is_empty() && !line.starts_with('#'))
+        .all(|line| read_only_sourced(line, cwd, dir, depth + 1))
+}
+
+/* Output of a job in the form a batch run would print it */
+#[derive(Default)]
+struct Output {
+    stdout: Vec<u8>,
+    stderr: Vec<u8>,
+    /* The last command failed, batch GDB exits with 1 then */
+    failed: bool,
+    /* GDB exited, by "quit" in the job commands or by a crash */
+    exit: Option<i32>,
+}
+
+/* GDB started with an ELF loaded, driven over GDB/MI */
+struct Worker {
+    child: Child,
+    stdin: ChildStdin,
+    stdout: ChildStdout,
+    buffer: Vec<u8>,
+    token: u64,
+    exited: bool,
+    last_used: Instant,
+}
+
+impl Worker {
+    fn start(gdb: &str, elf: &Path) -> io::Result<Worker> {
+        let start = Instant::now();
+        let mut child = Command::new(gdb)
+            .args(["--interpreter=mi2", "-q"])
+            .args(indexcache::gdb_args())
+            .arg(elf)
+            .stdin(Stdio::piped())
+            .stdout(Stdio::piped())
+            .stderr(Stdio::null())
+            .process_group(0)
+            .spawn()?;
+        let mut worker = Worker {
+            stdin: child.stdin.take().unwrap(),
+            stdout: child.stdout.take().unwrap(),
+            child,
+            buffer: vec![],
+            token: 0,
+            exited: false,
+            last_used: Instant::now(),
+        };
+        /* The first prompt is printed after the symbols are loaded */
+        let deadline = start + WORKER_START_TIMEOUT;
+        loop {
+            match worker.read_line(deadline)? {
+                Some(line) if line.trim_end() == "(gdb)" => break,
+                Some(_) => (),
+                None => {
+                    return Err(io::Error::new(
+                        io::ErrorKind::UnexpectedEof,
+                        format!("{} exited on start-up", gdb),
+                    ))
+                }
+            }
+        }
+        let mut output = Output::default();
+        for command in WORKER_SETUP {
+            worker.execute(command, deadline, &mut output)?;
+        }
+        esp_debug_trace!(
+            "GDB worker {} for {:?} started in {:?}",
+            worker.child.id(),
+            elf,
+            start.elapsed()
+        );
+        Ok(worker)
+    }
+
+    /* Next MI output line, None when GDB has exited */
+    fn read_line(&mut self, deadline: Instant) -> io::Result<Option<String>> {
+        loop {
+            if let Some(end) = self.buffer.iter().position(|&b| b == b'\n') {
+                let line: Vec<u8> = self.buffer.drain(..=end).collect();
+                return Ok(Some(
+                    String::from_utf8_lossy(&line[..end])
+                        .trim_end_matches('\r')
+                        .to_string(),
+                ));
+            }
+            let timeout = deadline.saturating_duration_since(Instant::now());
+            let mut pollfd = libc::pollfd {
+                fd: self.stdout.as_raw_fd(),
+                events: libc::POLLIN,
+                revents: 0,
+            };
+            let ready = unsafe { libc::poll(&mut pollfd, 1, timeout.as_millis() as libc::c_int) };
+            if ready < 0 {
+                let e = io::Error::last_os_error();
+                if e.kind() == io::ErrorKind::Interrupted {
+                    continue;
+                }
+                return Err(e);
+            }
+            if ready == 0 {
+                return Err(io::Error::new(io::ErrorKind::TimedOut, "GDB job timed out"));
+            }
+            let mut chunk = [0; 0x10000];
+            let n = self.stdout.read(&mut chunk)?;
+            if n == 0 {
+                return Ok(None);
+            }
+            self.buffer.extend_from_slice(&chunk[..n]);
+        }
+    }
+
+    /* Run a CLI command and collect its output until the next prompt */
+    fn execute(&mut self, command: &str, deadline: Instant, output: &mut Output) -> io::Result<()> {
+        self.token += 1;
+        let result_prefix = format!("{}^", self.token);
+        let request = format!(
+            "{}-interpreter-exec console {}\n",
+            self.token,
+            mi_quote(command)
+        );
+        /* Fails if GDB has exited, its exit code is collected below */
+        let _ = self.stdin.write_all(request.as_bytes());
+        let mut log = vec![];
+        let mut result = None;
+        loop {
+            let line = match self.read_line(deadline)? {
+                Some(line) => line,
+                None => {
+                    output.stdout.extend(log);
+                    let status = self.child.wait()?;
+                    self.exited = true;
+                    output.exit = Some(exit_code(status));
+                    return Ok(());
+                }
+            };
+            if let Some(s) = line.strip_prefix('~').or(line.strip_prefix('@')) {
+                output.stdout.extend(mi_unquote(s));
+            } else if let Some(s) = line.strip_prefix('&') {
+                log.extend(mi_unquote(s));
+            } else if let Some(s) = line.strip_prefix(&result_prefix) {
+                result = Some(s.to_string());
+            } else if result.is_some() && line.trim_end() == "(gdb)" {
+                break;
+            }
+        }
+        let result = result.unwrap_or_default();
+        output.failed = result.starts_with("error");
+        if let Some(msg) = result.strip_prefix("error,msg=") {
+            /* The message may be in the log already */
+            let mut message = mi_unquote(msg);
+            message.push(b'\n');
+            if !log.ends_with(&message) {
+                log.extend(message);
+            }
+        }
+        output.stderr.extend(log);
+        Ok(())
+    }
+
+    /* Same order as of "gdb --batch -c core -x script -ex command elf":
+     * the core is loaded first, then commands run one by one, a failed
+     * command does not stop the following ones. Relative paths are resolved
+     * against the client working directory. */
+    fn run_job(&mut self, job: &Job, timeout: Duration) -> io::Result<Output> {
+        let deadline = Instant::now() + timeout;
+        let mut output = Output::default();
+        self.execute(&format!("cd {}", job.cwd), deadline, &mut Output::default())?;
+        let core = format!("core-file {}", job.core);
+        for command in once(&core).chain(&job.commands) {
+            self.execute(command, deadline, &mut output)?;
+            if output.exit.is_some() {
+                return Ok(output);
+            }
+        }
+        /* Unload the core for the next job */
+        self.execute("core-file", deadline, &mut Output::default())?;
+        self.last_used = Instant::now();
+        Ok(output)
+    }
+}
+
+impl Drop for Worker {
+    fn drop(&mut self) {
+        if !self.exited {
+            unsafe { libc::kill(-(self.child.id() as i32), libc::SIGKILL) };
+            let _ = self.child.wait();
+        }
+    }
+}
+
+struct Job {
+    cwd: String,
+    elf: PathBuf,
+    core: String,
+    commands: Vec<String>,
+}
+
+impl Job {
+    /* The job leaves nothing behind for the next one, -x scripts included */
+    fn read_only(&self) -> bool {
+        let cwd = Path::new(&self.cwd);
+        self.commands
+            .iter()
+            .all(|command| read_only_sourced(command, cwd, cwd, 0))
+    }
+}
+
+/* Request: "job", working directory, ELF, core and commands separated by tabs */
+fn parse_job(request: &str) -> Option<Job> {
+    let mut fields = request.split('\t');
+    if fields.next()? != "job" {
+        return None;
+    }
+    let cwd = fields.next()?.to_string();
+    let elf = Path::new(&cwd).join(fields.next()?);
+    let core = fields.next()?.to_string();
+    Some(Job {
+        cwd,
+        elf,
+        core,
+        commands: fields.map(String::from).collect(),
+    })
+}
+
+/* Workers are shared by ELFs of the same build-id, ELFs without one are told
+ * apart by the path and modification time */
+fn elf_key(elf: &Path) -> io::Result<String> {
+    if let Some(id) = Elf::open(elf)?.build_id() {
+        return Ok(id);
+    }
+    let m = elf.metadata()?;
+    Ok(format!(
+        "{}@{}.{}",
+        elf.display(),
+        m.mtime(),
+        m.mtime_nsec()
+    ))
+}
+
+#[derive(Default)]
+struct Slot {
+    idle: Vec<Worker>,
+    busy: usize,
+}
+
+struct Pool {
+    gdb: String,
+    /* Workers per ELF */
+    size: usize,
+    idle_timeout: Duration,
+    job_timeout: Duration,
+    slots: Mutex<HashMap<String, Slot>>,
+    released: Condvar,
+}
+
+impl Pool {
+    /* Most recently used idle worker, a new one while the ELF has less than
+     * "size" workers, otherwise wait for one to be released */
+    fn checkout(&self, key: &str, elf: &Path) -> io::Result<Worker> {
+        let mut slots = self.slots.lock().unwrap();
+        loop {
+            let slot = slots.entry(key.to_string()).or_default();
+            if let Some(worker) = slot.idle.pop() {
+                slot.busy += 1;
+                return Ok(worker);
+            }
+            if slot.busy < self.size {
+                slot.busy += 1;
+                break;
+            }
+            slots = self.released.wait(slots).unwrap();
+        }
+        drop(slots);
+        Worker::start(&self.gdb, elf).inspect_err(|_| self.checkin(key, None))
+    }
+
+    fn checkin(&self, key: &str, worker: Option<Worker>) {
+        let mut slots = self.slots.lock().unwrap();
+        if let Some(slot) = slots.get_mut(key) {
+            slot.busy -= 1;
+            slot.idle.extend(worker);
+        }
+        self.released.notify_all();
+    }
+
+    /* Stop workers idle for longer than ESP_GDB_WRAPPER_POOL_IDLE_S */
+    fn reap(&self) {
+        loop {
+            thread::sleep(POOL_REAP_INTERVAL);
+            let mut slots = self.slots.lock().unwrap();
+            for (key, slot) in slots.iter_mut() {
+                let before = slot.idle.len();
+                slot.idle
+                    .retain(|w| w.last_used.elapsed() < self.idle_timeout);
+                if slot.idle.len() != before {
+                    esp_debug_trace!(
+                        "Reaped {} idle GDB workers of {}",
+                        before - slot.idle.len(),
+                        key
+                    );
+                }
+            }
+            slots.retain(|_, slot| slot.busy > 0 || !slot.idle.is_empty());
+        }
+    }
+
+    fn run(&self, job: &Job) -> io::Result<Output> {
+        let key = elf_key(&job.elf)?;
+        let mut worker = self.checkout(&key, &job.elf)?;
+        let start = Instant::now();
+        let result = worker.run_job(job, self.job_timeout);
+        esp_debug_trace!(
+            "Job for {:?} is done by worker {} in {:?}",
+            job.elf,
+            worker.child.id(),
+            start.elapsed()
+        );
+        /* A worker is reused only after a job it has completed without
+         * changing its state, so every job sees GDB as a batch run does */
+        let reusable = result.is_ok() && !worker.exited && job.read_only();
+        if !reusable {
+            esp_debug_trace!("GDB worker {} is retired", worker.child.id());
+        }
+        self.checkin(&key, reusable.then_some(worker));
+        result
+    }
+}
+
+fn respond(pool: &Pool, mut stream: UnixStream) -> io::Result<()> {
+    stream.set_read_timeout(Some(POOL_REQUEST_TIMEOUT))?;
+    let mut request = String::new();
+    BufReader::new(&stream).read_line(&mut request)?;
+    let output = match parse_job(request.trim_end_matches('\n')) {
+        Some(job) => pool.run(&job),
+        None => Err(io::Error::new(
+            io::ErrorKind::InvalidInput,
+            "malformed request",
+        )),
+    };
+    let output = output.unwrap_or_else(|e| Output {
+        stderr: format!("{}\n", e).into_bytes(),
+        exit: Some(1),
+        ..Default::default()
+    });
+    let code = output.exit.unwrap_or(if output.failed { 1 } else { 0 });
+    let header = format!(
+        "exit\t{}\t{}\t{}\n",
+        code,
+        output.stdout.len(),
+        output.stderr.len()
+    );
+    stream.write_all(header.as_bytes())?;
+    stream.write_all(&output.stdout)?;
+    stream.write_all(&output.stderr)
+}
+
+/* Serve batch jobs until killed, each connection in its own thread, so jobs
+ * for the same ELF run in parallel on up to "size" workers. A worker is kept
+ * warm only after jobs of READ_ONLY_COMMANDS and scripts of them. */
+pub fn serve(gdb: String, size: usize) -> io::Result<()> {
+    let path = socket_path().ok_or(io::Error::new(
+        io::ErrorKind::NotFound,
+        "Set XDG_RUNTIME_DIR or ESP_GDB_WRAPPER_POOL_SOCKET",
+    ))?;
+    let listener = resolver::listen_private(&path, "GDB pool")?;
+    panic::set_hook(Box::new(|info| esp_debug_trace!("{}", info)));
+    esp_debug_trace!(
+        "GDB pool of {} workers per ELF is listening on {:?}",
+        size,
+        path
+    );
+
+    let pool = Arc::new(Pool {
+        gdb,
+        size: size.max(1),
+        idle_timeout: duration_from_env("ESP_GDB_WRAPPER_POOL_IDLE_S", POOL_IDLE_TIMEOUT_DEFAULT),
+        job_timeout: duration_from_env(
+            "ESP_GDB_WRAPPER_POOL_JOB_TIMEOUT_S",
+            POOL_JOB_TIMEOUT_DEFAULT,
+        ),
+        slots: Mutex::new(HashMap::new()),
+        released: Condvar::new(),
+    });
+    let reaper = pool.clone();
+    thread::spawn(move || reaper.reap());
+    for stream in listener.incoming() {
+        let stream = match stream {
+            Ok(s) => s,
+            Err(_) => continue,
+        };
+        let pool = pool.clone();
+        thread::spawn(move || {
+            if let Err(e) = respond(&pool, stream) {
+                esp_debug_trace!("GDB pool request failed: {}", e);
+            }
+        });
+    }
+    Ok(())
+}
+
+/* Submit a job to the pool and print its output, None if the pool is not
+ * running or the job can not be passed to it */
+pub fn run(elf: &str, core: &str, commands: &[String]) -> Option<i32> {
+    let cwd = env::current_dir().ok()?.to_str()?.to_string();
+    let fields: Vec<&str> = [cwd.as_str(), elf, core]
+        .into_iter()
+        .chain(commands.iter().map(String::as_str))
+        .collect();
+    if fields.iter().any(|f| f.contains(['\t', '\n'])) {
+        return None;
+    }
+    let mut stream = UnixStream::connect(socket_path()?).ok()?;
+    stream
+        .write_all(format!("job\t{}\n", fields.join("\t")).as_bytes())
+        .ok()?;
+    let mut reader = BufReader::new(stream);
+    let mut header = String::new();
+    reader.read_line(&mut header).ok()?;
+    let fields: Vec<&str> = header.trim_end().split('\t').collect();
+    let ["exit", code, stdout_len, stderr_len] = fields[..] else {
+        return None;
+    };
+    let mut stdout = vec![0; stdout_len.parse().ok()?];
+    let mut stderr = vec![0; stderr_len.parse().ok()?];
+    reader.read_exact(&mut stdout).ok()?;
+    reader.read_exact(&mut stderr).ok()?;
+    let _ = io::stdout().write_all(&stdout);
+    let _ = io::stderr().write_all(&stderr);
+    code.parse().ok()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn quote() {
+        assert_eq!(mi_quote("bt"), "\"bt\"");
+        assert_eq!(
+            mi_quote("echo \"a\\b\"\n\t"),
+            "\"echo \\\"a\\\\b\\\"\\n\\t\""
+        );
+    }
+
+    #[test]
+    fn unquote() {
+        assert_eq!(
+            mi_unquote("\"#0  main () at x.c:3\\n\""),
+            b"#0  main () at x.c:3\n"
+        );
+        assert_eq!(mi_unquote("\"a\\tb\\\"c\\\\\""), b"a\tb\"c\\");
+        /* UTF-8 "é" and a short octal escape before a non-digit */
+        assert_eq!(mi_unquote("\"\\303\\251\\0x\""), b"\xc3\xa9\0x");
+        /* Anything after the closing quote is not part of the string */
+        assert_eq!(mi_unquote("\"ok\",more"), b"ok");
+    }
+
+    #[test]
+    fn quote_round_trip() {
+        let command = "printf \"%d\\n\", 1\t# \"x\"";
+        assert_eq!(mi_unquote(&mi_quote(command)), command.as_bytes());
+    }
+
+    #[test]
+    fn read_only_commands() {
+        for command in [
+            "bt",
+            "backtrace full",
+            "info registers",
+            "i r",
+            "info locals",
+            "thread apply all bt",
+            "frame 1",
+            "ptype struct task",
+            "disassemble main",
+        ] {
+            assert!(read_only(command), "{}", command);
+        }
+        for command in [
+            "",
+            "info line main",
+            "i li 3",
+            "frame apply all p $pc",
+            "thread apply all p x = 1",
+            "print x = 1",
+            "set var x = 1",
+            "call f()",
+            "continue",
+        ] {
+            assert!(!read_only(command), "{}", command);
+        }
+    }
+
+    #[test]
+    fn read_only_scripts() {
+        let dir = env::temp_dir().join(format!("esp-gdb-pool-{}-scripts", std::process::id()));
+        fs::create_dir_all(dir.join("sub")).unwrap();
+        fs::write(dir.join("summary.gdb"), "# summary\nbt\n\ninfo registers\n").unwrap();
+        fs::write(dir.join("sub/nested.gdb"), "source leaf.gdb\n").unwrap();
+        fs::write(dir.join("sub/leaf.gdb"), "thread apply all bt\n").unwrap();
+        fs::write(dir.join("writes.gdb"), "bt\nset var x = 1\n").unwrap();
+        fs::write(dir.join("loop.gdb"), "source loop.gdb\n").unwrap();
+        let job = |commands: &str| {
+            parse_job(&format!(
+                "job\t{}\tapp.elf\tcore\t{}",
+                dir.display(),
+                commands
+            ))
+            .unwrap()
+        };
+
+        /* Core dump summary scripts keep their worker */
+        assert!(job("source summary.gdb").read_only());
+        assert!(job("source sub/nested.gdb\tbt").read_only());
+        assert!(!job("source writes.gdb").read_only());
+        assert!(!job("source loop.gdb").read_only());
+        assert!(!job("source missing.gdb").read_only());
+        assert!(!job("source -v summary.gdb").read_only());
+        fs::remove_dir_all(&dir).unwrap();
+    }
+}
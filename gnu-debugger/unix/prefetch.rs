@@ -0,0 +1,80 @@
+use super::{trace, ESP_DEBUG_TRACE};
+use std::env;
+use std::fs::File;
+use std::io;
+use std::os::unix::io::AsRawFd;
+use std::path::{Path, PathBuf};
+use std::thread;
+use std::time::Instant;
+
+/* Linux limits a single readahead request to the readahead window of the
+ * device (128 KiB by default), so files are read ahead chunk by chunk */
+#[cfg(target_os = "linux")]
+const READAHEAD_CHUNK: u64 = 128 * 1024;
+
+/* Fill the page cache with files GDB start-up is going to page in, in background
+ * while the wrapper resolves Python. Set ESP_GDB_WRAPPER_NO_PREFETCH to disable. */
+pub fn start(files: Vec<PathBuf>) {
+    if files.is_empty() || env::var_os("ESP_GDB_WRAPPER_NO_PREFETCH").is_some() {
+        return;
+    }
+    esp_debug_trace!(
+        "Prefetching {} bytes of {:?}",
+        files
+            .iter()
+            .filter_map(|f| f.metadata().ok())
+            .map(|m| m.len())
+            .sum::<u64>(),
+        files
+    );
+    /* The thread is not joined: exec() of GDB stops it if it is still reading,
+     * its span is recorded only if it finishes before */
+    thread::spawn(move || {
+        let mut span = trace::span("prefetch");
+        let start = Instant::now();
+        let mut total = 0;
+        for file in &files {
+            match readahead(file) {
+                Ok(bytes) => total += bytes,
+                Err(e) => esp_debug_trace!("Prefetch of {:?} failed: {}", file, e),
+            }
+        }
+        esp_debug_trace!("Prefetched {} bytes in {:?}", total, start.elapsed());
+        span.detail(&format!("{} bytes", total));
+    });
+}
+
+/* readahead() returns when the data is read, so the elapsed time is the I/O time */
+#[cfg(target_os = "linux")]
+fn readahead(path: &Path) -> io::Result<u64> {
+    let file = File::open(path)?;
+    let len = file.metadata()?.len();
+    let mut offset = 0;
+    while offset < len {
+        let chunk = READAHEAD_CHUNK.min(len - offset);
+        if unsafe { libc::readahead(file.as_raw_fd(), offset as i64, chunk as usize) } != 0 {
+            return Err(io::Error::last_os_error());
+        }
+        offset += chunk;
+    }
+    Ok(len)
+}
+
+#[cfg(target_os = "macos")]
+fn readahead(path: &Path) -> io::Result<u64> {
+    let file = File::open(path)?;
+    let len = file.metadata()?.len();
+    let advice = libc::radvisory {
+        ra_offset: 0,
+        ra_count: len.min(i32::MAX as u64) as i32,
+    };
+    if unsafe { libc::fcntl(file.as_raw_fd(), libc::F_RDADVISE, &advice) } != 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(len)
+}
+
+#[cfg(not(any(target_os = "linux", target_os = "macos")))]
+fn readahead(_path: &Path) -> io::Result<u64> {
+    Err(io::Error::new(io::ErrorKind::Unsupported, "no readahead"))
+}
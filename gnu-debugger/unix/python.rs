@@ -0,0 +1,590 @@
+use super::{cache, ESP_DEBUG_TRACE};
+use std::env;
+use std::ffi::CString;
+use std::fs;
+use std::os::unix::ffi::OsStrExt;
+use std::os::unix::fs::MetadataExt;
+use std::os::unix::process::CommandExt;
+use std::path::{Component, Path, PathBuf};
+use std::process::{Command, Stdio};
+use std::sync::mpsc;
+use std::thread;
+use std::time::{Duration, Instant};
+
+const PYTHON_EXECUTABLE: &str = "python3";
+/* Single interpreter run reports version, library dir, base prefix and sys.path,
+ * one per line. sysconfig is not imported as nothing here needs it and -B
+ * prevents bytecode writes on read-only installations. */
+const PYTHON_PROBE_ARGS: [&str; 2] = ["-B", "-c"];
+const PYTHON_GET_INFO: &str = if cfg!(unix) {
+    "import os, sys; print('{}.{}'.format(*sys.version_info[:2]), \
+     os.path.join(sys.base_prefix, 'lib'), sys.base_prefix, \
+     os.pathsep.join(sys.path[1:]), sep='\\n', end='')"
+} else if cfg!(windows) {
+    "import os, sys; print('{}.{}'.format(*sys.version_info[:2]), \
+     sys.base_prefix, sys.base_prefix, \
+     os.pathsep.join(sys.path[1:]), sep='\\n', end='')"
+} else {
+    panic!("OS is not supported")
+};
+
+/* Overall deadline of probing all candidate interpreters at once */
+const PYTHON_PROBE_TIMEOUT_DEFAULT: Duration = Duration::from_millis(5000);
+/* Time more preferred candidates get after the first usable answer */
+const PYTHON_PROBE_GRACE: Duration = Duration::from_millis(100);
+/* Time to reap interpreters killed after the selection */
+const PYTHON_PROBE_REAP_TIMEOUT: Duration = Duration::from_millis(100);
+
+const PYTHON_INFO_CACHE: &str = "python-info";
+const PYTHON_PATH_DELIMITER: &str = ":";
+const PYCACHE_DIR_NAME: &str = "pycache";
+
+pub struct PythonInfo {
+    pub version: String,
+    pub libdir: String,
+    pub home: String,
+    pub path: String,
+}
+
+impl PythonInfo {
+    /* Start all candidates at once and take the most preferred one GDB is built
+     * for as soon as every more preferred candidate has finished; the rest are
+     * killed. After the first answer GDB is built for, more preferred candidates
+     * get PYTHON_PROBE_GRACE, so a slow one does not hold the start-up. Waiting
+     * is limited by ESP_GDB_WRAPPER_PROBE_TIMEOUT_MS overall. When waiting ends
+     * the best finished candidate is used. Without a candidate matching any GDB
+     * the most preferred working interpreter is returned. */
+    fn probe(gdb_versions: &[String]) -> Option<PythonInfo> {
+        let candidates = probe_candidates(gdb_versions);
+        esp_debug_trace!("Probing {:?} ...", candidates);
+        let start = Instant::now();
+        let timeout = env::var("ESP_GDB_WRAPPER_PROBE_TIMEOUT_MS")
+            .ok()
+            .and_then(|ms| ms.parse().ok())
+            .map_or(PYTHON_PROBE_TIMEOUT_DEFAULT, Duration::from_millis);
+        let mut deadline = start + timeout;
+
+        /* None while the candidate is running, Some(None) if it failed */
+        let mut results: Vec<Option<Option<PythonInfo>>> = vec![];
+        let mut pids = vec![];
+        let (tx, rx) = mpsc::channel();
+        for (i, python) in candidates.iter().enumerate() {
+            let child = Command::new(python)
+                .args(PYTHON_PROBE_ARGS)
+                .arg(PYTHON_GET_INFO)
+                .stdout(Stdio::piped())
+                .stderr(Stdio::null())
+                .process_group(0)
+                .spawn();
+            let child = match child {
+                Ok(c) => c,
+                Err(_) => {
+                    results.push(Some(None));
+                    pids.push(0);
+                    continue;
+                }
+            };
+            results.push(None);
+            pids.push(child.id() as libc::pid_t);
+            let tx = tx.clone();
+            thread::spawn(move || {
+                let info = child
+                    .wait_with_output()
+                    .ok()
+                    .filter(|o| o.status.success())
+                    .and_then(|o| PythonInfo::deserialize(&String::from_utf8_lossy(&o.stdout)));
+                let _ = tx.send((i, info));
+            });
+        }
+        drop(tx);
+
+        let selected = loop {
+            if let Some(selected) = select_probed(&results, gdb_versions, false) {
+                break selected;
+            }
+            let now = Instant::now();
+            match rx.recv_timeout(deadline.saturating_duration_since(now)) {
+                Ok((i, info)) => {
+                    esp_debug_trace!(
+                        "{:?} answered in {:?}: {}",
+                        candidates[i],
+                        start.elapsed(),
+                        info.as_ref().map_or("failed", |info| &info.version)
+                    );
+                    if info
+                        .as_ref()
+                        .is_some_and(|info| gdb_versions.contains(&info.version))
+                    {
+                        deadline = deadline.min(Instant::now() + PYTHON_PROBE_GRACE);
+                    }
+                    results[i] = Some(info);
+                }
+                Err(_) => {
+                    esp_debug_trace!("Python probe stopped waiting after {:?}", start.elapsed());
+                    break select_probed(&results, gdb_versions, true).flatten();
+                }
+            }
+        };
+
+        let running: Vec<usize> = (0..results.len())
+            .filter(|&i| results[i].is_none())
+            .collect();
+        /* Whole process group, wrapper scripts like pyenv shims have children */
+        for &i in &running {
+            unsafe { libc::kill(-pids[i], libc::SIGKILL) };
+        }
+        for _ in &running {
+            if rx.recv_timeout(PYTHON_PROBE_REAP_TIMEOUT).is_err() {
+                break;
+            }
+        }
+
+        let selected = selected?;
+        esp_debug_trace!(
+            "Python probe took {:?}, using {:?}",
+            start.elapsed(),
+            candidates[selected]
+        );
+        results[selected].take().flatten()
+    }
+
+    fn serialize(&self) -> String {
+        format!(
+            "{}\n{}\n{}\n{}",
+            self.version, self.libdir, self.home, self.path
+        )
+    }
+
+    fn deserialize(s: &str) -> Option<PythonInfo> {
+        let fields: Vec<&str> = s.split('\n').collect();
+        if fields.len() != 4 {
+            return None;
+        }
+        Some(PythonInfo {
+            version: fields[0].to_string(),
+            libdir: fields[1].to_string(),
+            home: fields[2].to_string(),
+            path: fields[3].to_string(),
+        })
+    }
+
+    /* Probe results depend on the candidate interpreters, the virtualenvs
+     * they belong to and the environment variables Python reads on start-up.
+     * Every candidate is stamped, the one selected may be any of them. */
+    fn cache_key(gdb_versions: &[String]) -> Option<String> {
+        let candidates = probe_candidates(gdb_versions);
+        if candidates.is_empty() {
+            return None;
+        }
+        let mut key = String::new();
+        for python in candidates {
+            let real_python = python.canonicalize().ok()?;
+            let meta = real_python.metadata().ok()?;
+            key += &format!(
+                "{}\t{}\t{}\t{}\t{}\t",
+                python.display(),
+                real_python.display(),
+                meta.ino(),
+                meta.mtime(),
+                meta.mtime_nsec()
+            );
+            let venv_cfg = python.parent()?.parent()?.join("pyvenv.cfg");
+            if let Ok(m) = venv_cfg.metadata() {
+                key += &format!("{}:{}\t", venv_cfg.display(), m.mtime());
+            }
+        }
+        for var in [
+            "IDF_PYTHON_ENV_PATH",
+            "VIRTUAL_ENV",
+            "PYTHONHOME",
+            "PYTHONPATH",
+            "PYTHONNOUSERSITE",
+        ] {
+            key += &format!("{}={}\t", var, env::var(var).unwrap_or_default());
+        }
+        key += &format!("GDB={}", gdb_versions.join(","));
+        Some(key)
+    }
+
+    /* Filesystem discovery goes first, then cached probe results, and
+     * interpreters are started only when neither of them is available.
+     * `gdb_versions` are Python versions of installed GDB-with-Python binaries,
+     * discovered interpreter of another version is not used. */
+    pub fn get(gdb_versions: &[String]) -> Option<PythonInfo> {
+        if let Some(info) = PythonInfo::discover() {
+            if gdb_versions.is_empty() || gdb_versions.contains(&info.version) {
+                return Some(info);
+            }
+            esp_debug_trace!("No GDB for discovered Python {}", info.version);
+        }
+        let key = match PythonInfo::cache_key(gdb_versions) {
+            Some(k) => k,
+            None => return PythonInfo::probe(gdb_versions),
+        };
+        let info = cache::get_or_insert_with(PYTHON_INFO_CACHE, &key, || {
+            PythonInfo::probe(gdb_versions).map(|i| i.serialize())
+        })?;
+        PythonInfo::deserialize(&info)
+    }
+}
+
+impl PythonInfo {
+    /* Derive PYTHON_GET_INFO values without starting the interpreter: locate it
+     * like execvp() does, read pyvenv.cfg for virtual environments and rebuild
+     * sys.path the way getpath and site do for the standard installation layout.
+     * Anything uncertain (PYTHONHOME, system site-packages of a virtualenv,
+     * distribution-specific layouts, ...) returns None to fall back to probing. */
+    fn discover() -> Option<PythonInfo> {
+        if env::var_os("ESP_GDB_WRAPPER_NO_DISCOVERY").is_some()
+            || env::var_os("PYTHONHOME").is_some()
+            || env::var_os("PYTHONUSERBASE").is_some()
+        {
+            return None;
+        }
+        let start = Instant::now();
+        let python = interpreter()?;
+        let exe_dir = python.parent()?;
+        let venv_cfg = [
+            exe_dir.join("pyvenv.cfg"),
+            exe_dir.parent()?.join("pyvenv.cfg"),
+        ]
+        .into_iter()
+        .find(|p| p.is_file());
+
+        let (version, prefix, mut site_dirs) = match venv_cfg {
+            Some(cfg_path) => {
+                let cfg = read_pyvenv_cfg(&cfg_path)?;
+                if cfg.include_system_site_packages {
+                    return None;
+                }
+                let version = major_minor(&cfg.version?)?;
+                let prefix = Path::new(&cfg.home?).parent()?.to_path_buf();
+                let site = cfg_path
+                    .parent()?
+                    .join("lib")
+                    .join(format!("python{}", version))
+                    .join("site-packages");
+                (version, prefix, vec![site])
+            }
+            None => {
+                if cfg!(target_os = "macos") {
+                    return None; // framework builds have their own user site layout
+                }
+                let (version, prefix) = installation(&python.canonicalize().ok()?)?;
+                let mut site_dirs = vec![];
+                if env::var_os("PYTHONNOUSERSITE").is_none() {
+                    let user_site = Path::new(&env::var_os("HOME")?)
+                        .join(".local")
+                        .join("lib")
+                        .join(format!("python{}", version))
+                        .join("site-packages");
+                    if user_site.is_dir() {
+                        site_dirs.push(user_site);
+                    }
+                }
+                site_dirs.push(
+                    prefix
+                        .join("lib")
+                        .join(format!("python{}", version))
+                        .join("site-packages"),
+                );
+                (version, prefix, site_dirs)
+            }
+        };
+
+        let stdlib = prefix.join("lib").join(format!("python{}", version));
+        let lib_dynload = stdlib.join("lib-dynload");
+        let main_site = site_dirs.pop()?;
+        if !stdlib.join("os.py").is_file() || !lib_dynload.is_dir() || !main_site.is_dir() {
+            return None;
+        }
+        site_dirs.push(main_site);
+
+        let mut path: Vec<PathBuf> = vec![];
+        if let Some(python_path) = env::var_os("PYTHONPATH") {
+            for p in env::split_paths(&python_path) {
+                if p.as_os_str().is_empty() {
+                    return None;
+                }
+                path.push(p);
+            }
+        }
+        path.push(
+            prefix
+                .join("lib")
+                .join(format!("python{}.zip", version.replace('.', ""))),
+        );
+        path.push(stdlib);
+        path.push(lib_dynload);
+        for site in site_dirs {
+            let pth_entries = read_pth_entries(&site);
+            path.push(site);
+            path.extend(pth_entries);
+        }
+
+        /* site.removeduppaths() makes entries absolute and drops duplicates */
+        let mut sys_path: Vec<String> = vec![];
+        for p in path {
+            let p = abspath(&p)?;
+            if !sys_path.contains(&p) {
+                sys_path.push(p);
+            }
+        }
+
+        let info = PythonInfo {
+            libdir: prefix.join("lib").display().to_string(),
+            home: prefix.display().to_string(),
+            version,
+            path: sys_path.join(PYTHON_PATH_DELIMITER),
+        };
+        esp_debug_trace!(
+            "Python {} discovered from {:?} in {:?}",
+            info.version,
+            python,
+            start.elapsed()
+        );
+        Some(info)
+    }
+}
+
+/* Interpreters in order of preference: ESP-IDF environment Python, python3
+ * from PATH and python3.X for every version GDB is built for, newest first.
+ * Names resolving to the same binary are probed once. */
+fn probe_candidates(gdb_versions: &[String]) -> Vec<PathBuf> {
+    let mut names = vec![PYTHON_EXECUTABLE.to_string()];
+    let mut versions = gdb_versions.to_vec();
+    versions.sort_by_key(|v| {
+        v.split('.')
+            .map(|n| n.parse().unwrap_or(0))
+            .collect::<Vec<u32>>()
+    });
+    names.extend(versions.iter().rev().map(|v| format!("python{}", v)));
+
+    let mut candidates: Vec<PathBuf> = vec![];
+    if let Some(idf_env) = env::var_os("IDF_PYTHON_ENV_PATH") {
+        let python = Path::new(&idf_env).join("bin").join(PYTHON_EXECUTABLE);
+        if is_executable(&python) {
+            candidates.push(python);
+        }
+    }
+    candidates.extend(names.iter().filter_map(|n| find_in_path(n)));
+
+    let mut real_paths = vec![];
+    candidates.retain(|c| {
+        let real = c.canonicalize().unwrap_or_else(|_| c.clone());
+        if real_paths.contains(&real) {
+            return false;
+        }
+        real_paths.push(real);
+        true
+    });
+    candidates
+}
+
+/* Some(selected candidate) when the choice is made, None to wait for more results.
+ * With `timed_out` the choice is made from the finished candidates. */
+fn select_probed(
+    results: &[Option<Option<PythonInfo>>],
+    gdb_versions: &[String],
+    timed_out: bool,
+) -> Option<Option<usize>> {
+    for (i, result) in results.iter().enumerate() {
+        match result {
+            None if !timed_out => return None,
+            Some(Some(info)) if gdb_versions.contains(&info.version) => return Some(Some(i)),
+            _ => (),
+        }
+    }
+    Some(results.iter().position(|r| matches!(r, Some(Some(_)))))
+}
+
+struct PyvenvCfg {
+    home: Option<String>,
+    version: Option<String>,
+    include_system_site_packages: bool,
+}
+
+fn read_pyvenv_cfg(path: &Path) -> Option<PyvenvCfg> {
+    let mut cfg = PyvenvCfg {
+        home: None,
+        version: None,
+        include_system_site_packages: false,
+    };
+    for line in fs::read_to_string(path).ok()?.lines() {
+        let (key, value) = match line.split_once('=') {
+            Some((k, v)) => (k.trim(), v.trim().to_string()),
+            None => continue,
+        };
+        match key {
+            "home" => cfg.home = Some(value),
+            /* "version_info" is written by virtualenv, "version" by venv */
+            "version_info" | "version" => {
+                if cfg.version.is_none() || key == "version_info" {
+                    cfg.version = Some(value);
+                }
+            }
+            "include-system-site-packages" => {
+                cfg.include_system_site_packages = value.eq_ignore_ascii_case("true")
+            }
+            _ => (),
+        }
+    }
+    Some(cfg)
+}
+
+/* Version and prefix of the installation from the real interpreter binary name:
+ * <prefix>/bin/python3.11 */
+fn installation(real_python: &Path) -> Option<(String, PathBuf)> {
+    let name = real_python.file_name()?.to_str()?;
+    let version = major_minor(name.strip_prefix("python")?)?;
+    let prefix = real_python.parent()?.parent()?.to_path_buf();
+    Some((version, prefix))
+}
+
+/* Cheap guess of the Python version and shared library GDB-with-Python is going
+ * to use, made before the environment is resolved. Virtualenv interpreters are
+ * symlinks to the base one, so the guess holds for them too. */
+pub fn guess_installation() -> Option<(String, PathBuf)> {
+    let (version, prefix) = installation(&interpreter()?.canonicalize().ok()?)?;
+    let libpython = if cfg!(target_os = "macos") {
+        format!("libpython{}.dylib", version)
+    } else {
+        format!("libpython{}.so.1.0", version)
+    };
+    Some((version, prefix.join("lib").join(libpython)))
+}
+
+/* "3.11.7.final.0" -> "3.11" */
+fn major_minor(version: &str) -> Option<String> {
+    let mut parts = version.split('.');
+    let major = parts.next()?;
+    let minor = parts.next()?;
+    if major != "3" || minor.is_empty() || !minor.chars().all(|c| c.is_ascii_digit()) {
+        return None;
+    }
+    Some(format!("{}.{}", major, minor))
+}
+
+/* Directories listed in *.pth files of the site directory, as site.addpackage() adds them */
+fn read_pth_entries(site: &Path) -> Vec<PathBuf> {
+    let mut pth_files: Vec<PathBuf> = match fs::read_dir(site) {
+        Ok(entries) => entries
+            .filter_map(|e| e.ok().map(|e| e.path()))
+            .filter(|p| p.extension().is_some_and(|ext| ext == "pth"))
+            .collect(),
+        Err(_) => return vec![],
+    };
+    pth_files.sort();
+
+    let mut entries = vec![];
+    for pth in pth_files {
+        let content = match fs::read_to_string(&pth) {
+            Ok(c) => c,
+            Err(_) => continue,
+        };
+        for line in content.lines() {
+            if line.starts_with('#')
+                || line.trim().is_empty()
+                || line.starts_with("import ")
+                || line.starts_with("import\t")
+            {
+                continue;
+            }
+            let dir = site.join(line.trim_end());
+            if dir.exists() {
+                entries.push(dir);
+            }
+        }
+    }
+    entries
+}
+
+/* os.path.abspath(): make absolute and normalize without resolving symlinks */
+fn abspath(path: &Path) -> Option<String> {
+    let path = if path.is_absolute() {
+        path.to_path_buf()
+    } else {
+        env::current_dir().ok()?.join(path)
+    };
+    let mut normalized = PathBuf::from("/");
+    for component in path.components() {
+        match component {
+            Component::ParentDir => {
+                normalized.pop();
+            }
+            Component::Normal(c) => normalized.push(c),
+            _ => (),
+        }
+    }
+    Some(normalized.to_str()?.to_string())
+}
+
+fn is_readable(path: &str) -> bool {
+    match CString::new(Path::new(path).as_os_str().as_bytes()) {
+        Ok(path) => unsafe { libc::access(path.as_ptr(), libc::R_OK) == 0 },
+        Err(_) => false,
+    }
+}
+
+/* Import path for GDB's Python: sys.path of the interpreter followed by PYTHONPATH
+ * of the environment, made absolute, without duplicates and without entries which
+ * do not exist or can not be read. Every import in GDB checks each entry. */
+pub fn import_path(sys_path: &str) -> String {
+    let python_path = env::var("PYTHONPATH").unwrap_or_default();
+    let entries: Vec<&str> = sys_path
+        .split(PYTHON_PATH_DELIMITER)
+        .chain(python_path.split(PYTHON_PATH_DELIMITER))
+        .filter(|p| !p.is_empty())
+        .collect();
+    let mut import_path: Vec<String> = vec![];
+    for entry in &entries {
+        match abspath(Path::new(entry)) {
+            Some(p) if !import_path.contains(&p) && is_readable(&p) => import_path.push(p),
+            _ => (),
+        }
+    }
+    esp_debug_trace!(
+        "Python import path entries: {} pruned to {}",
+        entries.len(),
+        import_path.len()
+    );
+    import_path.join(PYTHON_PATH_DELIMITER)
+}
+
+/* GDB's Python writes bytecode to the per-user cache instead of __pycache__
+ * directories of the toolchain, which may be installed on a read-only mount.
+ * Bytecode settings of the user are kept. */
+pub fn pycache_prefix() -> Option<String> {
+    if env::var_os("PYTHONPYCACHEPREFIX").is_some()
+        || env::var_os("PYTHONDONTWRITEBYTECODE").is_some()
+    {
+        return None;
+    }
+    let dir = cache::dir()?.join(PYCACHE_DIR_NAME);
+    fs::create_dir_all(&dir).ok()?;
+    Some(dir.to_str()?.to_string())
+}
+
+/* Interpreter the environment is discovered for: the one of ESP-IDF
+ * Python environment if it is exported, python3 from PATH otherwise */
+pub fn interpreter() -> Option<PathBuf> {
+    match env::var_os("IDF_PYTHON_ENV_PATH") {
+        Some(idf_env) => Some(Path::new(&idf_env).join("bin").join(PYTHON_EXECUTABLE)),
+        None => find_in_path(PYTHON_EXECUTABLE),
+    }
+}
+
+/* Search the executable in PATH the same way as execvp() does */
+fn find_in_path(name: &str) -> Option<PathBuf> {
+    let path = env::var_os("PATH")?;
+    env::split_paths(&path)
+        .map(|dir| dir.join(name))
+        .find(|p| is_executable(p))
+}
+
+fn is_executable(path: &Path) -> bool {
+    match path.metadata() {
+        Ok(m) => m.is_file() && m.mode() & 0o111 != 0,
+        Err(_) => false,
+    }
+}
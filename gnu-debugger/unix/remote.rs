@@ -0,0 +1,50 @@
+use super::ESP_DEBUG_TRACE;
+use std::env;
+
+const PROFILE_THROUGHPUT: &str = "throughput";
+/* GDB does not send larger packets, and memory reads are limited further
+ * by the PacketSize the stub reports in qSupported */
+const REMOTE_PACKET_SIZE_DEFAULT: u32 = 16384;
+/* Bytes, dcache lines are fetched whole on stack and code accesses */
+const DCACHE_LINE_SIZE: u32 = 256;
+const DCACHE_LINES: u32 = 4096;
+
+/* Settings of the profile selected by ESP_GDB_WRAPPER_PROFILE, passed with
+ * -iex so they are in effect before "target remote" in user scripts and
+ * user -iex options still override them. "throughput" is for dumping and
+ * loading large memory regions: packets of ESP_GDB_WRAPPER_REMOTE_PACKET_SIZE
+ * bytes, no acknowledgements when the stub supports it and larger dcache
+ * lines. Memory regions are not defined for caching, GDB refuses accesses
+ * outside of defined regions, and the memory map depends on the chip. */
+pub fn profile_args() -> Vec<String> {
+    let profile = match env::var("ESP_GDB_WRAPPER_PROFILE") {
+        Ok(profile) => profile,
+        Err(_) => return vec![],
+    };
+    if profile != PROFILE_THROUGHPUT {
+        esp_debug_trace!("Unknown GDB profile {:?}", profile);
+        return vec![];
+    }
+    throughput_profile()
+}
+
+fn throughput_profile() -> Vec<String> {
+    let packet_size = env::var("ESP_GDB_WRAPPER_REMOTE_PACKET_SIZE")
+        .ok()
+        .and_then(|s| s.parse().ok())
+        .unwrap_or(REMOTE_PACKET_SIZE_DEFAULT);
+    [
+        "set confirm off".to_string(),
+        "set pagination off".to_string(),
+        "set remote noack-packet on".to_string(),
+        format!("set remote memory-read-packet-size {}", packet_size),
+        format!("set remote memory-write-packet-size {}", packet_size),
+        format!("set dcache line-size {}", DCACHE_LINE_SIZE),
+        format!("set dcache size {}", DCACHE_LINES),
+        "set stack-cache on".to_string(),
+        "set code-cache on".to_string(),
+    ]
+    .into_iter()
+    .flat_map(|command| ["-iex".to_string(), command])
+    .collect()
+}
@@ -0,0 +1,228 @@
+use super::layout::Layout;
+use super::manifest::{Manifest, MANIFEST_HEADER};
+use super::ESP_DEBUG_TRACE;
+use std::collections::HashMap;
+use std::env;
+use std::fs;
+use std::io::{self, BufRead, BufReader, Read, Write};
+use std::os::unix::net::{UnixListener, UnixStream};
+use std::panic;
+use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+
+/* Socket location rule is shared with the toolchain wrapper */
+const RESOLVER_SOCKET_NAME: &str = "esp-wrapper-resolver.sock";
+const RESOLVER_TIMEOUT: Duration = Duration::from_millis(500);
+/* GDB wrapper needs a test run of GDB on the first request */
+const RESOLVER_GDB_TIMEOUT: Duration = Duration::from_secs(10);
+
+/* Hidden option of the GDB wrapper: resolve and print the manifest */
+pub const RESOLVE_OPTION: &str = "--esp-wrapper-daemon-resolve";
+
+/* Client environment GDB resolution depends on, sent with the request */
+const RESOLVER_ENVIRONMENT: [&str; 15] = [
+    "PATH",
+    "HOME",
+    "LD_LIBRARY_PATH",
+    "IDF_PYTHON_ENV_PATH",
+    "VIRTUAL_ENV",
+    "PYTHONHOME",
+    "PYTHONPATH",
+    "PYTHONNOUSERSITE",
+    "PYTHONUSERBASE",
+    "PYTHONPYCACHEPREFIX",
+    "PYTHONDONTWRITEBYTECODE",
+    "XDG_CACHE_HOME",
+    "ESP_GDB_WRAPPER_CACHE_DIR",
+    "ESP_GDB_WRAPPER_NO_CACHE",
+    "ESP_GDB_WRAPPER_NO_DISCOVERY",
+];
+
+/* ESP_WRAPPER_RESOLVER_SOCKET overrides the location, empty value disables the daemon */
+fn socket_path() -> Option<PathBuf> {
+    match env::var_os("ESP_WRAPPER_RESOLVER_SOCKET") {
+        Some(p) if p.is_empty() => None,
+        Some(p) => Some(PathBuf::from(p)),
+        None => Some(Path::new(&env::var_os("XDG_RUNTIME_DIR")?).join(RESOLVER_SOCKET_NAME)),
+    }
+}
+
+/* Ask the per-user resolver daemon, None if it is not running or can not answer */
+pub fn query_gdb(wrapper_path: &Path) -> Option<Manifest> {
+    let mut stream = UnixStream::connect(socket_path()?).ok()?;
+    stream.set_read_timeout(Some(RESOLVER_GDB_TIMEOUT)).ok()?;
+    stream.set_write_timeout(Some(RESOLVER_TIMEOUT)).ok()?;
+    let mut request = format!("gdb\t{}", wrapper_path.display());
+    for var in RESOLVER_ENVIRONMENT {
+        if let Ok(value) = env::var(var) {
+            request += &format!("\t{}={}", var, value);
+        }
+    }
+    stream.write_all((request + "\n").as_bytes()).ok()?;
+    let mut response = String::new();
+    stream.read_to_string(&mut response).ok()?;
+    let manifest = Manifest::deserialize(&response);
+    match manifest {
+        Some(_) => esp_debug_trace!("GDB is resolved by the daemon"),
+        None => esp_debug_trace!("Resolver daemon can not resolve GDB"),
+    }
+    manifest
+}
+
+/* Cold GDB resolution in a child wrapper started with the client environment,
+ * the daemon environment is shared by all connection threads and stays as it
+ * is. The child prints its trace output, if enabled, then the manifest. */
+fn resolve_gdb(wrapper_path: &Path, vars: &[(&str, &str)]) -> Option<Manifest> {
+    let mut command = Command::new(wrapper_path);
+    command.arg(RESOLVE_OPTION);
+    for var in RESOLVER_ENVIRONMENT {
+        command.env_remove(var);
+    }
+    let output = command
+        .envs(vars.iter().copied())
+        .stdin(Stdio::null())
+        .stderr(Stdio::inherit())
+        .output()
+        .ok()?;
+    let output = String::from_utf8_lossy(&output.stdout);
+    let start = output.rfind(MANIFEST_HEADER)?;
+    print!("{}", &output[..start]);
+    Manifest::deserialize(&output[start..])
+}
+
+fn resolve_toolchain(wrapper_path: &Path) -> Option<String> {
+    let layout = panic::catch_unwind(|| Layout::new(wrapper_path)).ok()?;
+    if !layout.exec_path.exists() || !layout.dynconfig_path.exists() {
+        return None;
+    }
+    let mut response = format!(
+        "exec\t{}\ndynconfig\t{}\n",
+        layout.exec_path.display(),
+        layout.dynconfig_path.display()
+    );
+    if let Some(option) = layout.dynconfig_option() {
+        response += &format!("option\t{}\n", option);
+    }
+    Some(response)
+}
+
+struct Daemon {
+    /* Request line of a GDB wrapper to its resolution result */
+    gdb: Mutex<HashMap<String, Manifest>>,
+    /* One cold GDB resolution at a time, clients of the same wrapper that wait
+     * for it get its result */
+    resolving: Mutex<()>,
+}
+
+impl Daemon {
+    /* Results are kept while files they were derived from are unchanged,
+     * so a cached answer costs a few stat() calls */
+    fn cached_gdb(&self, request: &str) -> Option<String> {
+        let gdb = self.gdb.lock().unwrap();
+        let manifest = gdb.get(request).filter(|m| m.is_current())?;
+        Some(manifest.serialize())
+    }
+
+    /* Connections are served by their own threads. Toolchain requests and
+     * cached GDB answers never wait for a cold GDB resolution, which runs the
+     * Python probe and the GDB self-test. */
+    fn respond(&self, request: &str) -> String {
+        let mut fields = request.split('\t');
+        match (fields.next(), fields.next()) {
+            (Some("toolchain"), Some(wrapper)) => {
+                resolve_toolchain(Path::new(wrapper)).unwrap_or_default()
+            }
+            (Some("gdb"), Some(wrapper)) => {
+                if let Some(response) = self.cached_gdb(request) {
+                    return response;
+                }
+                let _resolving = self.resolving.lock().unwrap();
+                /* Resolved by another client while this one was waiting */
+                if let Some(response) = self.cached_gdb(request) {
+                    return response;
+                }
+                let vars: Vec<(&str, &str)> = fields
+                    .filter_map(|f| f.split_once('='))
+                    .filter(|(name, _)| RESOLVER_ENVIRONMENT.contains(name))
+                    .collect();
+                match resolve_gdb(Path::new(wrapper), &vars) {
+                    Some(manifest) => {
+                        let response = manifest.serialize();
+                        self.gdb
+                            .lock()
+                            .unwrap()
+                            .insert(request.to_string(), manifest);
+                        response
+                    }
+                    None => String::new(),
+                }
+            }
+            _ => String::new(),
+        }
+    }
+
+    fn serve_connection(&self, mut stream: UnixStream) {
+        let _ = stream.set_read_timeout(Some(RESOLVER_TIMEOUT));
+        let _ = stream.set_write_timeout(Some(RESOLVER_TIMEOUT));
+        let mut request = String::new();
+        if BufReader::new(&stream).read_line(&mut request).is_err() {
+            return;
+        }
+        let start = Instant::now();
+        let response = self.respond(request.trim_end_matches('\n'));
+        let _ = stream.write_all(response.as_bytes());
+        esp_debug_trace!(
+            "{} request answered in {:?}",
+            request.split('\t').next().unwrap_or_default(),
+            start.elapsed()
+        );
+    }
+}
+
+/* Listen on a socket only the user can connect to, unless "server" is
+ * already running on it. bind() creates the socket with user-only
+ * permissions, changing them afterwards leaves a window for other users to
+ * connect. */
+pub fn listen_private(path: &Path, server: &str) -> io::Result<UnixListener> {
+    if UnixStream::connect(path).is_ok() {
+        return Err(io::Error::new(
+            io::ErrorKind::AddrInUse,
+            format!("{} is already running on {:?}", server, path),
+        ));
+    }
+    let _ = fs::remove_file(path);
+    let umask = unsafe { libc::umask(0o077) };
+    let listener = UnixListener::bind(path);
+    unsafe { libc::umask(umask) };
+    listener
+}
+
+/* Serve resolution requests of GDB and toolchain wrappers until killed.
+ * Resolution failures (wrapper assertions included) are answered with an empty
+ * response, so the client resolves locally and reports the error itself. */
+pub fn serve() -> io::Result<()> {
+    let path = socket_path().ok_or(io::Error::new(
+        io::ErrorKind::NotFound,
+        "Set XDG_RUNTIME_DIR or ESP_WRAPPER_RESOLVER_SOCKET",
+    ))?;
+    let listener = listen_private(&path, "Resolver daemon")?;
+    panic::set_hook(Box::new(|info| esp_debug_trace!("{}", info)));
+    esp_debug_trace!("Resolver daemon is listening on {:?}", path);
+
+    let daemon = Arc::new(Daemon {
+        gdb: Mutex::new(HashMap::new()),
+        resolving: Mutex::new(()),
+    });
+    for stream in listener.incoming() {
+        let stream = match stream {
+            Ok(s) => s,
+            Err(_) => continue,
+        };
+        let daemon = daemon.clone();
+        thread::spawn(move || daemon.serve_connection(stream));
+    }
+    Ok(())
+}
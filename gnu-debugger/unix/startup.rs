@@ -0,0 +1,105 @@
+use super::ESP_DEBUG_TRACE;
+use std::env;
+use std::fs::File;
+use std::io::Write;
+use std::path::{Path, PathBuf};
+use std::process;
+
+pub const STARTUP_STATS_OPTION: &str = "--esp-wrapper-startup-stats";
+
+/* GDB start-up statistics are requested by --esp-wrapper-startup-stats in
+ * front of the usual GDB arguments */
+pub fn requested() -> bool {
+    env::args().nth(1).as_deref() == Some(STARTUP_STATS_OPTION)
+}
+
+/* Per-session report next to the phase trace of ESP_WRAPPER_TRACE_FILE,
+ * "trace.json.gdb-<pid>.log", or in the temporary directory */
+fn report_path() -> PathBuf {
+    let pid = process::id();
+    match env::var_os("ESP_WRAPPER_TRACE_FILE").filter(|path| !path.is_empty()) {
+        Some(trace) => {
+            let trace = Path::new(&trace);
+            let name = trace.file_name().unwrap_or_default().to_string_lossy();
+            trace.with_file_name(format!("{}.gdb-{}.log", name, pid))
+        }
+        None => env::temp_dir().join(format!("esp-gdb-startup-{}.log", pid)),
+    }
+}
+
+/* Commands around user arguments: the first ones run before local .gdbinit
+ * and ELF loading, the last ones after user -x/-ex. Up to the first user
+ * command GDB prints time, memory and symtab counts after every command to
+ * its stdout, which goes to the report only, as does everything else GDB
+ * prints during start-up. Timestamped symbol file and auto-load debug
+ * messages go to the report only until the end. The output of user -x/-ex
+ * commands stays on the terminal and is copied to the report. The report
+ * ends with symbol statistics of every objfile, written to the report only.
+ * Home ~/.gdbinit runs before -iex and is not covered. */
+pub fn gdb_args(gdb: &str, user_args: &[String]) -> (Vec<String>, Vec<String>) {
+    if !requested() {
+        return (vec![], vec![]);
+    }
+    let path = report_path();
+    let header = format!(
+        "GDB start-up report\ngdb: {}\narguments: {:?}\n\n",
+        gdb, user_args
+    );
+    if let Err(e) = File::create(&path).and_then(|mut f| f.write_all(header.as_bytes())) {
+        eprintln!("Can't write GDB start-up report {:?}: {}", path, e);
+        return (vec![], vec![]);
+    }
+    eprintln!("GDB start-up statistics are written to {}", path.display());
+    esp_debug_trace!("GDB start-up report {:?}", path);
+    let before = [
+        format!("set logging file {}", path.display()),
+        "set logging overwrite off".to_string(),
+        "set logging redirect on".to_string(),
+        "set logging debugredirect on".to_string(),
+        "set logging enabled on".to_string(),
+        "set debug timestamp on".to_string(),
+        "set debug symfile on".to_string(),
+        "set debug auto-load on".to_string(),
+        "maint set per-command on".to_string(),
+    ];
+    /* -ex commands in front of the user ones run after ELF loading and local
+     * .gdbinit. Redirection takes effect when logging is enabled. */
+    let started = [
+        "maint set per-command off",
+        "set logging enabled off",
+        "set logging redirect off",
+        "set logging enabled on",
+    ];
+    let after = [
+        "set debug auto-load off",
+        "set debug symfile off",
+        "set debug timestamp off",
+        "set logging enabled off",
+        "set logging redirect on",
+        "set logging enabled on",
+        "maint print statistics",
+        "set logging enabled off",
+        "set logging redirect off",
+    ];
+    let ex = |commands: &[&str]| -> Vec<String> {
+        commands
+            .iter()
+            .flat_map(|command| ["-ex".to_string(), command.to_string()])
+            .collect()
+    };
+    let mut before: Vec<String> = before
+        .into_iter()
+        .flat_map(|command| ["-iex".to_string(), command])
+        .collect();
+    before.extend(ex(&started));
+    (before, ex(&after))
+}
+
+/* Arguments after --args are for the inferior, options have to go before */
+pub fn insert_options(argv: &mut Vec<String>, user_start: usize, options: Vec<String>) {
+    let end = argv[user_start..]
+        .iter()
+        .position(|a| a == "--args" || a == "-args")
+        .map_or(argv.len(), |i| user_start + i);
+    argv.splice(end..end, options);
+}
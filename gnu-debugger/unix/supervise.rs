@@ -0,0 +1,210 @@
+use super::ESP_DEBUG_TRACE;
+use std::io::{self, Read, Write};
+use std::os::unix::process::ExitStatusExt;
+use std::process::{Child, Command, ExitStatus, Stdio};
+use std::sync::atomic::{AtomicI32, Ordering};
+use std::sync::{mpsc, Arc, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+
+const POLL_INTERVAL: Duration = Duration::from_millis(10);
+const STDERR_DRAIN_TIMEOUT: Duration = Duration::from_millis(200);
+
+/* Messages of dynamic loader and embedded Python failing to start */
+const STARTUP_FAILURE_MARKERS: [&str; 5] = [
+    "error while loading shared libraries",
+    "Library not loaded",
+    "Fatal Python error",
+    "Could not find platform independent libraries",
+    "No module named 'encodings'",
+];
+
+static CHILD_PID: AtomicI32 = AtomicI32::new(0);
+
+pub enum Outcome {
+    Exited(ExitStatus),
+    StartupFailed,
+}
+
+extern "C" fn forward_signal(signal: libc::c_int) {
+    let pid = CHILD_PID.load(Ordering::SeqCst);
+    if pid > 0 {
+        unsafe { libc::kill(pid, signal) };
+    }
+}
+
+/* Keys of the terminal reach the whole process group, GDB included, and are
+ * sent by the kernel (si_pid 0). Signals sent with kill() to the wrapper, the
+ * process a launcher knows, are forwarded. */
+extern "C" fn forward_sent_signal(
+    signal: libc::c_int,
+    info: *mut libc::siginfo_t,
+    _context: *mut libc::c_void,
+) {
+    if unsafe { (*info).si_pid() } != 0 {
+        forward_signal(signal);
+    } else if signal == libc::SIGTSTP {
+        /* Stop with GDB, as the default action does */
+        unsafe { libc::kill(libc::getpid(), libc::SIGSTOP) };
+    }
+}
+
+/* Only the loader and Python initialization messages tell a start-up failure,
+ * GDB failing for any other reason is not run again */
+fn is_startup_failure(status: &ExitStatus, stderr: &[u8]) -> bool {
+    if status.success() {
+        return false;
+    }
+    let stderr = String::from_utf8_lossy(stderr);
+    STARTUP_FAILURE_MARKERS.iter().any(|m| stderr.contains(m))
+}
+
+/* Last output of GDB to the start-up pipe */
+const HANDOVER_MARKER: &str = "esp-gdb-wrapper: handover\n";
+
+/* First command of GDB: Python works, so stderr goes back to the terminal
+ * after the marker. The start-up pipe is closed by it. */
+fn handover_command(stderr_fd: libc::c_int) -> String {
+    format!(
+        "python import os; os.write(2, b'{0}\\n'); os.dup2({1}, 2); os.close({1})",
+        HANDOVER_MARKER.trim_end(),
+        stderr_fd
+    )
+}
+
+/* Run GDB-with-Python as a child sharing the terminal and process group of
+ * the wrapper. Its stderr is a pipe held back by the wrapper until GDB has
+ * initialized Python and switched stderr to the terminal with the first -iex
+ * command. If GDB dies before that with a loader or Python initialization
+ * failure the output is dropped and the caller can silently start another
+ * GDB. Output held longer than the start-up window is passed through. After
+ * the handover the wrapper only waits for GDB and forwards signals, and the
+ * session is never run again. */
+pub fn run(argv: &[String], startup_window: Duration) -> io::Result<Outcome> {
+    /* Inherited by GDB, dup() does not set close-on-exec */
+    let terminal_stderr = unsafe { libc::dup(2) };
+    if terminal_stderr < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    let spawned = Command::new(&argv[0])
+        .arg("-iex")
+        .arg(handover_command(terminal_stderr))
+        .args(&argv[1..])
+        .stderr(Stdio::piped())
+        .spawn();
+    unsafe { libc::close(terminal_stderr) };
+    let mut child = spawned?;
+    CHILD_PID.store(child.id() as i32, Ordering::SeqCst);
+
+    unsafe {
+        let mut action: libc::sigaction = std::mem::zeroed();
+        action.sa_sigaction = forward_sent_signal as libc::sighandler_t;
+        action.sa_flags = libc::SA_SIGINFO | libc::SA_RESTART;
+        libc::sigemptyset(&mut action.sa_mask);
+        for signal in [libc::SIGINT, libc::SIGQUIT, libc::SIGTSTP] {
+            libc::sigaction(signal, &action, std::ptr::null_mut());
+        }
+        /* SIGCONT resumes GDB stopped by a forwarded SIGTSTP */
+        for signal in [
+            libc::SIGTERM,
+            libc::SIGHUP,
+            libc::SIGUSR1,
+            libc::SIGUSR2,
+            libc::SIGCONT,
+        ] {
+            libc::signal(signal, forward_signal as libc::sighandler_t);
+        }
+    }
+
+    /* Some(buffer) while holding the output back, None when passing it through */
+    let held_stderr = Arc::new(Mutex::new(Some(Vec::new())));
+    let (eof_tx, eof_rx) = mpsc::channel();
+    let mut child_stderr = child.stderr.take().expect("piped stderr");
+    let relay_stderr = held_stderr.clone();
+    thread::spawn(move || {
+        let mut chunk = [0u8; 4096];
+        while let Ok(n) = child_stderr.read(&mut chunk) {
+            if n == 0 {
+                break;
+            }
+            match relay_stderr.lock().unwrap().as_mut() {
+                Some(buffer) => buffer.extend_from_slice(&chunk[..n]),
+                None => {
+                    let output = chunk[..n].strip_suffix(HANDOVER_MARKER.as_bytes());
+                    let _ = io::stderr().write_all(output.unwrap_or(&chunk[..n]));
+                }
+            }
+        }
+        let _ = eof_tx.send(());
+    });
+
+    let deadline = Instant::now() + startup_window;
+    let mut handed_over = false;
+    while Instant::now() < deadline {
+        /* End of the pipe without the marker: GDB is exiting */
+        let eof = eof_rx.recv_timeout(POLL_INTERVAL).is_ok();
+        if eof {
+            if let Some(buffer) = held_stderr.lock().unwrap().as_mut() {
+                if buffer.ends_with(HANDOVER_MARKER.as_bytes()) {
+                    buffer.truncate(buffer.len() - HANDOVER_MARKER.len());
+                    handed_over = true;
+                    break;
+                }
+            }
+        }
+        let status = if eof {
+            Some(wait(&mut child)?)
+        } else {
+            child.try_wait()?
+        };
+        if let Some(status) = status {
+            if !eof {
+                let _ = eof_rx.recv_timeout(STDERR_DRAIN_TIMEOUT);
+            }
+            let stderr = held_stderr.lock().unwrap().take().unwrap_or_default();
+            if is_startup_failure(&status, &stderr) {
+                esp_debug_trace!(
+                    "GDB failed on start-up ({}): {}",
+                    status,
+                    String::from_utf8_lossy(&stderr).trim()
+                );
+                return Ok(Outcome::StartupFailed);
+            }
+            let _ = io::stderr().write_all(&stderr);
+            return Ok(Outcome::Exited(status));
+        }
+    }
+
+    if handed_over {
+        esp_debug_trace!("GDB started successfully, handing over");
+    } else {
+        esp_debug_trace!("GDB start-up is longer than the window, passing its output through");
+    }
+    if let Some(stderr) = held_stderr.lock().unwrap().take() {
+        let _ = io::stderr().write_all(&stderr);
+    }
+    let status = wait(&mut child)?;
+    let _ = eof_rx.recv_timeout(STDERR_DRAIN_TIMEOUT);
+    Ok(Outcome::Exited(status))
+}
+
+fn wait(child: &mut Child) -> io::Result<ExitStatus> {
+    loop {
+        match child.wait() {
+            Err(e) if e.kind() == io::ErrorKind::Interrupted => continue,
+            result => return result,
+        }
+    }
+}
+
+/* Exit with the same status as GDB: same exit code or death by the same signal */
+pub fn exit_like(status: ExitStatus) -> ! {
+    if let Some(signal) = status.signal() {
+        unsafe {
+            libc::signal(signal, libc::SIG_DFL);
+            libc::kill(libc::getpid(), signal);
+        }
+        std::process::exit(128 + signal);
+    }
+    std::process::exit(status.code().unwrap_or(-1));
+}
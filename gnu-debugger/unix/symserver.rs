@@ -0,0 +1,482 @@
+use super::elf::Elf;
+use super::{cache, exe, ESP_DEBUG_TRACE};
+use std::collections::hash_map::DefaultHasher;
+use std::collections::{HashMap, HashSet};
+use std::env;
+use std::fs::{self, File};
+use std::hash::{Hash, Hasher};
+use std::io::{self, BufRead, BufReader, Read, Write};
+use std::net::{Ipv4Addr, SocketAddr, TcpListener, TcpStream};
+use std::os::unix::fs::MetadataExt;
+use std::os::unix::process::CommandExt;
+use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
+use std::sync::{Arc, Condvar, Mutex, MutexGuard};
+use std::thread;
+use std::time::{Duration, Instant};
+
+const SYMBOL_INDEX_CACHE: &str = "symbol-index";
+const SYMBOL_SERVER_CACHE: &str = "symbol-server";
+const SYMBOL_SERVER_START_TIMEOUT: Duration = Duration::from_secs(2);
+const SYMBOL_SERVER_CONNECT_TIMEOUT: Duration = Duration::from_millis(100);
+const SYMBOL_SERVER_POLL_INTERVAL: Duration = Duration::from_millis(20);
+/* A lookup miss rescans the directories, not more often than that */
+const RESCAN_INTERVAL: Duration = Duration::from_secs(1);
+const HTTP_REQUEST_TIMEOUT: Duration = Duration::from_secs(5);
+/* Request line and headers, longer requests are rejected */
+const HTTP_REQUEST_MAX: u64 = 8192;
+/* Random bytes of the access token */
+const TOKEN_SIZE: usize = 16;
+
+/* ESP_GDB_WRAPPER_SYMBOL_DIRS: directories of firmware ELFs separated by ':' */
+fn dirs_from_env() -> Vec<PathBuf> {
+    env::var_os("ESP_GDB_WRAPPER_SYMBOL_DIRS")
+        .map(|dirs| env::split_paths(&dirs).collect())
+        .unwrap_or_default()
+}
+
+fn canonical_dirs(dirs: &[PathBuf]) -> Vec<PathBuf> {
+    dirs.iter()
+        .filter_map(|d| fs::canonicalize(d).ok())
+        .collect()
+}
+
+/* Cache entries of a server and its index are named by the directory set */
+fn cache_names(dirs: &[PathBuf]) -> (String, String, String) {
+    let key = dirs
+        .iter()
+        .map(|d| d.display().to_string())
+        .collect::<Vec<String>>()
+        .join("\t");
+    let mut hasher = DefaultHasher::new();
+    key.hash(&mut hasher);
+    let hash = hasher.finish();
+    (
+        format!("{}-{:016x}", SYMBOL_INDEX_CACHE, hash),
+        format!("{}-{:016x}", SYMBOL_SERVER_CACHE, hash),
+        key,
+    )
+}
+
+/* File as it was when its build-id was read */
+#[derive(Clone)]
+struct Stamp {
+    size: u64,
+    mtime: i64,
+    mtime_nsec: i64,
+    build_id: Option<String>,
+}
+
+impl Stamp {
+    fn matches(&self, m: &fs::Metadata) -> bool {
+        self.size == m.len() && self.mtime == m.mtime() && self.mtime_nsec == m.mtime_nsec()
+    }
+}
+
+/* Build-id to ELF map of the directories, kept in the per-user cache. Only
+ * files added or changed since the last scan are opened, and only their
+ * headers and note sections are read from the mapping. */
+struct Index {
+    dirs: Vec<PathBuf>,
+    cache_name: String,
+    cache_key: String,
+    files: HashMap<PathBuf, Stamp>,
+    by_id: HashMap<String, PathBuf>,
+    scanned: Option<Instant>,
+    /* The directories are walked without holding the lock */
+    rescanning: bool,
+}
+
+impl Index {
+    fn load(dirs: Vec<PathBuf>) -> Index {
+        let (cache_name, _, cache_key) = cache_names(&dirs);
+        let mut files = HashMap::new();
+        for line in cache::read(&cache_name, &cache_key)
+            .unwrap_or_default()
+            .lines()
+        {
+            let fields: Vec<&str> = line.splitn(5, '\t').collect();
+            let [build_id, size, mtime, mtime_nsec, path] = fields[..] else {
+                continue;
+            };
+            let (Ok(size), Ok(mtime), Ok(mtime_nsec)) =
+                (size.parse(), mtime.parse(), mtime_nsec.parse())
+            else {
+                continue;
+            };
+            let stamp = Stamp {
+                size,
+                mtime,
+                mtime_nsec,
+                build_id: (!build_id.is_empty()).then(|| build_id.to_string()),
+            };
+            files.insert(PathBuf::from(path), stamp);
+        }
+        let mut index = Index {
+            dirs,
+            cache_name,
+            cache_key,
+            files,
+            by_id: HashMap::new(),
+            scanned: None,
+            rescanning: false,
+        };
+        index.update_ids();
+        index
+    }
+
+    fn update_ids(&mut self) {
+        let mut paths: Vec<&PathBuf> = self.files.keys().collect();
+        paths.sort();
+        self.by_id.clear();
+        /* The first path in order wins for copies of the same ELF */
+        for path in paths.into_iter().rev() {
+            if let Some(id) = &self.files[path].build_id {
+                self.by_id.insert(id.clone(), path.clone());
+            }
+        }
+    }
+
+    /* Symlinks are followed, a directory reached twice (a link loop or two
+     * links to one directory) is walked once: "visited" has its (dev, ino) */
+    fn walk(
+        dir: &Path,
+        visited: &mut HashSet<(u64, u64)>,
+        found: &mut Vec<(PathBuf, fs::Metadata)>,
+    ) {
+        let entries = match fs::metadata(dir) {
+            Ok(m) if visited.insert((m.dev(), m.ino())) => fs::read_dir(dir),
+            _ => return,
+        };
+        let entries = match entries {
+            Ok(entries) => entries,
+            Err(_) => return,
+        };
+        for entry in entries.filter_map(|e| e.ok()) {
+            if entry.file_name().to_string_lossy().starts_with('.') {
+                continue;
+            }
+            let path = entry.path();
+            match fs::metadata(&path) {
+                Ok(m) if m.is_dir() => Index::walk(&path, visited, found),
+                Ok(m) if m.is_file() => found.push((path, m)),
+                _ => (),
+            }
+        }
+    }
+
+    /* Stat every file, read build-ids of new and changed ones. "known" are
+     * the files of the last scan, returns the files found and whether they
+     * differ from the known ones. */
+    fn scan(
+        dirs: &[PathBuf],
+        mut known: HashMap<PathBuf, Stamp>,
+    ) -> (HashMap<PathBuf, Stamp>, bool) {
+        let mut found = vec![];
+        let mut visited = HashSet::new();
+        for dir in dirs {
+            Index::walk(dir, &mut visited, &mut found);
+        }
+        let mut changed = found.len() != known.len();
+        let mut files = HashMap::with_capacity(found.len());
+        for (path, m) in found {
+            let stamp = match known.remove(&path) {
+                Some(stamp) if stamp.matches(&m) => stamp,
+                _ => {
+                    changed = true;
+                    Stamp {
+                        size: m.len(),
+                        mtime: m.mtime(),
+                        mtime_nsec: m.mtime_nsec(),
+                        build_id: Elf::open(&path).ok().and_then(|elf| elf.build_id()),
+                    }
+                }
+            };
+            files.insert(path, stamp);
+        }
+        (files, changed)
+    }
+
+    fn save(&self) {
+        let mut content = String::new();
+        for (path, stamp) in &self.files {
+            let path = path.display().to_string();
+            if path.contains('\n') {
+                continue;
+            }
+            content += &format!(
+                "{}\t{}\t{}\t{}\t{}\n",
+                stamp.build_id.as_deref().unwrap_or_default(),
+                stamp.size,
+                stamp.mtime,
+                stamp.mtime_nsec,
+                path
+            );
+        }
+        cache::write(&self.cache_name, &self.cache_key, &content);
+    }
+
+    /* A hit costs a stat() to check the file was not rebuilt in place */
+    fn current(&self, build_id: &str) -> Option<PathBuf> {
+        let path = self.by_id.get(build_id)?;
+        let current = path.metadata().is_ok_and(|m| self.files[path].matches(&m));
+        current.then(|| path.clone())
+    }
+}
+
+/* Index shared by the connection threads. A miss rescans, so a build copied
+ * into a directory is found right away, but not more often than
+ * RESCAN_INTERVAL. Hits are served while a rescan runs, misses wait for it. */
+struct SharedIndex {
+    index: Mutex<Index>,
+    rescanned: Condvar,
+}
+
+impl SharedIndex {
+    fn lookup(&self, build_id: &str) -> Option<PathBuf> {
+        let mut index = self.index.lock().unwrap();
+        if let Some(path) = index.current(build_id) {
+            return Some(path);
+        }
+        if index.rescanning {
+            while index.rescanning {
+                index = self.rescanned.wait(index).unwrap();
+            }
+            return index.current(build_id);
+        }
+        if index.scanned.is_some_and(|t| t.elapsed() < RESCAN_INTERVAL) {
+            return None;
+        }
+        let index = self.rescan(index);
+        index.current(build_id)
+    }
+
+    fn rescan<'a>(&'a self, mut index: MutexGuard<'a, Index>) -> MutexGuard<'a, Index> {
+        let start = Instant::now();
+        index.rescanning = true;
+        let dirs = index.dirs.clone();
+        let known = index.files.clone();
+        drop(index);
+        let (files, changed) = Index::scan(&dirs, known);
+        let mut index = self.index.lock().unwrap();
+        index.files = files;
+        index.scanned = Some(Instant::now());
+        index.rescanning = false;
+        if changed {
+            index.update_ids();
+            index.save();
+        }
+        self.rescanned.notify_all();
+        esp_debug_trace!(
+            "Symbol index: {} files, {} build-ids, scanned in {:?}",
+            index.files.len(),
+            index.by_id.len(),
+            start.elapsed()
+        );
+        index
+    }
+}
+
+fn http_response(stream: &mut TcpStream, status: &str, body: &str) -> io::Result<()> {
+    write!(
+        stream,
+        "HTTP/1.1 {}\r\nContent-Type: text/plain\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}",
+        status,
+        body.len(),
+        body
+    )
+}
+
+/* debuginfod API subset under the token of the server:
+ * GET /<token>/buildid/<id>/debuginfo and .../executable, both are the same
+ * firmware ELF. Sources are not served. */
+fn respond(index: &SharedIndex, token: &str, mut stream: TcpStream) -> io::Result<()> {
+    stream.set_read_timeout(Some(HTTP_REQUEST_TIMEOUT))?;
+    let mut reader = BufReader::new((&stream).take(HTTP_REQUEST_MAX));
+    let mut request = String::new();
+    reader.read_line(&mut request)?;
+    loop {
+        let mut header = String::new();
+        if reader.read_line(&mut header)? == 0 || header.trim_end().is_empty() {
+            break;
+        }
+    }
+    let fields: Vec<&str> = request.split_whitespace().collect();
+    let (method, target) = match fields[..] {
+        [method @ ("GET" | "HEAD"), target, _] if request.ends_with('\n') => (method, target),
+        _ => return http_response(&mut stream, "400 Bad Request", "Bad Request\n"),
+    };
+    let parts: Vec<&str> = target.trim_start_matches('/').split('/').collect();
+    if !parts.first().is_some_and(|t| token_matches(t, token)) {
+        return http_response(&mut stream, "403 Forbidden", "Forbidden\n");
+    }
+    let path = match parts[1..] {
+        ["buildid", id, "debuginfo" | "executable"]
+            if !id.is_empty() && id.bytes().all(|c| c.is_ascii_hexdigit()) =>
+        {
+            index.lookup(&id.to_ascii_lowercase())
+        }
+        _ => None,
+    };
+    esp_debug_trace!("{} {} -> {:?}", method, parts[1..].join("/"), path);
+    let mut file = match path.and_then(|p| File::open(p).ok()) {
+        Some(file) => file,
+        None => return http_response(&mut stream, "404 Not Found", "Not Found\n"),
+    };
+    write!(
+        stream,
+        "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: {}\r\nConnection: close\r\n\r\n",
+        file.metadata()?.len()
+    )?;
+    if method == "GET" {
+        io::copy(&mut file, &mut stream)?;
+    }
+    Ok(())
+}
+
+/* Every byte is compared, the time taken does not tell how much matched */
+fn token_matches(given: &str, token: &str) -> bool {
+    given.len() == token.len()
+        && given
+            .bytes()
+            .zip(token.bytes())
+            .fold(0, |diff, (a, b)| diff | (a ^ b))
+            == 0
+}
+
+fn new_token() -> io::Result<String> {
+    let mut bytes = [0; TOKEN_SIZE];
+    File::open("/dev/urandom")?.read_exact(&mut bytes)?;
+    Ok(bytes.iter().map(|b| format!("{:02x}", b)).collect())
+}
+
+/* Serve ELFs of the directories by build-id on the loopback interface until
+ * killed. The port is ESP_GDB_WRAPPER_SYMBOL_SERVER_PORT or any free one.
+ * Other users can connect to the port too, so requests have to carry a
+ * random token. The port and the token are published in the per-user cache
+ * for wrappers to connect to. */
+pub fn serve(dirs: &[PathBuf]) -> io::Result<()> {
+    let dirs = if dirs.is_empty() {
+        canonical_dirs(&dirs_from_env())
+    } else {
+        canonical_dirs(dirs)
+    };
+    if dirs.is_empty() {
+        return Err(io::Error::new(
+            io::ErrorKind::NotFound,
+            "Pass ELF directories or set ESP_GDB_WRAPPER_SYMBOL_DIRS",
+        ));
+    }
+    let (_, server_cache, cache_key) = cache_names(&dirs);
+    if let Some((port, _)) = running_server(&server_cache, &cache_key) {
+        return Err(io::Error::new(
+            io::ErrorKind::AddrInUse,
+            format!("Symbol server is already running on port {}", port),
+        ));
+    }
+    let token = new_token()?;
+    let port = env::var("ESP_GDB_WRAPPER_SYMBOL_SERVER_PORT")
+        .ok()
+        .and_then(|p| p.parse().ok())
+        .unwrap_or(0);
+    let listener = TcpListener::bind((Ipv4Addr::LOCALHOST, port))?;
+    let port = listener.local_addr()?.port();
+    /* Clients connecting during the first scan wait for it in the backlog */
+    cache::write(&server_cache, &cache_key, &format!("{}\t{}", port, token));
+    esp_debug_trace!("Symbol server for {:?} is listening on port {}", dirs, port);
+
+    let index = Arc::new(SharedIndex {
+        index: Mutex::new(Index::load(dirs)),
+        rescanned: Condvar::new(),
+    });
+    drop(index.rescan(index.index.lock().unwrap()));
+    let token = Arc::new(token);
+    for stream in listener.incoming() {
+        let stream = match stream {
+            Ok(s) => s,
+            Err(_) => continue,
+        };
+        let index = index.clone();
+        let token = token.clone();
+        thread::spawn(move || {
+            if let Err(e) = respond(&index, &token, stream) {
+                esp_debug_trace!("Symbol server request failed: {}", e);
+            }
+        });
+    }
+    Ok(())
+}
+
+/* Port and token of the running server */
+fn running_server(server_cache: &str, cache_key: &str) -> Option<(u16, String)> {
+    let entry = cache::read(server_cache, cache_key)?;
+    let (port, token) = entry.trim().split_once('\t')?;
+    let port = port.parse().ok()?;
+    let address = SocketAddr::from((Ipv4Addr::LOCALHOST, port));
+    TcpStream::connect_timeout(&address, SYMBOL_SERVER_CONNECT_TIMEOUT).ok()?;
+    Some((port, token.to_string()))
+}
+
+/* Port and token of the server for ESP_GDB_WRAPPER_SYMBOL_DIRS, started in
+ * background if it is not running. The lock makes concurrent wrappers start
+ * one server. */
+fn server(dirs: &[PathBuf]) -> Option<(u16, String)> {
+    let (_, server_cache, cache_key) = cache_names(dirs);
+    if let Some(server) = running_server(&server_cache, &cache_key) {
+        return Some(server);
+    }
+    let _lock = cache::Lock::acquire(&server_cache)?;
+    if let Some(server) = running_server(&server_cache, &cache_key) {
+        return Some(server);
+    }
+    let child = Command::new(exe::wrapper_path().ok()?)
+        .arg("--esp-wrapper-symbol-server")
+        .args(dirs)
+        .stdin(Stdio::null())
+        .stdout(Stdio::null())
+        .stderr(Stdio::null())
+        .process_group(0)
+        .spawn();
+    esp_debug_trace!(
+        "Starting symbol server: {:?}",
+        child.as_ref().map(|c| c.id())
+    );
+    child.ok()?;
+    let deadline = Instant::now() + SYMBOL_SERVER_START_TIMEOUT;
+    while Instant::now() < deadline {
+        if let Some(server) = running_server(&server_cache, &cache_key) {
+            return Some(server);
+        }
+        thread::sleep(SYMBOL_SERVER_POLL_INTERVAL);
+    }
+    None
+}
+
+/* With ESP_GDB_WRAPPER_SYMBOL_DIRS set, GDB looks up the ELF of a core dump
+ * (and of a remote target) by build-id at the local symbol server first.
+ * Returns GDB options and the environment GDB needs for them. */
+pub fn gdb_args() -> (Vec<String>, Vec<(&'static str, String)>) {
+    let dirs = canonical_dirs(&dirs_from_env());
+    if dirs.is_empty() {
+        return (vec![], vec![]);
+    }
+    let (port, token) = match server(&dirs) {
+        Some(server) => server,
+        None => {
+            esp_debug_trace!("Symbol server is not available");
+            return (vec![], vec![]);
+        }
+    };
+    let url = format!("http://127.0.0.1:{}/{}", port, token);
+    let urls = match env::var("DEBUGINFOD_URLS") {
+        Ok(urls) if !urls.split_whitespace().any(|u| u == url) => {
+            format!("{} {}", url, urls).trim_end().to_string()
+        }
+        Ok(urls) => urls,
+        Err(_) => url,
+    };
+    (
+        vec!["-iex".to_string(), "set debuginfod enabled on".to_string()],
+        vec![("DEBUGINFOD_URLS", urls)],
+    )
+}
@@ -0,0 +1,121 @@
+#!/bin/sh
+# Resolver daemon check with a stub python3 and a fake toolchain tree, no
+# real toolchain or Python needed:
+#   - the socket is private to the user
+#   - toolchain and GDB wrappers get their launch from the daemon
+#   - the Python probe runs once for any number of GDB launches
+#   - a toolchain request is answered while a cold GDB resolution is running
+#
+#   tests/resolver-daemon.sh [esp-elf-gdb-wrapper] [xtensa-toolchian-wrapper]
+#
+# Without arguments both wrappers are built with cargo.
+
+set -e
+cd "$(dirname "$0")/.."
+
+if [ $# -ge 2 ]; then
+    GDB_WRAPPER=$(realpath "$1")
+    TOOLCHAIN_WRAPPER=$(realpath "$2")
+else
+    TARGET_DIR=${CARGO_TARGET_DIR:-$PWD/target}
+    cargo build --release -q
+    (cd ../../gnu-xtensa-toolchian && CARGO_TARGET_DIR=$TARGET_DIR cargo build --release -q)
+    GDB_WRAPPER=$TARGET_DIR/release/esp-elf-gdb-wrapper
+    TOOLCHAIN_WRAPPER=$TARGET_DIR/release/xtensa-toolchian-wrapper
+fi
+
+TMP=$(mktemp -d)
+DAEMON=
+cleanup() {
+    [ -n "$DAEMON" ] && kill "$DAEMON" 2>/dev/null
+    rm -rf "$TMP"
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $*"
+    echo "--- daemon log"
+    cat "$TMP/daemon.log"
+    exit 1
+}
+
+# Toolchain tree: the wrappers, the real tools they start and the dynconfig
+mkdir -p "$TMP/toolchain/bin" "$TMP/toolchain/lib" "$TMP/python/bin" "$TMP/cache"
+BIN=$TMP/toolchain/bin
+cp "$GDB_WRAPPER" "$BIN/xtensa-esp32-elf-gdb"
+cp "$TOOLCHAIN_WRAPPER" "$BIN/xtensa-esp32-elf-gcc"
+: >"$TMP/toolchain/lib/xtensa_esp32.so"
+cat >"$BIN/xtensa-esp-elf-gcc" <<'EOF'
+#!/bin/sh
+echo "gcc $* config=$XTENSA_GNU_CONFIG"
+EOF
+cat >"$BIN/xtensa-esp-elf-gdb-no-python" <<'EOF'
+#!/bin/sh
+echo "gdb-no-python $*"
+EOF
+# GDB-with-Python: the self-test run takes STUB_GDB_TEST_DELAY seconds
+cat >"$BIN/xtensa-esp-elf-gdb-3.11" <<'EOF'
+#!/bin/sh
+for arg; do
+    if [ "$arg" = --batch-silent ]; then
+        sleep "${STUB_GDB_TEST_DELAY:-0}"
+        exit 0
+    fi
+done
+echo "gdb-3.11 $*"
+EOF
+# python3 counts its runs
+cat >"$TMP/python/bin/python3" <<EOF
+#!/bin/sh
+echo run >>"$TMP/python-runs"
+printf '3.11\n$TMP/python/lib\n$TMP/python\n$TMP/python/lib/python3.11'
+EOF
+chmod +x "$BIN"/* "$TMP/python/bin/python3"
+
+export PATH="$TMP/python/bin:$PATH"
+export ESP_WRAPPER_RESOLVER_SOCKET="$TMP/resolver.sock"
+export ESP_GDB_WRAPPER_CACHE_DIR="$TMP/cache"
+export ESP_GDB_WRAPPER_NO_MANIFEST=1
+export ESP_GDB_WRAPPER_NO_DISCOVERY=1
+export STUB_GDB_TEST_DELAY=2
+unset IDF_PYTHON_ENV_PATH VIRTUAL_ENV PYTHONHOME PYTHONPATH
+
+ESP_DEBUG_TRACE=1 "$BIN/xtensa-esp32-elf-gdb" --esp-wrapper-daemon >"$TMP/daemon.log" 2>&1 &
+DAEMON=$!
+i=0
+while [ ! -S "$ESP_WRAPPER_RESOLVER_SOCKET" ]; do
+    i=$((i + 1))
+    [ $i -lt 100 ] || fail "daemon did not start"
+    sleep 0.05
+done
+
+mode=$(stat -c %a "$ESP_WRAPPER_RESOLVER_SOCKET" 2>/dev/null || stat -f %Lp "$ESP_WRAPPER_RESOLVER_SOCKET")
+case "$mode" in *00) ;; *) fail "socket is not private: $mode" ;; esac
+
+# Cold GDB resolution in the background, the self-test keeps it busy
+"$BIN/xtensa-esp32-elf-gdb" -ex "python print(1)" >"$TMP/gdb-1.out" &
+GDB_CLIENT=$!
+sleep 0.5
+
+# ESP_DEBUG_TRACE keeps the toolchain wrapper off its fast path, which does
+# not ask the daemon
+out=$(ESP_DEBUG_TRACE=1 "$BIN/xtensa-esp32-elf-gcc" -c x.c | tail -n 1)
+[ "$out" = "gcc -mdynconfig=xtensa_esp32.so -c x.c config=$TMP/toolchain/lib/xtensa_esp32.so" ] ||
+    fail "toolchain launch: $out"
+grep -q "toolchain request answered" "$TMP/daemon.log" ||
+    fail "toolchain request was not answered by the daemon"
+grep -q "gdb request answered" "$TMP/daemon.log" &&
+    fail "toolchain request waited for the GDB resolution"
+
+wait $GDB_CLIENT
+# The wrapper adds its own -iex options in front of the user ones
+out=$(cat "$TMP/gdb-1.out")
+case "$out" in "gdb-3.11 "*" -ex python print(1)") ;; *) fail "first GDB launch: $out" ;; esac
+
+out=$("$BIN/xtensa-esp32-elf-gdb" -ex "python print(2)")
+case "$out" in "gdb-3.11 "*" -ex python print(2)") ;; *) fail "second GDB launch: $out" ;; esac
+[ "$(grep -c "gdb request answered" "$TMP/daemon.log")" = 2 ] ||
+    fail "GDB launches were not answered by the daemon"
+[ "$(wc -l <"$TMP/python-runs")" -eq 1 ] || fail "python3 ran $(wc -l <"$TMP/python-runs") times"
+
+echo "resolver daemon: OK"
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <windows.h>
 #include <stdbool.h>
+#include <ctype.h>
 
 #define MCPU_MAX_LEN 16
 #define MCPU_PREFIX "--mcpu="
@@ -21,6 +22,8 @@
 #define GDB_EXTENSION ".exe"
 
 #define GDB_ARG_BATCH_SILENT "--batch-silent"
+#define ESP_WRAPPER_RESOLVE_OPTION "--esp-wrapper-resolve"
+#define ESP_WRAPPER_PREWARM_OPTION "--esp-wrapper-prewarm"
 
 #define PYTHON_SCRIPT_CMD_OPTION " -c "
 #define PYTHON_SCRIPT_BODY "\"import os, sys;"\
@@ -28,8 +31,37 @@
 "print(sys.base_prefix);"\
 "print(os.pathsep.join(sys.path[1:]));\""
 
-#define REDIRECT_STDERR_TO_NULL " 2>nul"
 #define PYTHON_MAJOR_WITH_DOT "3."
+#define PYTHON_LAUNCHER "py -"
+#define IDF_PYTHON_ENV_EXE "\\Scripts\\python.exe"
+
+#define PYTHON_PROBE_TIMEOUT_MS 5000
+#define PYTHON_PROBE_MAX_CANDIDATES 16
+#define PYTHON_PROBE_PIPE_SIZE (1024 * 1024)
+#define GDB_PYTHON_VERSION_MAX_LEN 8
+#define GDB_CATALOG_MAX_VERSIONS 12
+
+#define CACHE_DIR_NAME "esp-gdb-wrapper"
+#define PYCACHE_DIR_NAME "pycache"
+#define INDEX_CACHE_DIR_NAME "index-cache"
+#define INDEX_CACHE_MAX_MB 1024
+#define INDEX_CACHE_EVICTION_STAMP ".last-eviction"
+#define INDEX_CACHE_EVICTION_INTERVAL_S 3600
+#define FILETIME_TICKS_PER_SECOND 10000000ULL
+#define FILETIME_UNIX_EPOCH 116444736000000000ULL // 1970-01-01 in FILETIME ticks
+#define GDB_TEST_CACHE_PREFIX "gdb-test-"
+#define GDB_TEST_PASSED "passed"
+#define GDB_TEST_FAILED "failed"
+#define GDB_TEST_TIMED_OUT "timed-out"
+#define GDB_TEST_TIMEOUT_MS 5000
+#define GDB_TEST_TIMED_OUT_TTL_S 3600 // timed out test may be caused by a temporary condition
+#define GDB_TEST_TIMEOUT_EXIT_CODE 258 // WAIT_TIMEOUT
+
+#define PYTHON_COMMAND_PREFIX "py"
+#define PYTHON_COMMAND_ALIAS "pi"
+#define MAX_SOURCE_DEPTH 8
+
+#define TRACE_FILE_ENV "ESP_WRAPPER_TRACE_FILE"
 
 #define PRINT_MESSAGE(...) \
 do                         \
@@ -41,66 +73,158 @@ do                         \
 } while(0);
 
 
+// GDB binaries next to the wrapper, the directory is listed only once
+typedef struct {
+  char *base_path; // without python suffix and extension
+  BOOL has_no_python;
+  size_t versions_count;
+  char versions[GDB_CATALOG_MAX_VERSIONS][GDB_PYTHON_VERSION_MAX_LEN]; // newest first
+} gdb_catalog_t;
+
 #if TARGET_ESP_ARCH_XTENSA
 static void set_mcpu_option_and_fixup_filename(const char *exe_path);
 static char *get_filename_ptr(const char *exe_path);
 #endif
 static char *get_module_filename(size_t append_memory_size);
+static const gdb_catalog_t *get_gdb_catalog(void);
 static char *get_exe_path(const char *python_version);
-static char *get_cmdline(const int argc, const char **argv, const char *exe_path);
+static BOOL gdb_python_supported(const char *python_version);
+static char *get_cmdline(const int argc, const char **argv, const char *exe_path, const char *gdb_options);
+static char **get_gdb_init_commands(void);
+static void free_gdb_init_commands(char **commands);
+static char *get_gdb_options(void);
+static void evict_index_cache(const char *dir);
+static int prewarm_index_cache(const char *elf);
 static void get_python_info(char **version, char **base_prefix, char **python_path);
 static int execute_cmdline(const char *cmdline, BOOL test_run);
 static int update_environment_variables(const char *python_base_prefix, const char *python_path);
+static char *prune_python_path(const char *python_path);
 static int run_gdb(const char *python_version, const int argc, const char ** argv, BOOL test_run);
+static int run_gdb_test(const char *python_version, const char *python_base_prefix);
+static char *get_gdb_fingerprint(const char *exe_path, const char *python_version, const char *python_base_prefix);
+static void print_resolution(const char *python_version, const char *python_base_prefix);
+static char *get_cache_path(const char *name);
+static char *cache_read(const char *name, const char *key);
+static void cache_write(const char *name, const char *key, const char *value);
+static BOOL python_required(const int argc, const char **argv);
+static BOOL script_uses_python(const char *script, int depth);
+static BOOL command_uses_python(const char *command, const char *dir, int depth);
+static ULONGLONG unix_time_s(void);
+static DWORD env_timeout_ms(const char *name, DWORD default_ms);
+static ULONGLONG trace_now(void);
+static char *trace_escape(char *p, const char *s);
+static void trace_span(const char *name, ULONGLONG start, const char *detail);
 
 const char *python_exe_arr[] = {"python", "python3"};
 
+// Commands and convenience functions implemented in Python or running Python code
+const char *python_implemented_names[] = {
+  "explore", "pretty-printer", "frame-filter", "unwinder", "xmethod", "type-printer",
+  "missing-debug-handler", "$_memeq", "$_streq", "$_strlen", "$_regex", "$_as_string",
+  "$_caller_is", "$_caller_matches", "$_any_caller_is", "$_any_caller_matches"
+};
+
+// GDB options taking a value in the next argument (unless given as --opt=value)
+const char *gdb_options_with_value[] = {
+  "x", "command", "ix", "init-command", "ex", "eval-command", "iex", "init-eval-command",
+  "e", "exec", "s", "symbols", "se", "c", "core", "p", "pid", "cd", "d", "directory",
+  "b", "l", "i", "interpreter", "tty", "data-directory"
+};
+
+// Options without a value, anything else makes the detection give up
+const char *gdb_known_flags[] = {
+  "q", "quiet", "silent", "readnow", "readnever", "write", "return-child-result",
+  "w", "nw", "nowindows", "tui", "fullname", "f", "dbx", "statistics", "configuration"
+};
+
 int print_messages = 0;
+const char *trace_category = "";
+ULONGLONG trace_process_start = 0;
 
 // Workflow:
-// 1. Get python version and python base_prefix. (python executables to check are in python_exe_arr)
-// 2. Set PYTHONHOME and PYTHONPATH + append PATH environment variables with base_prefix from step 1
-// 3. Find GDB binary with python version from step 1. (GDB without python used if errors on steps 1,2)
-// 4. Execute GDB binary as a child process
-// 5. Disable ctrl+c and ctrl+break for this wrapper process
-// 6. Wait until GDB exit
+// 1. Check if GDB session may use python. (batch sessions without python scripts and commands don't)
+// 2. Get python version and python base_prefix. (candidate python executables are probed in parallel)
+// 3. Set PYTHONHOME and PYTHONPATH + append PATH environment variables with base_prefix from step 2
+// 4. Find GDB binary with python version from step 2. (GDB without python used if skipped or errors on steps 1-3)
+// 5. Test GDB with-python unless the test result for this GDB binary and python is cached
+// 6. Execute GDB binary as a child process
+// 7. Disable ctrl+c and ctrl+break for this wrapper process
+// 8. Wait until GDB exit
 int main (int argc, char **argv) {
-  char *python_version;
-  char *python_base_prefix;
-  char *python_path;
+  char *python_version = NULL;
+  char *python_base_prefix = NULL;
+  char *python_path = NULL;
   const char *trace_str = getenv ("ESP_DEBUG_TRACE");
+  BOOL resolve_only = FALSE;
+  BOOL need_python = FALSE;
   int exit_code = 0;
+  ULONGLONG phase_start = 0;
   if(trace_str) {
     print_messages = atoi(trace_str) > 0;
   }
+  trace_process_start = trace_now();
+  trace_category = strrchr(argv[0], '\\') ? strrchr(argv[0], '\\') + 1 : argv[0];
 
-  get_python_info(&python_version, &python_base_prefix, &python_path);
-  if (python_version && update_environment_variables(python_base_prefix, python_path)) {
-    // start gdb without python if setting environment was failed
-    PRINT_MESSAGE("update_environment_variables() failed, gdb without-python will be used\r\n");
-    free(python_version);
-    python_version = NULL;
+  if (argc > 1 && strcmp(argv[1], ESP_WRAPPER_PREWARM_OPTION) == 0) {
+    if (argc < 3) {
+      fprintf(stderr, "Usage: %s %s <elf>\n", argv[0], ESP_WRAPPER_PREWARM_OPTION);
+      return 1;
+    }
+    return prewarm_index_cache(argv[2]);
   }
 
-  if (python_base_prefix) {
-    free(python_base_prefix);
-  }
+  // IDE launchers may start GDB directly with the printed resolution
+  resolve_only = argc > 1 && strcmp(argv[1], ESP_WRAPPER_RESOLVE_OPTION) == 0;
 
-  if (python_path) {
-    free(python_path);
+  if (!resolve_only) {
+    phase_start = trace_now();
+    need_python = python_required((const int) argc, (const char **) argv);
+    trace_span("argscan", phase_start, NULL);
+  }
+  if (resolve_only || need_python) {
+    phase_start = trace_now();
+    get_python_info(&python_version, &python_base_prefix, &python_path);
+    trace_span("python-probe", phase_start, python_version);
+  }
+  if (python_version) {
+    int failed = 0;
+    phase_start = trace_now();
+    failed = update_environment_variables(python_base_prefix, python_path);
+    trace_span("env-update", phase_start, NULL);
+    if (failed) {
+      // start gdb without python if setting environment was failed
+      PRINT_MESSAGE("update_environment_variables() failed, gdb without-python will be used\r\n");
+      free(python_version);
+      python_version = NULL;
+    }
   }
 
   if (python_version) {
+    int failed = 0;
     // run GDB with-python to check if it executes well
-    char *test_argv[2] = { NULL, GDB_ARG_BATCH_SILENT };
-    if (run_gdb(python_version, 2, (const char **) test_argv, TRUE)) {
+    phase_start = trace_now();
+    failed = run_gdb_test(python_version, python_base_prefix);
+    trace_span("gdb-test", phase_start, failed ? GDB_TEST_FAILED : GDB_TEST_PASSED);
+    if (failed) {
       PRINT_MESSAGE("GDB with-python test execution failed, use no-python GDB\r\n");
       free(python_version);
       python_version = NULL;
     }
   }
 
-  exit_code = run_gdb(python_version, (const int) argc, (const char **) argv, FALSE);
+  if (resolve_only) {
+    print_resolution(python_version, python_base_prefix);
+  } else {
+    exit_code = run_gdb(python_version, (const int) argc, (const char **) argv, FALSE);
+  }
+
+  if (python_base_prefix) {
+    free(python_base_prefix);
+  }
+
+  if (python_path) {
+    free(python_path);
+  }
 
   if (python_version) {
     free(python_version);
@@ -111,13 +235,24 @@ int main (int argc, char **argv) {
 static int run_gdb(const char *python_version, const int argc, const char ** argv, BOOL test_run) {
   char *cmdline = NULL;
   char *exe_path = NULL;
+  char *gdb_options = NULL;
   int exit_code = 0;
+  ULONGLONG phase_start = trace_now();
 
   exe_path = get_exe_path(python_version);
-  cmdline = get_cmdline(argc, argv, exe_path);
+  if (!test_run) {
+    trace_span("gdb-select", phase_start, exe_path);
+    phase_start = trace_now();
+    gdb_options = get_gdb_options();
+    trace_span("gdb-options", phase_start, NULL);
+    // the whole wrapper start-up, phases nest in it
+    trace_span("start", trace_process_start, exe_path);
+  }
+  cmdline = get_cmdline(argc, argv, exe_path, gdb_options);
   exit_code = execute_cmdline(cmdline, test_run);
 
   free(exe_path);
+  free(gdb_options);
   free(cmdline);
   return exit_code;
 }
@@ -162,6 +297,564 @@ char *readline(FILE *f)
   }
   return buf;
 }
+
+static unsigned long fnv1a_hash(const char *s) {
+  unsigned long hash = 2166136261UL;
+  while (*s) {
+    hash ^= (unsigned char) *s++;
+    hash = (hash * 16777619UL) & 0xffffffffUL;
+  }
+  return hash;
+}
+
+// Timed out test is recorded with its time: "timed-out <seconds since the Unix epoch>".
+// FALSE if it is older than GDB_TEST_TIMED_OUT_TTL_S.
+static BOOL gdb_test_record_current(const char *record) {
+  const size_t prefix_len = strlen(GDB_TEST_TIMED_OUT);
+  if (strncmp(record, GDB_TEST_TIMED_OUT, prefix_len)) {
+    return TRUE;
+  }
+  return unix_time_s() - strtoull(record + prefix_len, NULL, 10) < GDB_TEST_TIMED_OUT_TTL_S;
+}
+
+// Test result depends only on GDB binary and python installation it loads,
+// so it is cached until one of them is changed
+static int run_gdb_test(const char *python_version, const char *python_base_prefix) {
+  char *test_argv[2] = { NULL, GDB_ARG_BATCH_SILENT };
+  char cache_name[sizeof(GDB_TEST_CACHE_PREFIX) + 8];
+  char *exe_path = get_exe_path(python_version);
+  char *key = get_gdb_fingerprint(exe_path, python_version, python_base_prefix);
+  char *cached = NULL;
+  char record[sizeof(GDB_TEST_TIMED_OUT) + 24];
+  int exit_code = 0;
+
+  if (!key) {
+    free(exe_path);
+    return run_gdb(python_version, 2, (const char **) test_argv, TRUE);
+  }
+
+  sprintf(cache_name, "%s%08lx", GDB_TEST_CACHE_PREFIX, fnv1a_hash(exe_path));
+  free(exe_path);
+
+  cached = cache_read(cache_name, key);
+  if (cached && !gdb_test_record_current(cached)) {
+    PRINT_MESSAGE("Cached GDB test result is expired: %s\r\n", cached);
+    free(cached);
+    cached = NULL;
+  }
+  if (cached) {
+    PRINT_MESSAGE("Cached GDB test result: %s\r\n", cached);
+    exit_code = strcmp(cached, GDB_TEST_PASSED) ? 1 : 0;
+    free(cached);
+  } else {
+    exit_code = run_gdb(python_version, 2, (const char **) test_argv, TRUE);
+    // timed out test is recorded too, next launches go straight to no-python GDB
+    // until GDB_TEST_TIMED_OUT_TTL_S has passed. Not when ESP_GDB_WRAPPER_TEST_TIMEOUT_MS
+    // cut the test shorter than the default: the setting, not GDB, may be the cause.
+    if (exit_code == GDB_TEST_TIMEOUT_EXIT_CODE) {
+      sprintf(record, "%s %llu", GDB_TEST_TIMED_OUT, unix_time_s());
+    } else {
+      strcpy(record, exit_code ? GDB_TEST_FAILED : GDB_TEST_PASSED);
+    }
+    if (exit_code != GDB_TEST_TIMEOUT_EXIT_CODE ||
+        env_timeout_ms("ESP_GDB_WRAPPER_TEST_TIMEOUT_MS", GDB_TEST_TIMEOUT_MS) >= GDB_TEST_TIMEOUT_MS) {
+      cache_write(cache_name, key, record);
+    }
+  }
+
+  free(key);
+  return exit_code;
+}
+
+// exe path, size, modification time, python base_prefix and version.
+// NULL if GDB binary is not accessible.
+static char *get_gdb_fingerprint(const char *exe_path, const char *python_version, const char *python_base_prefix) {
+  WIN32_FILE_ATTRIBUTE_DATA attrs;
+  char *fingerprint = NULL;
+
+  if (!GetFileAttributesExA(exe_path, GetFileExInfoStandard, &attrs)) {
+    return NULL;
+  }
+  python_version = python_version ? python_version : GDB_NO_PYTHON_SUFFIX;
+  python_base_prefix = python_base_prefix ? python_base_prefix : "";
+
+  // 4 numbers fit in 64 chars
+  fingerprint = malloc(strlen(exe_path) + strlen(python_base_prefix) + strlen(python_version) + 64);
+  if (!fingerprint) {
+    perror("malloc()");
+    abort();
+  }
+  sprintf(fingerprint, "%s|%lu:%lu|%lu:%lu|%s|%s", exe_path,
+          attrs.nFileSizeHigh, attrs.nFileSizeLow,
+          attrs.ftLastWriteTime.dwHighDateTime, attrs.ftLastWriteTime.dwLowDateTime,
+          python_base_prefix, python_version);
+  return fingerprint;
+}
+
+static void print_json_string(const char *s) {
+  putchar('"');
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      printf("\\%c", *s);
+    } else if ((unsigned char) *s < 0x20) {
+      printf("\\u%04x", (unsigned char) *s);
+    } else {
+      putchar(*s);
+    }
+  }
+  putchar('"');
+}
+
+// Print GDB binary and environment prepared for it as JSON instead of running GDB.
+// The result is valid while the fingerprint (GDB binary size and modification time,
+// python base_prefix and version) is the same.
+static void print_resolution(const char *python_version, const char *python_base_prefix) {
+  const char *env_names[] = { "XTENSA_GNU_CONFIG", "PATH", "PYTHONHOME", "PYTHONPATH", "PYTHONPYCACHEPREFIX" };
+  const size_t env_count = python_version ? sizeof(env_names) / sizeof(env_names[0]) : 1;
+  char *exe_path = get_exe_path(python_version);
+  char *no_python_exe_path = get_exe_path(NULL);
+  char *fingerprint = get_gdb_fingerprint(exe_path, python_version, python_base_prefix);
+  char **commands = get_gdb_init_commands();
+  BOOL first = TRUE;
+
+  printf("{\n  \"gdb\": ");
+  print_json_string(exe_path);
+  printf(",\n  \"python\": %s,\n  \"argv\": [", python_version ? "true" : "false");
+  print_json_string(exe_path);
+  // the options run_gdb() puts in front of the user arguments
+  for (size_t i = 0; commands[i]; i++) {
+    printf(", ");
+    print_json_string("-iex");
+    printf(", ");
+    print_json_string(commands[i]);
+  }
+  free_gdb_init_commands(commands);
+  printf("],\n  \"env\": {");
+  for (size_t i = 0; i < env_count; i++) {
+    // values set by the wrapper are not visible through getenv()
+    DWORD size = GetEnvironmentVariable(env_names[i], NULL, 0);
+    char *value = NULL;
+    if (size == 0) {
+      continue;
+    }
+    value = malloc(size);
+    if (!value) {
+      perror("malloc()");
+      abort();
+    }
+    GetEnvironmentVariable(env_names[i], value, size);
+    printf("%s\n    ", first ? "" : ",");
+    print_json_string(env_names[i]);
+    printf(": ");
+    print_json_string(value);
+    first = FALSE;
+    free(value);
+  }
+  printf("\n  },\n  \"gdb_no_python\": ");
+  print_json_string(no_python_exe_path);
+  printf(",\n  \"fingerprint\": ");
+  if (fingerprint) {
+    print_json_string(fingerprint);
+  } else {
+    printf("null");
+  }
+  printf("\n}\n");
+  fflush(stdout);
+
+  free(exe_path);
+  free(no_python_exe_path);
+  free(fingerprint);
+}
+
+// Returns path of the file in per-user cache directory or NULL if caching is disabled.
+// ESP_GDB_WRAPPER_CACHE_DIR overrides the directory, ESP_GDB_WRAPPER_NO_CACHE disables caching.
+static char *get_cache_path(const char *name) {
+  const char *base = getenv("ESP_GDB_WRAPPER_CACHE_DIR");
+  char *path = NULL;
+
+  if (getenv("ESP_GDB_WRAPPER_NO_CACHE")) {
+    return NULL;
+  }
+
+  if (base) {
+    path = malloc(strlen(base) + strlen(name) + 2);
+    if (!path) {
+      perror("malloc()");
+      abort();
+    }
+    strcpy(path, base);
+  } else {
+    base = getenv("LOCALAPPDATA");
+    if (!base) {
+      return NULL;
+    }
+    path = malloc(strlen(base) + strlen(CACHE_DIR_NAME) + strlen(name) + 3);
+    if (!path) {
+      perror("malloc()");
+      abort();
+    }
+    sprintf(path, "%s\\%s", base, CACHE_DIR_NAME);
+  }
+
+  // fails with ERROR_ALREADY_EXISTS for existing directory which is fine
+  CreateDirectoryA(path, NULL);
+  strcat(path, "\\");
+  strcat(path, name);
+  return path;
+}
+
+// Cache file contains the key on the first line and the value on the second.
+// Returns NULL if there is no entry or it was written for another key.
+static char *cache_read(const char *name, const char *key) {
+  char *path = get_cache_path(name);
+  char *entry_key = NULL;
+  char *value = NULL;
+  FILE *f = NULL;
+
+  if (!path) {
+    return NULL;
+  }
+  f = fopen(path, "r");
+  free(path);
+  if (!f) {
+    return NULL;
+  }
+
+  entry_key = readline(f);
+  if (entry_key && strcmp(entry_key, key) == 0) {
+    value = readline(f);
+  } else {
+    PRINT_MESSAGE("Cache %s is outdated\r\n", name);
+  }
+
+  if (entry_key) {
+    free(entry_key);
+  }
+  fclose(f);
+  return value;
+}
+
+// Write to a temporary file and move it over the entry,
+// so concurrent readers never see partially written file
+static void cache_write(const char *name, const char *key, const char *value) {
+  char *path = get_cache_path(name);
+  char *tmp_path = NULL;
+  FILE *f = NULL;
+
+  if (!path) {
+    return;
+  }
+  tmp_path = malloc(strlen(path) + 32);
+  if (!tmp_path) {
+    perror("malloc()");
+    abort();
+  }
+  sprintf(tmp_path, "%s.%lu.tmp", path, GetCurrentProcessId());
+
+  f = fopen(tmp_path, "w");
+  if (f) {
+    fprintf(f, "%s\n%s\n", key, value);
+    fclose(f);
+    if (!MoveFileExA(tmp_path, path, MOVEFILE_REPLACE_EXISTING)) {
+      PRINT_MESSAGE("Failed to write cache %s: %lu\r\n", name, GetLastError());
+      DeleteFileA(tmp_path);
+    }
+  }
+
+  free(tmp_path);
+  free(path);
+}
+
+static BOOL in_list(const char *name, size_t len, const char **list, size_t list_size) {
+  for (size_t i = 0; i < list_size; i++) {
+    if (strlen(list[i]) == len && strncmp(list[i], name, len) == 0) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+#define IN_LIST(name, len, list) in_list(name, len, list, sizeof(list) / sizeof(list[0]))
+#define IS_OPTION(name, len, option) (strlen(option) == len && strncmp(name, option, len) == 0)
+
+static BOOL file_exists(const char *path) {
+  DWORD attrs = GetFileAttributesA(path);
+  return attrs != INVALID_FILE_ATTRIBUTES && !(attrs & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+static char *path_join(const char *dir, const char *name) {
+  char *path = malloc(strlen(dir) + strlen(name) + 2);
+  if (!path) {
+    perror("malloc()");
+    abort();
+  }
+  sprintf(path, "%s\\%s", dir, name);
+  return path;
+}
+
+static BOOL objfile_uses_python(const char *objfile) {
+  char *auto_load = malloc(strlen(objfile) + sizeof("-gdb.gdb"));
+  BOOL res = FALSE;
+  if (!auto_load) {
+    perror("malloc()");
+    abort();
+  }
+  sprintf(auto_load, "%s-gdb.py", objfile);
+  if (file_exists(auto_load)) {
+    PRINT_MESSAGE("GDB session requires python: auto-load script %s\r\n", auto_load);
+    res = TRUE;
+  } else {
+    sprintf(auto_load, "%s-gdb.gdb", objfile);
+    res = file_exists(auto_load) && script_uses_python(auto_load, 0);
+  }
+  free(auto_load);
+  return res;
+}
+
+// Decide whether the GDB session can use python. Only batch sessions are checked:
+// -x/-ix scripts, -ex/-iex commands, init files and auto-load scripts of the loaded
+// objfiles must not contain python. Anything that can't be checked counts as python usage.
+// ESP_GDB_WRAPPER_PYTHON=on|off overrides the detection.
+static BOOL python_required(const int argc, const char **argv) {
+  const char *override = getenv("ESP_GDB_WRAPPER_PYTHON");
+  const char *home = getenv("HOME") ? getenv("HOME") : getenv("USERPROFILE");
+  BOOL batch = FALSE;
+  BOOL read_home_init = TRUE;
+  BOOL read_local_init = TRUE;
+  int positional = 0;
+  int i = 1;
+
+  if (override) {
+    if (strcmp(override, "on") == 0 || strcmp(override, "1") == 0) {
+      return TRUE;
+    }
+    if (strcmp(override, "off") == 0 || strcmp(override, "0") == 0) {
+      return FALSE;
+    }
+  }
+
+  // first pass over options, objfiles are checked after the session is known to be batch
+  while (i < argc) {
+    const char *arg = argv[i++];
+    const char *name = arg;
+    const char *value = NULL;
+    size_t len = 0;
+
+    if (arg[0] != '-' || arg[1] == '\0') {
+      continue;
+    }
+    while (*name == '-') {
+      name++;
+    }
+    value = strchr(name, '=');
+    len = value ? (size_t) (value++ - name) : strlen(name);
+    if (!value && IN_LIST(name, len, gdb_options_with_value)) {
+      if (i >= argc) {
+        PRINT_MESSAGE("GDB session requires python: no value for %s\r\n", arg);
+        return TRUE;
+      }
+      value = argv[i++];
+    }
+
+    if (IS_OPTION(name, len, "batch") || IS_OPTION(name, len, "batch-silent")) {
+      batch = TRUE;
+    } else if (IS_OPTION(name, len, "nx") || IS_OPTION(name, len, "n")) {
+      read_home_init = FALSE;
+      read_local_init = FALSE;
+    } else if (IS_OPTION(name, len, "nh")) {
+      read_home_init = FALSE;
+    } else if (IS_OPTION(name, len, "x") || IS_OPTION(name, len, "command") ||
+               IS_OPTION(name, len, "ix") || IS_OPTION(name, len, "init-command")) {
+      if (script_uses_python(value, 0)) {
+        return TRUE;
+      }
+    } else if (IS_OPTION(name, len, "ex") || IS_OPTION(name, len, "eval-command") ||
+               IS_OPTION(name, len, "iex") || IS_OPTION(name, len, "init-eval-command")) {
+      if (command_uses_python(value, ".", 0)) {
+        return TRUE;
+      }
+    } else if (IS_OPTION(name, len, "args")) {
+      break;
+    } else if (IS_OPTION(name, len, "python") || IS_OPTION(name, len, "P")) {
+      PRINT_MESSAGE("GDB session requires python: option %s\r\n", arg);
+      return TRUE;
+    } else if (!IN_LIST(name, len, gdb_options_with_value) && !IN_LIST(name, len, gdb_known_flags)) {
+      PRINT_MESSAGE("GDB session requires python: unknown option %s\r\n", arg);
+      return TRUE;
+    }
+  }
+
+  if (!batch) {
+    PRINT_MESSAGE("GDB session requires python: interactive session\r\n");
+    return TRUE;
+  }
+
+  if (home) {
+    const char *init_files[] = {".gdbearlyinit", ".gdbinit", ".config\\gdb\\gdbinit"};
+    size_t init_files_num = read_home_init ? sizeof(init_files) / sizeof(init_files[0]) : 1;
+    for (size_t n = 0; n < init_files_num; n++) {
+      char *init_file = path_join(home, init_files[n]);
+      BOOL res = file_exists(init_file) && script_uses_python(init_file, 0);
+      free(init_file);
+      if (res) {
+        return TRUE;
+      }
+    }
+  }
+  if (read_local_init && file_exists(".gdbinit") && script_uses_python(".gdbinit", 0)) {
+    return TRUE;
+  }
+
+  // gdb [options] [executable [core-file|pid]], -e/-s/-se and the program after --args
+  for (i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *name = arg;
+    size_t len = 0;
+
+    if (arg[0] != '-' || arg[1] == '\0') {
+      if (positional++ == 0 && objfile_uses_python(arg)) {
+        return TRUE;
+      }
+      continue;
+    }
+    while (*name == '-') {
+      name++;
+    }
+    if (strchr(name, '=')) {
+      len = strchr(name, '=') - name;
+      if ((IS_OPTION(name, len, "e") || IS_OPTION(name, len, "exec") || IS_OPTION(name, len, "s") ||
+           IS_OPTION(name, len, "symbols") || IS_OPTION(name, len, "se")) &&
+          objfile_uses_python(name + len + 1)) {
+        return TRUE;
+      }
+      continue;
+    }
+    len = strlen(name);
+    if (IS_OPTION(name, len, "args")) {
+      if (i + 1 < argc && objfile_uses_python(argv[i + 1])) {
+        return TRUE;
+      }
+      break;
+    }
+    if (IN_LIST(name, len, gdb_options_with_value) && ++i < argc) {
+      if ((IS_OPTION(name, len, "e") || IS_OPTION(name, len, "exec") || IS_OPTION(name, len, "s") ||
+           IS_OPTION(name, len, "symbols") || IS_OPTION(name, len, "se")) &&
+          objfile_uses_python(argv[i])) {
+        return TRUE;
+      }
+    }
+  }
+
+  PRINT_MESSAGE("GDB session does not use python\r\n");
+  return FALSE;
+}
+
+static BOOL script_uses_python(const char *script, int depth) {
+  const char *ext = strrchr(script, '.');
+  char *dir = NULL;
+  char *sep = NULL;
+  char *line = NULL;
+  BOOL res = FALSE;
+  FILE *f = NULL;
+
+  if (ext && _stricmp(ext, ".py") == 0) {
+    PRINT_MESSAGE("GDB session requires python: python script %s\r\n", script);
+    return TRUE;
+  }
+  if (depth > MAX_SOURCE_DEPTH) {
+    PRINT_MESSAGE("GDB session requires python: too deep source nesting in %s\r\n", script);
+    return TRUE;
+  }
+  f = fopen(script, "r");
+  if (!f) {
+    PRINT_MESSAGE("GDB session requires python: can't read %s\r\n", script);
+    return TRUE;
+  }
+
+  dir = strdup(script);
+  if (!dir) {
+    perror("strdup()");
+    abort();
+  }
+  sep = strrchr(dir, '\\') > strrchr(dir, '/') ? strrchr(dir, '\\') : strrchr(dir, '/');
+  if (sep) {
+    *sep = '\0';
+  } else {
+    strcpy(dir, ".");
+  }
+
+  while (!res && (line = readline(f))) {
+    res = command_uses_python(line, dir, depth);
+    free(line);
+  }
+
+  free(dir);
+  fclose(f);
+  return res;
+}
+
+static BOOL command_uses_python(const char *command, const char *dir, int depth) {
+  const char *file = NULL;
+  const char *end = NULL;
+  char *path = NULL;
+  size_t word_len = 0;
+  BOOL res = FALSE;
+
+  while (isspace((unsigned char) *command)) {
+    command++;
+  }
+  while (command[word_len] && !isspace((unsigned char) command[word_len])) {
+    word_len++;
+  }
+
+  if (strncmp(command, PYTHON_COMMAND_PREFIX, strlen(PYTHON_COMMAND_PREFIX)) == 0 ||
+      IS_OPTION(command, word_len, PYTHON_COMMAND_ALIAS)) {
+    PRINT_MESSAGE("GDB session requires python: command \"%s\"\r\n", command);
+    return TRUE;
+  }
+  for (size_t i = 0; i < sizeof(python_implemented_names) / sizeof(python_implemented_names[0]); i++) {
+    if (strstr(command, python_implemented_names[i])) {
+      PRINT_MESSAGE("GDB session requires python: command \"%s\"\r\n", command);
+      return TRUE;
+    }
+  }
+  if (!IS_OPTION(command, word_len, "source") && !IS_OPTION(command, word_len, "so")) {
+    return FALSE;
+  }
+
+  // the last word is the file name, options of source are not supported
+  end = command + strlen(command);
+  while (end > command + word_len && isspace((unsigned char) end[-1])) {
+    end--;
+  }
+  file = end;
+  while (file > command + word_len && !isspace((unsigned char) file[-1])) {
+    file--;
+  }
+  if (file == end || file[0] == '-') {
+    PRINT_MESSAGE("GDB session requires python: command \"%s\"\r\n", command);
+    return TRUE;
+  }
+  path = malloc(end - file + 1);
+  if (!path) {
+    perror("malloc()");
+    abort();
+  }
+  memcpy(path, file, end - file);
+  path[end - file] = '\0';
+
+  // GDB looks for relative names in the current directory first
+  if (file_exists(path)) {
+    res = script_uses_python(path, depth + 1);
+  } else {
+    char *script = path_join(dir, path);
+    res = script_uses_python(script, depth + 1);
+    free(script);
+  }
+  free(path);
+  return res;
+}
+
 static char *get_module_filename(size_t append_memory_size) {
   LPTSTR exe_path;
   DWORD exe_path_size;
@@ -250,7 +943,7 @@ static void set_mcpu_option_and_fixup_filename(const char *exe_path) {
   strcat(xtensa_dynconfig, ".so");
 
   if (!SetEnvironmentVariable("XTENSA_GNU_CONFIG", xtensa_dynconfig)) {
-    fprintf(stderr, "SetEnvironmentVariable(XTENSA_GNU_CONFIG) failed: %s\r\n", GetLastError());
+    fprintf(stderr, "SetEnvironmentVariable(XTENSA_GNU_CONFIG) failed: %lu\r\n", GetLastError());
     abort();
   }
   free(xtensa_dynconfig);
@@ -262,54 +955,134 @@ static void set_mcpu_option_and_fixup_filename(const char *exe_path) {
 }
 #endif
 
-static char *get_exe_path(const char *python_version) {
-  char *exe_path = NULL;
-  char *base_path = NULL;
-  const char *python_suffix = python_version ? python_version : GDB_NO_PYTHON_SUFFIX;
-  size_t chars_to_remove = 0;
-  char *start = NULL;
-  size_t chars_to_move = 0;
-
-  exe_path = get_module_filename(strlen(python_suffix) + 1);
+// Find all "{arch}-{chip}-elf-gdb-{python}.exe" binaries with one directory listing.
+// Selecting GDB and falling back to no-python GDB don't touch the filesystem again,
+// each file metadata request costs a round trip on network drives.
+static const gdb_catalog_t *get_gdb_catalog(void) {
+  static gdb_catalog_t catalog;
+  static BOOL scanned = FALSE;
+  WIN32_FIND_DATAA find_data;
+  HANDLE find = INVALID_HANDLE_VALUE;
+  char *pattern = NULL;
+  const char *filename = NULL;
+  size_t prefix_len = 0;
+  ULONGLONG scan_start = 0;
+
+  if (scanned) {
+    return &catalog;
+  }
+  scanned = TRUE;
+  scan_start = trace_now();
 
+  catalog.base_path = get_module_filename(0);
 #if TARGET_ESP_ARCH_XTENSA
-  set_mcpu_option_and_fixup_filename(exe_path);
+  set_mcpu_option_and_fixup_filename(catalog.base_path);
 #endif
+  catalog.base_path[strlen(catalog.base_path) - strlen(GDB_EXTENSION)] = '\0';
 
-  // insert python_version to the filename
-  // don't worry about buffer overflow, additionall memory for python version
-  // was allocated in get_module_filename()
-  base_path = strdup(exe_path);
-  if (base_path == NULL) {
-    perror("strdup()");
+  pattern = malloc(strlen(catalog.base_path) + strlen("-*" GDB_EXTENSION) + 1);
+  if (pattern == NULL) {
+    perror("malloc()");
     abort();
   }
-  base_path[strlen(base_path) - strlen(GDB_EXTENSION)] = '\0';
+  sprintf(pattern, "%s-*%s", catalog.base_path, GDB_EXTENSION);
+  // found names are without directory
+  filename = strrchr(catalog.base_path, '\\');
+  prefix_len = strlen(filename ? filename + 1 : catalog.base_path) + 1;
+  find = FindFirstFileA(pattern, &find_data);
+  free(pattern);
+  if (find == INVALID_HANDLE_VALUE) {
+    trace_span("catalog-scan", scan_start, NULL);
+    return &catalog;
+  }
 
-  sprintf(exe_path, "%s-%s%s", base_path, python_suffix, GDB_EXTENSION);
-  if(python_suffix != GDB_NO_PYTHON_SUFFIX) {
-    if (GetFileAttributesA(exe_path) == INVALID_FILE_ATTRIBUTES) { // no exe file for this python version
-      sprintf(exe_path, "%s-%s%s", base_path, GDB_NO_PYTHON_SUFFIX, GDB_EXTENSION);
-      PRINT_MESSAGE("Python-%s is not supported. Run without python\r\n", python_version);
-    } else {
-      PRINT_MESSAGE("Run with python-%s\r\n", python_version);
+  do {
+    const char *suffix = &find_data.cFileName[prefix_len];
+    const char *minor = &suffix[strlen(PYTHON_MAJOR_WITH_DOT)];
+    size_t len = strlen(suffix) - strlen(GDB_EXTENSION);
+    size_t pos = catalog.versions_count;
+
+    if (len == strlen(GDB_NO_PYTHON_SUFFIX) && strncmp(suffix, GDB_NO_PYTHON_SUFFIX, len) == 0) {
+      catalog.has_no_python = TRUE;
+      continue;
+    }
+    if (pos == GDB_CATALOG_MAX_VERSIONS || len >= GDB_PYTHON_VERSION_MAX_LEN ||
+        len <= strlen(PYTHON_MAJOR_WITH_DOT) ||
+        strncmp(suffix, PYTHON_MAJOR_WITH_DOT, strlen(PYTHON_MAJOR_WITH_DOT)) != 0 ||
+        strspn(minor, "0123456789") != len - strlen(PYTHON_MAJOR_WITH_DOT)) {
+      continue;
+    }
+    // keep the list sorted by minor version
+    while (pos > 0 && atoi(&catalog.versions[pos - 1][strlen(PYTHON_MAJOR_WITH_DOT)]) < atoi(minor)) {
+      strcpy(catalog.versions[pos], catalog.versions[pos - 1]);
+      pos--;
+    }
+    memcpy(catalog.versions[pos], suffix, len);
+    catalog.versions[pos][len] = '\0';
+    catalog.versions_count++;
+  } while (FindNextFileA(find, &find_data));
+  FindClose(find);
+
+  PRINT_MESSAGE("GDB no-python found: %d, GDB with python found:", catalog.has_no_python);
+  for (size_t i = 0; i < catalog.versions_count; i++) {
+    PRINT_MESSAGE(" %s", catalog.versions[i]);
+  }
+  PRINT_MESSAGE("\r\n");
+  trace_span("catalog-scan", scan_start, NULL);
+  return &catalog;
+}
+
+static BOOL gdb_python_supported(const char *python_version) {
+  const gdb_catalog_t *catalog = get_gdb_catalog();
+  for (size_t i = 0; i < catalog->versions_count; i++) {
+    if (strcmp(catalog->versions[i], python_version) == 0) {
+      return TRUE;
     }
+  }
+  return FALSE;
+}
+
+static char *get_exe_path(const char *python_version) {
+  const gdb_catalog_t *catalog = get_gdb_catalog();
+  const char *python_suffix = python_version ? python_version : GDB_NO_PYTHON_SUFFIX;
+  char *exe_path = NULL;
+
+  // no exe file for this python version
+  if(python_suffix != GDB_NO_PYTHON_SUFFIX && !gdb_python_supported(python_version)) {
+    PRINT_MESSAGE("Python-%s is not supported. Run without python\r\n", python_version);
+    python_suffix = GDB_NO_PYTHON_SUFFIX;
+  } else if (python_suffix != GDB_NO_PYTHON_SUFFIX) {
+    PRINT_MESSAGE("Run with python-%s\r\n", python_version);
   } else {
     PRINT_MESSAGE("Run without python\r\n");
   }
 
-  free(base_path);
+  exe_path = malloc(strlen(catalog->base_path) + 1 + strlen(python_suffix) + strlen(GDB_EXTENSION) + 1);
+  if (exe_path == NULL) {
+    perror("malloc()");
+    abort();
+  }
+  // insert python_version to the filename
+  sprintf(exe_path, "%s-%s%s", catalog->base_path, python_suffix, GDB_EXTENSION);
+  if (python_suffix == GDB_NO_PYTHON_SUFFIX && !catalog->has_no_python) {
+    PRINT_MESSAGE("\"%s\" is not found\r\n", exe_path);
+  }
   return exe_path;
 }
 
-static char *get_cmdline(const int argc, const char **argv, const char *exe_path) {
-  char * cmdline = (char *)malloc(strlen(exe_path) + 1);
+static char *get_cmdline(const int argc, const char **argv, const char *exe_path, const char *gdb_options) {
+  char * cmdline = (char *)malloc(strlen(exe_path) + (gdb_options ? strlen(gdb_options) : 0) + 1);
   if (cmdline == NULL) {
     perror("malloc");
     abort();
   }
   strcpy(cmdline, exe_path);
 
+  // Wrapper options go first, so user's -iex/-ex commands override them
+  if (gdb_options) {
+    strcat(cmdline, gdb_options);
+  }
+
   // Append with user's arguments. Protect them with quotes
   for (int i = 1; i < argc; i++) {
     size_t cur_len = strlen(cmdline);
@@ -323,10 +1096,234 @@ static char *get_cmdline(const int argc, const char **argv, const char *exe_path
   return cmdline;
 }
 
+// GDB index cache keeps the symbol index of every ELF GDB has loaded, named by build-id.
+// Next load of the same ELF skips DWARF indexing, which takes seconds for a large application.
+// Index cache is disabled by ESP_GDB_WRAPPER_NO_INDEX_CACHE or when caching is disabled.
+// DWARF is indexed by as many threads as CPUs the process may run on.
+// Commands run with -iex in front of the user arguments, NULL-terminated.
+// Free with free_gdb_init_commands().
+static char **get_gdb_init_commands(void) {
+  const char *worker_threads_fmt = "maint set worker-threads %lu";
+  const char *index_cache_fmt = "set index-cache directory %s";
+  const char *index_cache_enable = "set index-cache enabled on";
+  char *index_cache_dir = getenv("ESP_GDB_WRAPPER_NO_INDEX_CACHE") ? NULL : get_cache_path(INDEX_CACHE_DIR_NAME);
+  char **commands = calloc(4, sizeof(char *));
+  size_t count = 0;
+  if (commands == NULL) {
+    perror("calloc()");
+    abort();
+  }
+
+  commands[count] = malloc(strlen(worker_threads_fmt) + 16);
+  if (commands[count] == NULL) {
+    perror("malloc()");
+    abort();
+  }
+  sprintf(commands[count++], worker_threads_fmt, (unsigned long) GetActiveProcessorCount(ALL_PROCESSOR_GROUPS));
+  if (index_cache_dir) {
+    CreateDirectoryA(index_cache_dir, NULL);
+    evict_index_cache(index_cache_dir);
+    commands[count] = malloc(strlen(index_cache_fmt) + strlen(index_cache_dir) + 1);
+    if (commands[count] == NULL) {
+      perror("malloc()");
+      abort();
+    }
+    sprintf(commands[count++], index_cache_fmt, index_cache_dir);
+    commands[count] = strdup(index_cache_enable);
+    if (commands[count++] == NULL) {
+      perror("strdup()");
+      abort();
+    }
+    free(index_cache_dir);
+  }
+  return commands;
+}
+
+static void free_gdb_init_commands(char **commands) {
+  for (size_t i = 0; commands[i]; i++) {
+    free(commands[i]);
+  }
+  free(commands);
+}
+
+// The same commands as a command line part: -iex "<command>" for each of them
+static char *get_gdb_options(void) {
+  char **commands = get_gdb_init_commands();
+  size_t size = 1;
+  char *options = NULL;
+
+  for (size_t i = 0; commands[i]; i++) {
+    size += strlen(commands[i]) + sizeof(" -iex \"\"");
+  }
+  options = malloc(size);
+  if (options == NULL) {
+    perror("malloc()");
+    abort();
+  }
+  options[0] = '\0';
+  for (size_t i = 0; commands[i]; i++) {
+    sprintf(&options[strlen(options)], " -iex \"%s\"", commands[i]);
+  }
+  free_gdb_init_commands(commands);
+  return options;
+}
+
+typedef struct {
+  ULONGLONG last_use;
+  ULONGLONG size;
+  char name[MAX_PATH];
+} index_cache_file_t;
+
+static int compare_index_cache_files(const void *a, const void *b) {
+  const index_cache_file_t *file_a = a;
+  const index_cache_file_t *file_b = b;
+  return file_a->last_use < file_b->last_use ? -1 : file_a->last_use > file_b->last_use;
+}
+
+static ULONGLONG filetime_to_ull(FILETIME t) {
+  return ((ULONGLONG) t.dwHighDateTime << 32) | t.dwLowDateTime;
+}
+
+// Remove least recently used indices until the cache fits into ESP_GDB_WRAPPER_INDEX_CACHE_MAX_MB.
+// The directory is listed not more often than INDEX_CACHE_EVICTION_INTERVAL_S.
+static void evict_index_cache(const char *dir) {
+  const char *max_mb_str = getenv("ESP_GDB_WRAPPER_INDEX_CACHE_MAX_MB");
+  ULONGLONG max_size = INDEX_CACHE_MAX_MB;
+  char *path = malloc(strlen(dir) + MAX_PATH + 2);
+  index_cache_file_t *files = NULL;
+  size_t files_count = 0;
+  ULONGLONG size = 0;
+  WIN32_FILE_ATTRIBUTE_DATA attrs;
+  WIN32_FIND_DATAA find_data;
+  HANDLE find = INVALID_HANDLE_VALUE;
+  FILETIME now;
+  FILE *stamp = NULL;
+
+  if (path == NULL) {
+    perror("malloc()");
+    abort();
+  }
+
+  // Invalid value keeps the default, like on Linux and macOS
+  if (max_mb_str && isdigit((unsigned char) max_mb_str[0])) {
+    char *end = NULL;
+    ULONGLONG max_mb = strtoull(max_mb_str, &end, 10);
+    if (*end == '\0') {
+      max_size = max_mb;
+    }
+  }
+  max_size *= 1024 * 1024;
+
+  sprintf(path, "%s\\%s", dir, INDEX_CACHE_EVICTION_STAMP);
+  GetSystemTimeAsFileTime(&now);
+  if (GetFileAttributesExA(path, GetFileExInfoStandard, &attrs) &&
+      filetime_to_ull(now) - filetime_to_ull(attrs.ftLastWriteTime) <
+      INDEX_CACHE_EVICTION_INTERVAL_S * FILETIME_TICKS_PER_SECOND) {
+    free(path);
+    return;
+  }
+  stamp = fopen(path, "w");
+  if (stamp) {
+    fclose(stamp);
+  }
+
+  sprintf(path, "%s\\*", dir);
+  find = FindFirstFileA(path, &find_data);
+  if (find != INVALID_HANDLE_VALUE) {
+    do {
+      if (find_data.cFileName[0] == '.' || (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        continue;
+      }
+      files = realloc(files, (files_count + 1) * sizeof(files[0]));
+      if (files == NULL) {
+        perror("realloc()");
+        abort();
+      }
+      files[files_count].last_use = filetime_to_ull(find_data.ftLastAccessTime);
+      if (files[files_count].last_use < filetime_to_ull(find_data.ftLastWriteTime)) {
+        files[files_count].last_use = filetime_to_ull(find_data.ftLastWriteTime);
+      }
+      files[files_count].size = ((ULONGLONG) find_data.nFileSizeHigh << 32) | find_data.nFileSizeLow;
+      strcpy(files[files_count].name, find_data.cFileName);
+      size += files[files_count].size;
+      files_count++;
+    } while (FindNextFileA(find, &find_data));
+    FindClose(find);
+  }
+  PRINT_MESSAGE("Index cache %s: %u files, %llu of %llu bytes\r\n", dir, (unsigned) files_count, size, max_size);
+
+  if (files_count) {
+    qsort(files, files_count, sizeof(files[0]), compare_index_cache_files);
+  }
+  for (size_t i = 0; i < files_count && size > max_size; i++) {
+    sprintf(path, "%s\\%s", dir, files[i].name);
+    if (DeleteFileA(path)) {
+      PRINT_MESSAGE("Evicted %s\r\n", path);
+      size -= files[i].size;
+    }
+  }
+  free(files);
+  free(path);
+}
+
+// Load the ELF with no-python GDB in background, so the index cache has
+// its symbol index when a debug session starts. Returns 0 if GDB is started.
+static int prewarm_index_cache(const char *elf) {
+  STARTUPINFO si;
+  PROCESS_INFORMATION pi;
+  const char *prewarm_argv[3] = { NULL, "-nx", "-batch" };
+  char elf_path[MAX_PATH];
+  char *exe_path = NULL;
+  char *gdb_options = NULL;
+  char *cmdline = NULL;
+  size_t len = 0;
+
+  if (getenv("ESP_GDB_WRAPPER_NO_INDEX_CACHE") || getenv("ESP_GDB_WRAPPER_NO_CACHE")) {
+    fprintf(stderr, "GDB index cache is disabled\n");
+    return 1;
+  }
+  len = GetFullPathNameA(elf, sizeof(elf_path), elf_path, NULL);
+  if (len == 0 || len >= sizeof(elf_path) || GetFileAttributesA(elf_path) == INVALID_FILE_ATTRIBUTES) {
+    fprintf(stderr, "%s: file is not found\n", elf);
+    return 1;
+  }
+
+  exe_path = get_exe_path(NULL);
+  gdb_options = get_gdb_options();
+  cmdline = get_cmdline(3, prewarm_argv, exe_path, gdb_options);
+  cmdline = realloc(cmdline, strlen(cmdline) + strlen(elf_path) + 4);
+  if (cmdline == NULL) {
+    perror("realloc");
+    abort();
+  }
+  sprintf(&cmdline[strlen(cmdline)], " \"%s\"", elf_path);
+  PRINT_MESSAGE("Executing: \"%s\"\r\n", cmdline);
+
+  ZeroMemory(&si, sizeof(si));
+  si.cb = sizeof(si);
+  ZeroMemory(&pi, sizeof(pi));
+  if (!CreateProcessA(NULL, cmdline, NULL, NULL, FALSE, DETACHED_PROCESS | CREATE_NO_WINDOW,
+                      NULL, NULL, &si, &pi)) {
+    fprintf(stderr, "Can't execute \"%s\"\nError: %lu", cmdline, GetLastError());
+    len = 0;
+  } else {
+    printf("Filling GDB index cache for %s in background (pid %lu)\n", elf, pi.dwProcessId);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+  }
+
+  free(exe_path);
+  free(gdb_options);
+  free(cmdline);
+  return len ? 0 : 1;
+}
+
 static int update_environment_variables(const char *python_base_prefix, const char *python_path) {
   int ret = -1;
   DWORD path_var_size = 0;
   char *buf = NULL;
+  char *pruned_path = NULL;
+  char *pycache_dir = NULL;
   int len = 0;
 
   if (!python_base_prefix) {
@@ -359,34 +1356,258 @@ static int update_environment_variables(const char *python_base_prefix, const ch
     goto error;
   }
   if (!SetEnvironmentVariable("PATH", buf)) {
-    PRINT_MESSAGE("SetEnvironmentVariable(PATH) failed: %s\r\n", GetLastError());
+    PRINT_MESSAGE("SetEnvironmentVariable(PATH) failed: %lu\r\n", GetLastError());
     goto error;
   }
 
   // Set PYTHONHOME to have base python modules
   if (!SetEnvironmentVariable("PYTHONHOME", python_base_prefix)) {
-    PRINT_MESSAGE("SetEnvironmentVariable(PYTHONHOME) failed: %s\r\n", GetLastError());
+    PRINT_MESSAGE("SetEnvironmentVariable(PYTHONHOME) failed: %lu\r\n", GetLastError());
     goto error;
   }
 
   // Set PYTHONPATH to have espressif virtual env modules
-  if (!SetEnvironmentVariable("PYTHONPATH", python_path)) {
-    PRINT_MESSAGE("SetEnvironmentVariable(PYTHONPATH) failed: %s\r\n", GetLastError());
+  pruned_path = python_path ? prune_python_path(python_path) : NULL;
+  if (!SetEnvironmentVariable("PYTHONPATH", pruned_path)) {
+    PRINT_MESSAGE("SetEnvironmentVariable(PYTHONPATH) failed: %lu\r\n", GetLastError());
     goto error;
   }
 
+  // Write bytecode to per-user cache, toolchain may be installed on read-only drive
+  if (!getenv("PYTHONPYCACHEPREFIX") && !getenv("PYTHONDONTWRITEBYTECODE") &&
+      (pycache_dir = get_cache_path(PYCACHE_DIR_NAME))) {
+    CreateDirectoryA(pycache_dir, NULL);
+    if (!SetEnvironmentVariable("PYTHONPYCACHEPREFIX", pycache_dir)) {
+      PRINT_MESSAGE("SetEnvironmentVariable(PYTHONPYCACHEPREFIX) failed: %lu\r\n", GetLastError());
+    }
+  }
+
   ret = 0;
 error:
   if (buf) {
     free(buf);
   }
+  if (pruned_path) {
+    free(pruned_path);
+  }
+  if (pycache_dir) {
+    free(pycache_dir);
+  }
   return ret;
 }
 
+// Make entries absolute, drop duplicates and entries which don't exist.
+// Every import of GDB's python checks each entry.
+static char *prune_python_path(const char *python_path) {
+  char *pruned = malloc(strlen(python_path) + 1);
+  char **entries = NULL;
+  size_t entries_count = 0;
+  size_t pruned_count = 0;
+  const char *start = python_path;
+  char full_path[MAX_PATH];
+  size_t i = 0;
+
+  entries = calloc(strlen(python_path) / 2 + 2, sizeof(char *));
+  if (pruned == NULL || entries == NULL) {
+    perror("malloc()");
+    abort();
+  }
+  pruned[0] = '\0';
+
+  while (start) {
+    const char *end = strchr(start, ';');
+    size_t len = end ? (size_t) (end - start) : strlen(start);
+    char *entry = malloc(len + 1);
+    DWORD full_len = 0;
+    BOOL duplicate = FALSE;
+
+    if (entry == NULL) {
+      perror("malloc()");
+      abort();
+    }
+    memcpy(entry, start, len);
+    entry[len] = '\0';
+    start = end ? end + 1 : NULL;
+    if (len == 0) {
+      free(entry);
+      continue;
+    }
+    entries_count++;
+
+    full_len = GetFullPathNameA(entry, sizeof(full_path), full_path, NULL);
+    free(entry);
+    if (full_len == 0 || full_len >= sizeof(full_path) ||
+        GetFileAttributesA(full_path) == INVALID_FILE_ATTRIBUTES) {
+      continue;
+    }
+    for (i = 0; i < pruned_count && !duplicate; i++) {
+      duplicate = _stricmp(entries[i], full_path) == 0;
+    }
+    if (duplicate) {
+      continue;
+    }
+    // normalized path may be longer than the original one
+    pruned = realloc(pruned, strlen(pruned) + full_len + 2);
+    if (pruned == NULL) {
+      perror("realloc()");
+      abort();
+    }
+    entries[pruned_count++] = strdup(full_path);
+    if (pruned[0]) {
+      strcat(pruned, ";");
+    }
+    strcat(pruned, full_path);
+  }
+
+  PRINT_MESSAGE("Python import path entries: %u pruned to %u\r\n", (unsigned) entries_count, (unsigned) pruned_count);
+  for (i = 0; i < pruned_count; i++) {
+    free(entries[i]);
+  }
+  free(entries);
+  return pruned;
+}
+
+typedef struct {
+  char *cmdline;
+  PROCESS_INFORMATION pi;
+  HANDLE stdout_read;
+  BOOL running;
+  char *version;
+  char *base_prefix;
+  char *python_path;
+} python_probe_t;
+
+static void python_probe_add(python_probe_t *probes, size_t *count, const char *exe) {
+  char *cmdline = malloc(strlen(exe) + strlen(PYTHON_SCRIPT_CMD_OPTION) + strlen(PYTHON_SCRIPT_BODY) + 1);
+  if (cmdline == NULL) {
+    perror("malloc()");
+    abort();
+  }
+  sprintf(cmdline, "%s%s%s", exe, PYTHON_SCRIPT_CMD_OPTION, PYTHON_SCRIPT_BODY);
+  ZeroMemory(&probes[*count], sizeof(probes[*count]));
+  probes[(*count)++].cmdline = cmdline;
+}
+
+static void python_probe_start(python_probe_t *probe, HANDLE nul) {
+  SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+  STARTUPINFO si;
+  HANDLE stdout_write = NULL;
+
+  // The pipe fits the whole output, it is read when the process exits
+  if (!CreatePipe(&probe->stdout_read, &stdout_write, &sa, PYTHON_PROBE_PIPE_SIZE)) {
+    PRINT_MESSAGE("CreatePipe() failed: %lu\r\n", GetLastError());
+    probe->stdout_read = NULL;
+    return;
+  }
+  SetHandleInformation(probe->stdout_read, HANDLE_FLAG_INHERIT, 0);
+
+  ZeroMemory(&si, sizeof(si));
+  si.cb = sizeof(si);
+  si.dwFlags = STARTF_USESTDHANDLES;
+  si.hStdInput = nul;
+  si.hStdOutput = stdout_write;
+  si.hStdError = nul;
+  probe->running = CreateProcessA(NULL, probe->cmdline, NULL, NULL, TRUE, CREATE_NO_WINDOW,
+                                  NULL, NULL, &si, &probe->pi);
+  // Only the child keeps the write end, so other probes don't inherit it
+  CloseHandle(stdout_write);
+  if (!probe->running) {
+    PRINT_MESSAGE("Can't execute \"%s\": %lu\r\n", probe->cmdline, GetLastError());
+    ZeroMemory(&probe->pi, sizeof(probe->pi));
+  }
+}
+
+// Parse version, base_prefix and python_path printed by the exited interpreter
+static void python_probe_finish(python_probe_t *probe) {
+  char *fields[3] = { NULL, NULL, NULL };
+  DWORD exit_code = 1;
+  DWORD available = 0;
+  DWORD read = 0;
+  char *output = NULL;
+  char *line = NULL;
+  int i = 0;
+
+  probe->running = FALSE;
+  GetExitCodeProcess(probe->pi.hProcess, &exit_code);
+  if (exit_code == 0 && PeekNamedPipe(probe->stdout_read, NULL, 0, NULL, &available, NULL)) {
+    output = malloc(available + 1);
+    if (output == NULL) {
+      perror("malloc()");
+      abort();
+    }
+    if (available == 0 || !ReadFile(probe->stdout_read, output, available, &read, NULL)) {
+      read = 0;
+    }
+    output[read] = '\0';
+
+    for (line = output, i = 0; line && i < 3; i++) {
+      char *end = strchr(line, '\n');
+      if (end) {
+        *end = '\0';
+        if (end > line && end[-1] == '\r') {
+          end[-1] = '\0';
+        }
+      }
+      fields[i] = strdup(line);
+      line = end ? end + 1 : NULL;
+    }
+    free(output);
+  }
+
+  if (fields[0] && fields[1] && fields[2] &&
+      strncmp(fields[0], PYTHON_MAJOR_WITH_DOT, strlen(PYTHON_MAJOR_WITH_DOT)) == 0) {
+    probe->version = fields[0];
+    probe->base_prefix = fields[1];
+    probe->python_path = fields[2];
+  } else {
+    for (i = 0; i < 3; i++) {
+      free(fields[i]);
+    }
+  }
+  PRINT_MESSAGE("Probed \"%s\": %s\r\n", probe->cmdline, probe->version ? probe->version : "failed");
+}
+
+// The most preferred interpreter GDB is built for wins once all more preferred ones
+// have exited. If none of them matches, the most preferred working one is used.
+// Returns FALSE while the choice depends on still running interpreters.
+static BOOL python_probe_select(python_probe_t *probes, size_t count, BOOL timed_out, int *selected) {
+  size_t i = 0;
+
+  *selected = -1;
+  for (i = 0; i < count; i++) {
+    if (probes[i].running && !timed_out) {
+      return FALSE;
+    }
+    if (probes[i].version && gdb_python_supported(probes[i].version)) {
+      *selected = (int) i;
+      return TRUE;
+    }
+  }
+  for (i = 0; i < count; i++) {
+    if (probes[i].version) {
+      *selected = (int) i;
+      break;
+    }
+  }
+  return TRUE;
+}
+
+// Run all candidates at once: python of ESP-IDF environment, python_exe_arr and
+// the py launcher for every python version GDB is built for. The whole probe is
+// limited by PYTHON_PROBE_TIMEOUT_MS (ESP_GDB_WRAPPER_PROBE_TIMEOUT_MS overrides),
+// interpreters still running after the choice is made are terminated.
 static void get_python_info(char **version, char **base_prefix, char **python_path) {
-  char *tmp = NULL;
+  python_probe_t probes[PYTHON_PROBE_MAX_CANDIDATES];
+  const gdb_catalog_t *catalog = get_gdb_catalog();
   const size_t python_exe_arr_size = sizeof(python_exe_arr) / sizeof(python_exe_arr[0]);
+  const char *idf_python_env_path = getenv("IDF_PYTHON_ENV_PATH");
+  const DWORD timeout = env_timeout_ms("ESP_GDB_WRAPPER_PROBE_TIMEOUT_MS", PYTHON_PROBE_TIMEOUT_MS);
+  const DWORD start = GetTickCount();
+  SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+  HANDLE nul = INVALID_HANDLE_VALUE;
+  size_t count = 0;
   size_t i = 0;
+  int selected = -1;
 
   if (version == NULL || base_prefix == NULL) {
     fprintf(stderr, "%s: bad input parameters (%p %p)\n", __FUNCTION__, version, base_prefix);
@@ -397,49 +1618,92 @@ static void get_python_info(char **version, char **base_prefix, char **python_pa
   *base_prefix = NULL;
   *python_path = NULL;
 
-  for (i = 0; i < python_exe_arr_size; i++) {
-    FILE* pipe = NULL;
-    char *python_cmd = malloc(strlen(python_exe_arr[i]) +
-                              strlen(PYTHON_SCRIPT_CMD_OPTION) +
-                              strlen(PYTHON_SCRIPT_BODY) +
-                              strlen(REDIRECT_STDERR_TO_NULL) +
-                              1);
-    sprintf(python_cmd, "%s%s%s%s", python_exe_arr[i],
-            PYTHON_SCRIPT_CMD_OPTION,
-            PYTHON_SCRIPT_BODY,
-            REDIRECT_STDERR_TO_NULL);
-
-    pipe = popen(python_cmd, "r");
-    free(python_cmd);
-
-    if (pipe == NULL) {
-      continue;
+  if (idf_python_env_path) {
+    char *exe = malloc(strlen(idf_python_env_path) + strlen(IDF_PYTHON_ENV_EXE) + 3);
+    if (exe == NULL) {
+      perror("malloc()");
+      abort();
     }
+    sprintf(exe, "\"%s%s\"", idf_python_env_path, IDF_PYTHON_ENV_EXE);
+    python_probe_add(probes, &count, exe);
+    free(exe);
+  }
+  for (i = 0; i < python_exe_arr_size; i++) {
+    python_probe_add(probes, &count, python_exe_arr[i]);
+  }
+  for (i = 0; i < catalog->versions_count && count < PYTHON_PROBE_MAX_CANDIDATES; i++) {
+    char exe[sizeof(PYTHON_LAUNCHER) + GDB_PYTHON_VERSION_MAX_LEN];
+    sprintf(exe, "%s%s", PYTHON_LAUNCHER, catalog->versions[i]);
+    python_probe_add(probes, &count, exe);
+  }
 
-    *version = readline(pipe);
-    if (*version == NULL) {
-      pclose(pipe);
-      continue;
-    }
+  nul = CreateFileA("NUL", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                    &sa, OPEN_EXISTING, 0, NULL);
+  for (i = 0; i < count; i++) {
+    python_probe_start(&probes[i], nul);
+  }
+  if (nul != INVALID_HANDLE_VALUE) {
+    CloseHandle(nul);
+  }
 
-    PRINT_MESSAGE("Found python version: %s\r\n", *version);
-    if (strncmp(*version, PYTHON_MAJOR_WITH_DOT, strlen(PYTHON_MAJOR_WITH_DOT)) == 0) {
-      *base_prefix = readline(pipe);
-      *python_path = readline(pipe);
-      pclose(pipe);
+  while (!python_probe_select(probes, count, FALSE, &selected)) {
+    HANDLE handles[PYTHON_PROBE_MAX_CANDIDATES];
+    size_t index[PYTHON_PROBE_MAX_CANDIDATES];
+    DWORD elapsed = GetTickCount() - start;
+    DWORD handles_count = 0;
+    DWORD res = 0;
+
+    for (i = 0; i < count; i++) {
+      if (probes[i].running) {
+        index[handles_count] = i;
+        handles[handles_count++] = probes[i].pi.hProcess;
+      }
+    }
+    res = WaitForMultipleObjects(handles_count, handles, FALSE, elapsed < timeout ? timeout - elapsed : 0);
+    if (res >= WAIT_OBJECT_0 && res < WAIT_OBJECT_0 + handles_count) {
+      python_probe_finish(&probes[index[res - WAIT_OBJECT_0]]);
+    } else {
+      PRINT_MESSAGE("Python probe timeout (%lu ms) is reached\r\n", timeout);
+      python_probe_select(probes, count, TRUE, &selected);
       break;
     }
+  }
+  PRINT_MESSAGE("Python probe took %lu ms\r\n", GetTickCount() - start);
 
-    free(*version);
-    *version = NULL;
-    pclose(pipe);
+  for (i = 0; i < count; i++) {
+    if (probes[i].running) {
+      TerminateProcess(probes[i].pi.hProcess, 1);
+    }
+    if (probes[i].pi.hProcess) {
+      CloseHandle(probes[i].pi.hProcess);
+      CloseHandle(probes[i].pi.hThread);
+    }
+    if (probes[i].stdout_read) {
+      CloseHandle(probes[i].stdout_read);
+    }
+    if ((int) i == selected) {
+      PRINT_MESSAGE("Found python version: %s (%s)\r\n", probes[i].version, probes[i].cmdline);
+      *version = probes[i].version;
+      *base_prefix = probes[i].base_prefix;
+      *python_path = probes[i].python_path;
+    } else {
+      free(probes[i].version);
+      free(probes[i].base_prefix);
+      free(probes[i].python_path);
+    }
+    free(probes[i].cmdline);
   }
 }
 
+// Test run is limited by GDB_TEST_TIMEOUT_MS (ESP_GDB_WRAPPER_TEST_TIMEOUT_MS overrides):
+// GDB with-python may hang in site initialization. GDB runs in a job object, so
+// processes it started are terminated with it. GDB_TEST_TIMEOUT_EXIT_CODE is returned on timeout.
 static int execute_cmdline(const char *cmdline, BOOL test_run) {
   STARTUPINFO si;
   PROCESS_INFORMATION pi;
   DWORD exit_code = 0;
+  HANDLE job = NULL;
+  DWORD timeout = INFINITE;
 
   PRINT_MESSAGE("Executing: \"%s\"\r\n", cmdline);
 
@@ -450,21 +1714,40 @@ static int execute_cmdline(const char *cmdline, BOOL test_run) {
   // Do not show popup boxes with errors on test run
   SetErrorMode(test_run ? (SEM_FAILCRITICALERRORS | SEM_NOGPFAULTERRORBOX) : 0);
 
+  if (test_run) {
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits;
+    timeout = env_timeout_ms("ESP_GDB_WRAPPER_TEST_TIMEOUT_MS", GDB_TEST_TIMEOUT_MS);
+    job = CreateJobObjectA(NULL, NULL);
+    if (job) {
+      // Processes of the job are killed when the wrapper exits too
+      ZeroMemory(&limits, sizeof(limits));
+      limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+      SetInformationJobObject(job, JobObjectExtendedLimitInformation, &limits, sizeof(limits));
+    }
+  }
+
   if (!CreateProcessA(NULL,                // No module name (use command line)
                       (char *) cmdline,    // Command line
                       NULL,                // Process handle not inheritable
                       NULL,                // Thread handle not inheritable
                       TRUE,                // Set handle inheritance to TRUE
-                      0,                   // No creation flags
+                      job ? CREATE_SUSPENDED : 0, // Start in the job before GDB runs anything
                       NULL,                // Use parent's environment block
                       NULL,                // Use parent's starting directory
                       &si,                 // Pointer to STARTUPINFO structure
                       &pi)                 // Pointer to PROCESS_INFORMATION structure
      ) {
-    fprintf(stderr, "Can't execute \"%s\"\nError: %s", cmdline, GetLastError());
+    fprintf(stderr, "Can't execute \"%s\"\nError: %lu", cmdline, GetLastError());
     abort();
   }
 
+  if (job) {
+    if (!AssignProcessToJobObject(job, pi.hProcess)) {
+      PRINT_MESSAGE("AssignProcessToJobObject() failed: %lu\r\n", GetLastError());
+    }
+    ResumeThread(pi.hThread);
+  }
+
   if (!test_run) {
     // Disable ctrl+c handling for this GDB wrapper
     // Setting this on test-run breaks Ctrl handlings on target GDB
@@ -472,15 +1755,125 @@ static int execute_cmdline(const char *cmdline, BOOL test_run) {
   }
 
   // Wait until child process exits.
-  WaitForSingleObject(pi.hProcess, INFINITE);
-
-  // Get exit code of child process
-  GetExitCodeProcess(pi.hProcess, &exit_code);
+  if (WaitForSingleObject(pi.hProcess, timeout) == WAIT_TIMEOUT) {
+    PRINT_MESSAGE("GDB test run is not finished in %lu ms, terminating\r\n", timeout);
+    if (!job || !TerminateJobObject(job, GDB_TEST_TIMEOUT_EXIT_CODE)) {
+      TerminateProcess(pi.hProcess, GDB_TEST_TIMEOUT_EXIT_CODE);
+    }
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    exit_code = GDB_TEST_TIMEOUT_EXIT_CODE;
+  } else {
+    // Get exit code of child process
+    GetExitCodeProcess(pi.hProcess, &exit_code);
+  }
   PRINT_MESSAGE("Exit code is %d\r\n", exit_code);
 
   // Close process and thread handles.
   CloseHandle(pi.hProcess);
   CloseHandle(pi.hThread);
+  if (job) {
+    CloseHandle(job);
+  }
 
   return (int) exit_code;
 }
+
+// Timeout in milliseconds from the environment variable. Unset, invalid ("", "abc", "5s")
+// or zero value keeps the default, like on Linux and macOS.
+static DWORD env_timeout_ms(const char *name, DWORD default_ms) {
+  const char *value = getenv(name);
+  char *end = NULL;
+  unsigned long ms = 0;
+
+  if (value == NULL || !isdigit((unsigned char) value[0])) {
+    return default_ms;
+  }
+  ms = strtoul(value, &end, 10);
+  if (*end != '\0' || ms == 0 || ms >= INFINITE) {
+    return default_ms;
+  }
+  return (DWORD) ms;
+}
+
+static ULONGLONG unix_time_s(void) {
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+  return (filetime_to_ull(now) - FILETIME_UNIX_EPOCH) / FILETIME_TICKS_PER_SECOND;
+}
+
+// Microseconds since the Unix epoch, so events of different processes line up
+static ULONGLONG trace_now(void) {
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+  return (filetime_to_ull(now) - FILETIME_UNIX_EPOCH) / 10;
+}
+
+// Write s as JSON string content at p, return the end of the written text.
+// An escaped byte takes up to 6 characters.
+static char *trace_escape(char *p, const char *s) {
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      p += sprintf(p, "\\%c", *s);
+    } else if ((unsigned char) *s < 0x20) {
+      p += sprintf(p, "\\u%04x", (unsigned char) *s);
+    } else {
+      *p++ = *s;
+    }
+  }
+  return p;
+}
+
+// Append a Chrome trace complete event to ESP_WRAPPER_TRACE_FILE, in the format the
+// Linux and macOS wrappers write. Every launch appends to the same file, the JSON array
+// is never closed. The file is locked, so the first writer of an empty file opens the array.
+static void trace_span(const char *name, ULONGLONG start, const char *detail) {
+  static HANDLE file = NULL;
+  const char *path = getenv(TRACE_FILE_ENV);
+  ULONGLONG end = trace_now();
+  OVERLAPPED overlapped;
+  LARGE_INTEGER size;
+  DWORD written = 0;
+  char *event = NULL;
+  char *p = NULL;
+
+  if (path == NULL || *path == '\0') {
+    return;
+  }
+  if (file == NULL) {
+    // FILE_APPEND_DATA makes every write an append, LockFileEx needs read or write data access
+    file = CreateFileA(path, FILE_APPEND_DATA | FILE_READ_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                       OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  }
+  if (file == INVALID_HANDLE_VALUE) {
+    return;
+  }
+
+  // escaped strings take up to 6 characters per byte
+  event = malloc(256 + 6 * (strlen(name) + strlen(trace_category) + (detail ? strlen(detail) : 0)));
+  if (event == NULL) {
+    perror("malloc()");
+    abort();
+  }
+  p = event + sprintf(event, "{\"name\":\"");
+  p = trace_escape(p, name);
+  p += sprintf(p, "\",\"cat\":\"");
+  p = trace_escape(p, trace_category);
+  p += sprintf(p, "\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%lu,\"tid\":%lu",
+               start, end - start, GetCurrentProcessId(), GetCurrentProcessId());
+  if (detail) {
+    p += sprintf(p, ",\"args\":{\"detail\":\"");
+    p = trace_escape(p, detail);
+    p += sprintf(p, "\"}");
+  }
+  p += sprintf(p, "},\n");
+
+  ZeroMemory(&overlapped, sizeof(overlapped));
+  if (LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped)) {
+    if (GetFileSizeEx(file, &size) && size.QuadPart == 0) {
+      WriteFile(file, "[\n", 2, &written, NULL);
+    }
+    WriteFile(file, event, (DWORD) (p - event), &written, NULL);
+    UnlockFileEx(file, 0, MAXDWORD, MAXDWORD, &overlapped);
+  }
+  free(event);
+}
@@ -0,0 +1,286 @@
+use super::exe::MULTICALL_NAME;
+use libc::{c_char, c_int};
+use std::mem::MaybeUninit;
+use std::ptr::null;
+
+/* Allocation-free launch for the common case. It runs as a constructor,
+ * glibc and macOS pass it argc/argv/envp before the Rust runtime starts
+ * main(). The wrapper name is parsed, the tool path, the XTENSA_GNU_CONFIG
+ * entry and the argv/envp arrays are built in fixed stack buffers and the
+ * tool is started with one execve(). main() takes over when tracing is
+ * enabled, the name or the layout is unexpected, something does not fit the
+ * buffers or execve() fails, and it reports the errors. */
+
+const PATH_MAX: usize = libc::PATH_MAX as usize;
+const ARGV_MAX: usize = 16384;
+const ENVP_MAX: usize = 4096;
+
+const CONFIG_ENV_ENTRY: &[u8] = b"XTENSA_GNU_CONFIG=";
+
+/* NUL-terminated string in a fixed buffer, push() fails instead of growing */
+struct Buf<const N: usize> {
+    data: [u8; N],
+    len: usize,
+}
+
+impl<const N: usize> Buf<N> {
+    fn new() -> Self {
+        Buf {
+            data: [0; N],
+            len: 0,
+        }
+    }
+
+    fn push(&mut self, s: &[u8]) -> Option<()> {
+        /* One byte is kept for the terminating NUL */
+        let end = self.len + s.len();
+        if end >= N {
+            return None;
+        }
+        self.data[self.len..end].copy_from_slice(s);
+        self.data[end] = 0;
+        self.len = end;
+        Some(())
+    }
+
+    fn as_bytes(&self) -> &[u8] {
+        &self.data[..self.len]
+    }
+
+    fn as_ptr(&self) -> *const c_char {
+        self.data.as_ptr() as *const c_char
+    }
+}
+
+/* Pointer array of at most N entries, terminated by NULL. Only the used part
+ * is written, so the untouched stack pages are never faulted in. */
+struct PtrArray<const N: usize> {
+    data: MaybeUninit<[*const c_char; N]>,
+    len: usize,
+}
+
+impl<const N: usize> PtrArray<N> {
+    fn new() -> Self {
+        PtrArray {
+            data: MaybeUninit::uninit(),
+            len: 0,
+        }
+    }
+
+    fn push(&mut self, p: *const c_char) -> Option<()> {
+        /* One entry is kept for the terminating NULL */
+        if self.len + 1 >= N {
+            return None;
+        }
+        let data = self.data.as_mut_ptr() as *mut *const c_char;
+        unsafe {
+            data.add(self.len).write(p);
+            data.add(self.len + 1).write(null());
+        }
+        self.len += 1;
+        Some(())
+    }
+
+    fn as_ptr(&self) -> *const *const c_char {
+        self.data.as_ptr() as *const *const c_char
+    }
+}
+
+/* "xtensa-{chip}-elf-{tool}" into ("{chip}", "{tool}") */
+fn parse_name(name: &[u8]) -> Option<(&[u8], &[u8])> {
+    let rest = name.strip_prefix(b"xtensa-")?;
+    let dash = rest.iter().position(|&c| c == b'-')?;
+    let (chip, rest) = (&rest[..dash], &rest[dash + 1..]);
+    let tool = rest.strip_prefix(b"elf-")?;
+    if chip.is_empty() || chip == b"esp" || tool.is_empty() {
+        return None;
+    }
+    Some((chip, tool))
+}
+
+/* Same tools as layout::is_compiler() */
+fn is_compiler(tool: &[u8]) -> bool {
+    matches!(tool, b"cc" | b"gcc" | b"g++" | b"c++")
+        || tool
+            .strip_prefix(b"gcc-")
+            .is_some_and(|version| version.first().is_some_and(u8::is_ascii_digit))
+}
+
+fn split_last_slash(path: &[u8]) -> Option<(&[u8], &[u8])> {
+    let slash = path.iter().rposition(|&c| c == b'/')?;
+    Some((&path[..slash], &path[slash + 1..]))
+}
+
+/* Same as env::current_exe() */
+#[cfg(target_os = "linux")]
+fn current_exe(buf: &mut Buf<PATH_MAX>) -> Option<()> {
+    let len = unsafe {
+        libc::readlink(
+            c"/proc/self/exe".as_ptr(),
+            buf.data.as_mut_ptr() as *mut c_char,
+            PATH_MAX - 1,
+        )
+    };
+    if len <= 0 || len as usize >= PATH_MAX - 1 {
+        return None;
+    }
+    buf.len = len as usize;
+    buf.data[buf.len] = 0;
+    Some(())
+}
+
+#[cfg(target_os = "macos")]
+fn current_exe(buf: &mut Buf<PATH_MAX>) -> Option<()> {
+    let mut size = PATH_MAX as u32;
+    if unsafe { libc::_NSGetExecutablePath(buf.data.as_mut_ptr() as *mut c_char, &mut size) } != 0 {
+        return None;
+    }
+    buf.len = buf.data.iter().position(|&c| c == 0)?;
+    Some(())
+}
+
+unsafe fn c_bytes<'a>(s: *const c_char) -> &'a [u8] {
+    std::ffi::CStr::from_ptr(s).to_bytes()
+}
+
+#[cfg(target_os = "linux")]
+#[used]
+#[link_section = ".init_array"]
+static FAST_PATH: extern "C" fn(c_int, *const *const c_char, *const *const c_char) = fast_path;
+
+#[cfg(target_os = "macos")]
+#[used]
+#[link_section = "__DATA,__mod_init_func"]
+static FAST_PATH: extern "C" fn(c_int, *const *const c_char, *const *const c_char) = fast_path;
+
+extern "C" fn fast_path(argc: c_int, argv: *const *const c_char, envp: *const *const c_char) {
+    let _ = unsafe { exec(argc, argv, envp) };
+}
+
+/* Returns when the launch is left to the regular path */
+unsafe fn exec(argc: c_int, argv: *const *const c_char, envp: *const *const c_char) -> Option<()> {
+    let mut env = PtrArray::<ENVP_MAX>::new();
+    let mut config = Buf::<{ PATH_MAX + 32 }>::new();
+    config.push(CONFIG_ENV_ENTRY)?;
+    for i in 0.. {
+        let entry = *envp.add(i);
+        if entry.is_null() {
+            break;
+        }
+        let bytes = c_bytes(entry);
+        /* Debug output and the start-up trace are left to the regular path */
+        if bytes.starts_with(b"ESP_DEBUG_TRACE=")
+            || bytes
+                .strip_prefix(b"ESP_WRAPPER_TRACE_FILE=")
+                .is_some_and(|path| !path.is_empty())
+        {
+            return None;
+        }
+        /* Replaced, like env::set_var() */
+        if !bytes.starts_with(CONFIG_ENV_ENTRY) {
+            env.push(entry)?;
+        }
+    }
+
+    let mut wrapper = Buf::<PATH_MAX>::new();
+    current_exe(&mut wrapper)?;
+    let (bin_dir, mut name) = split_last_slash(wrapper.as_bytes())?;
+    /* Symlink to the multi-call binary, like exe::wrapper_path() */
+    if name == MULTICALL_NAME.as_bytes() && argc > 0 {
+        let arg0 = c_bytes(*argv);
+        name = split_last_slash(arg0).map_or(arg0, |(_, name)| name);
+    }
+    let (chip, tool) = parse_name(name)?;
+    /* The multi-call binary runs the GDB wrapper for "xtensa-{chip}-elf-gdb" */
+    if tool == b"gdb" {
+        return None;
+    }
+
+    /* {bin}/../lib/xtensa_{chip}.so must exist */
+    let (toolchain_dir, _) = split_last_slash(bin_dir)?;
+    config.push(toolchain_dir)?;
+    config.push(b"/lib/xtensa_")?;
+    config.push(chip)?;
+    config.push(b".so")?;
+    let dynconfig = config.as_ptr().add(CONFIG_ENV_ENTRY.len());
+    if libc::access(dynconfig, libc::F_OK) != 0 {
+        return None;
+    }
+    env.push(config.as_ptr())?;
+
+    let mut exec_path = Buf::<PATH_MAX>::new();
+    exec_path.push(bin_dir)?;
+    exec_path.push(b"/xtensa-esp-elf-")?;
+    exec_path.push(tool)?;
+
+    let mut option = Buf::<64>::new();
+    let mut args = PtrArray::<ARGV_MAX>::new();
+    args.push(exec_path.as_ptr())?;
+    if is_compiler(tool) {
+        option.push(b"-mdynconfig=xtensa_")?;
+        option.push(chip)?;
+        option.push(b".so")?;
+        args.push(option.as_ptr())?;
+    }
+    for i in 1..argc as usize {
+        args.push(*argv.add(i))?;
+    }
+
+    libc::execve(exec_path.as_ptr(), args.as_ptr(), env.as_ptr());
+    None
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn names() {
+        assert_eq!(
+            parse_name(b"xtensa-esp32s3-elf-gcc"),
+            Some((&b"esp32s3"[..], &b"gcc"[..]))
+        );
+        assert_eq!(
+            parse_name(b"xtensa-esp32-elf-gcc-ar"),
+            Some((&b"esp32"[..], &b"gcc-ar"[..]))
+        );
+        /* The real tools, not wrappers */
+        assert_eq!(parse_name(b"xtensa-esp-elf-gcc"), None);
+        assert_eq!(parse_name(b"xtensa-esp32-elf-"), None);
+        assert_eq!(parse_name(b"xtensa--elf-gcc"), None);
+        assert_eq!(parse_name(b"riscv32-esp-elf-gcc"), None);
+        assert_eq!(parse_name(b"xtensa-esp32-gcc"), None);
+    }
+
+    #[test]
+    fn compilers() {
+        for tool in ["cc", "gcc", "g++", "c++", "gcc-13.2.0"] {
+            assert!(is_compiler(tool.as_bytes()), "{}", tool);
+        }
+        for tool in ["gcc-ar", "gcc-", "ld", "as", "objdump", "gdb"] {
+            assert!(!is_compiler(tool.as_bytes()), "{}", tool);
+        }
+    }
+
+    #[test]
+    fn buffers() {
+        let mut buf = Buf::<8>::new();
+        buf.push(b"/bin").unwrap();
+        buf.push(b"/cc").unwrap();
+        /* No room left for the NUL */
+        assert!(buf.push(b"x").is_none());
+        assert_eq!(buf.as_bytes(), b"/bin/cc");
+        assert_eq!(buf.data[buf.len], 0);
+        assert_eq!(
+            split_last_slash(buf.as_bytes()),
+            Some((&b"/bin"[..], &b"cc"[..]))
+        );
+        assert_eq!(split_last_slash(b"cc"), None);
+
+        let mut args = PtrArray::<3>::new();
+        args.push(buf.as_ptr()).unwrap();
+        args.push(buf.as_ptr()).unwrap();
+        assert!(args.push(buf.as_ptr()).is_none());
+        assert!(unsafe { *args.as_ptr().add(2) }.is_null());
+    }
+}
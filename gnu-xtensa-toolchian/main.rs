@@ -2,12 +2,10 @@ use lazy_static::lazy_static;
 use std::env;
 #[cfg(windows)]
 use std::ffi::c_char;
-#[cfg(windows)]
 use std::ffi::CStr;
 use std::ffi::CString;
 #[cfg(unix)]
 use std::iter::once;
-use std::path::Path;
 #[cfg(windows)]
 use std::path::PathBuf;
 #[cfg(windows)]
@@ -16,8 +14,6 @@ use std::process::{exit, Command, ExitStatus};
 use std::ptr::null;
 
 const CONFIG_ENV_NAME: &str = "XTENSA_GNU_CONFIG";
-const XTENSA_TOOLCHAIN_PREFIX: &str = "xtensa-esp-elf-";
-const XTENSA_TOOL_PARSE_ERROR: &str = "Called tool must have pattern \"xtensa-esp*-elf-*\"";
 
 lazy_static! {
     static ref ESP_DEBUG_TRACE: bool = env::var("ESP_DEBUG_TRACE").is_ok();
@@ -33,6 +29,14 @@ macro_rules! esp_debug_trace {
     };
 }
 
+#[cfg(any(all(target_os = "linux", target_env = "gnu"), target_os = "macos"))]
+mod fastpath;
+#[cfg(unix)]
+mod resolver;
+
+use esp_wrapper_common::{exe, layout, trace};
+use layout::Layout;
+
 #[cfg(windows)]
 extern "system" {
     fn GetLongPathNameA(lpszShortPath: *const u8, lpszLongPath: *mut u8, cchBuffer: u32) -> u32;
@@ -91,13 +95,14 @@ fn get_short_path_name(long_path: &str) -> String {
     get_path_name(long_path, GetShortPathNameA)
 }
 
-fn main() {
+pub fn main() {
+    trace::start();
     let wrapper_path;
     #[cfg(windows)]
     let short_path_using;
     #[cfg(windows)]
     {
-        let exe_path = env::current_exe().expect("Get executable path");
+        let exe_path = exe::wrapper_path().expect("Get executable path");
         let exe_path_str = exe_path.to_str().unwrap();
         short_path_using = exe_path_str == get_short_path_name(exe_path_str);
         if short_path_using {
@@ -108,37 +113,33 @@ fn main() {
     }
     #[cfg(unix)]
     {
-        wrapper_path = env::current_exe().expect("Get exec full path");
-    }
-    let wrapper_name = Path::new(&wrapper_path)
-        .file_name()
-        .expect("Current exe has path")
-        .to_str()
-        .unwrap();
-
-    let mut chip = "";
-    let mut tool_name = Vec::<&str>::new();
-    for (i, s) in wrapper_name.split('-').enumerate() {
-        match i {
-            0 => assert_eq!(s, "xtensa", "{}", XTENSA_TOOL_PARSE_ERROR),
-            1 => chip = s,
-            2 => assert_eq!(s, "elf", "{}", XTENSA_TOOL_PARSE_ERROR),
-            _ => tool_name.push(s),
-        }
+        wrapper_path = exe::wrapper_path().expect("Get exec full path");
     }
-    let chip = chip;
-    assert_ne!(chip, "esp", "Target chip can not be \"esp\"");
-    assert_ne!(chip, "", "{}", XTENSA_TOOL_PARSE_ERROR);
 
-    let tool_name = tool_name.join("-");
-    assert_ne!(tool_name, "", "{}", XTENSA_TOOL_PARSE_ERROR);
+    /* Resolver daemon already knows the layout, resolve locally if it is not running */
+    #[cfg(unix)]
+    let resolved = {
+        let _span = trace::span("resolver-query");
+        resolver::query(&wrapper_path)
+    };
+    #[cfg(unix)]
+    if let Some(resolved) = resolved {
+        esp_debug_trace!("export {}={}", CONFIG_ENV_NAME, resolved.dynconfig);
+        env::set_var(CONFIG_ENV_NAME, resolved.dynconfig);
+        let argv: Vec<String> = once(resolved.exec_path)
+            .chain(resolved.dynconfig_option)
+            .chain(env::args().skip(1))
+            .collect();
+        esp_debug_trace!("Execute: {:?}", argv);
+        exec(argv);
+    }
 
-    let bin_dir = wrapper_path
-        .parent()
-        .expect("Executable must be in some directory");
+    let mut span = trace::span("layout");
+    let layout = Layout::new(&wrapper_path);
+    span.detail(&layout.chip);
 
     /* Get tool path */
-    let exec_path = bin_dir.join(format!("{}{}", XTENSA_TOOLCHAIN_PREFIX, tool_name));
+    let exec_path = &layout.exec_path;
     let exec_path_str = exec_path.as_path().display().to_string();
     assert!(
         exec_path.try_exists().unwrap(),
@@ -146,15 +147,8 @@ fn main() {
         exec_path_str
     );
 
-    let dynconfig_filename = format!("xtensa_{}.so", chip);
     /* Get dynconfig path */
-    let dynconfig_path = bin_dir
-        .parent()
-        .expect("Toolchain must be in some directory")
-        .join("lib")
-        .as_path()
-        .join(dynconfig_filename.clone());
-
+    let dynconfig_path = &layout.dynconfig_path;
     let dynconfig_path_str = dynconfig_path.as_path().display().to_string();
 
     #[cfg(windows)]
@@ -169,11 +163,14 @@ fn main() {
     assert!(
         dynconfig_path.try_exists().unwrap(),
         "Dynconfig for target {} is not exist ({})",
-        chip,
+        layout.chip,
         dynconfig
     );
 
+    drop(span);
+
     /* Set XTENSA_GNU_CONFIG env variable */
+    let span = trace::span("env-update");
     esp_debug_trace!("export {}={}", CONFIG_ENV_NAME, dynconfig);
     env::set_var(CONFIG_ENV_NAME, dynconfig);
 
@@ -190,12 +187,12 @@ fn main() {
     {
         argv[0] = exec_path_str;
     }
-    if is_compiler(tool_name) {
-        /* Need to add mdynconfig option for using the right multilib instance */
-        let dynconfig_option = format!("-mdynconfig={}", dynconfig_filename);
+    if let Some(dynconfig_option) = layout.dynconfig_option() {
         argv.insert(1, dynconfig_option);
     }
 
+    drop(span);
+
     esp_debug_trace!("Execute: {:?}", argv);
     exec(argv);
 }
@@ -215,6 +212,7 @@ fn exec(argv: Vec<String>) {
 
     let app = *argv.first().expect("app in argv[0]");
 
+    trace::exec(&unsafe { CStr::from_ptr(app) }.to_string_lossy());
     unsafe { libc::execv(app, argv.as_ptr()) };
     println!(
         "execv errno ({})",
@@ -225,6 +223,7 @@ fn exec(argv: Vec<String>) {
 
 #[cfg(windows)]
 fn exec(argv: Vec<String>) {
+    trace::exec(argv.get(0).expect("app in argv[0]"));
     let mut child = Command::new(argv.get(0).expect("app in argv[0]"))
         .args(&argv[1..])
         .spawn()
@@ -239,33 +238,6 @@ fn exec(argv: Vec<String>) {
     };
 }
 
-fn is_compiler(tool_name: String) -> bool {
-    /* consider tools:
-     * xtensa-esp-elf-cc[.exe]
-     * xtensa-esp-elf-gcc[.exe]
-     * xtensa-esp-elf-g++[.exe]
-     * xtensa-esp-elf-c++[.exe]
-     * xtensa-esp-elf-gcc-13.1.0[.exe]
-     */
-    #[cfg(windows)]
-    let tool_name = match tool_name.strip_suffix(".exe") {
-        Some(s) => s.to_owned(),
-        None => tool_name,
-    };
-
-    if ["cc", "gcc", "g++", "c++"].contains(&tool_name.as_str()) {
-        return true;
-    }
-    if tool_name.starts_with("gcc-") {
-        return tool_name
-            .chars()
-            .nth("gcc-".len())
-            .unwrap()
-            .is_ascii_digit();
-    }
-    false
-}
-
 #[cfg(all(windows, target_pointer_width = "32"))]
 #[no_mangle]
 pub extern "C" fn _Unwind_Resume() {
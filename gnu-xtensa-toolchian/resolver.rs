@@ -0,0 +1,57 @@
+use super::ESP_DEBUG_TRACE;
+use std::env;
+use std::io::{Read, Write};
+use std::os::unix::net::UnixStream;
+use std::path::{Path, PathBuf};
+use std::time::Duration;
+
+/* Socket location rule is shared with the resolver daemon of esp-elf-gdb-wrapper */
+const RESOLVER_SOCKET_NAME: &str = "esp-wrapper-resolver.sock";
+const RESOLVER_TIMEOUT: Duration = Duration::from_millis(500);
+
+/* Toolchain layout resolved by the daemon */
+pub struct Resolved {
+    pub exec_path: String,
+    pub dynconfig: String,
+    pub dynconfig_option: Option<String>,
+}
+
+fn socket_path() -> Option<PathBuf> {
+    match env::var_os("ESP_WRAPPER_RESOLVER_SOCKET") {
+        Some(p) if p.is_empty() => None,
+        Some(p) => Some(PathBuf::from(p)),
+        None => Some(Path::new(&env::var_os("XDG_RUNTIME_DIR")?).join(RESOLVER_SOCKET_NAME)),
+    }
+}
+
+/* Ask the per-user resolver daemon, None if it is not running or can not answer */
+pub fn query(wrapper_path: &Path) -> Option<Resolved> {
+    let mut stream = UnixStream::connect(socket_path()?).ok()?;
+    stream.set_read_timeout(Some(RESOLVER_TIMEOUT)).ok()?;
+    stream.set_write_timeout(Some(RESOLVER_TIMEOUT)).ok()?;
+    stream
+        .write_all(format!("toolchain\t{}\n", wrapper_path.display()).as_bytes())
+        .ok()?;
+    let mut response = String::new();
+    stream.read_to_string(&mut response).ok()?;
+
+    let mut resolved = Resolved {
+        exec_path: String::new(),
+        dynconfig: String::new(),
+        dynconfig_option: None,
+    };
+    for line in response.lines() {
+        match line.split_once('\t')? {
+            ("exec", v) => resolved.exec_path = v.to_string(),
+            ("dynconfig", v) => resolved.dynconfig = v.to_string(),
+            ("option", v) => resolved.dynconfig_option = Some(v.to_string()),
+            _ => return None,
+        }
+    }
+    if resolved.exec_path.is_empty() || resolved.dynconfig.is_empty() {
+        esp_debug_trace!("Resolver daemon can not resolve {:?}", wrapper_path);
+        return None;
+    }
+    esp_debug_trace!("Toolchain layout is resolved by the daemon");
+    Some(resolved)
+}
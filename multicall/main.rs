@@ -0,0 +1,32 @@
+/* Toolchain and GDB wrappers in one binary for Linux and macOS. It is
+ * installed once as bin/esp-wrapper and every wrapper name is a hard link or
+ * a symlink to it in the same directory:
+ *   xtensa-esp32-elf-gcc -> esp-wrapper    toolchain wrapper
+ *   xtensa-esp32-elf-gdb -> esp-wrapper    GDB wrapper
+ *   riscv32-esp-elf-gdb -> esp-wrapper     GDB wrapper
+ * All wrapper processes of a build share one text image in the page cache. */
+#[path = "../gnu-debugger/unix/main.rs"]
+mod gdb;
+#[path = "../gnu-xtensa-toolchian/main.rs"]
+mod toolchain;
+
+use esp_wrapper_common::exe;
+
+fn main() {
+    let wrapper = exe::wrapper_path().expect("Get exec full path");
+    let name = wrapper
+        .file_name()
+        .expect("Current exe has path")
+        .to_string_lossy();
+    if name.ends_with("-elf-gdb") {
+        gdb::main();
+    } else if name.starts_with("xtensa-") {
+        toolchain::main();
+    } else {
+        eprintln!(
+            "{} has to be started by a wrapper name, \"xtensa-esp32-elf-gcc\" or \"xtensa-esp32-elf-gdb\"",
+            name
+        );
+        std::process::exit(1);
+    }
+}
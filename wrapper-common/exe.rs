@@ -0,0 +1,24 @@
+use std::env;
+use std::io;
+use std::path::{Path, PathBuf};
+
+/* Multi-call binary serving all wrapper names, installed in the toolchain
+ * bin/ directory with a link per name */
+pub const MULTICALL_NAME: &str = "esp-wrapper";
+
+/* Wrapper path, current_exe() unless it is the multi-call binary reached
+ * through a symlink: then the name comes from argv[0] and the directory from
+ * the binary, the links are next to it */
+pub fn wrapper_path() -> io::Result<PathBuf> {
+    let exe = env::current_exe()?;
+    if exe.file_stem() != Some(MULTICALL_NAME.as_ref()) {
+        return Ok(exe);
+    }
+    let name = env::args_os()
+        .next()
+        .and_then(|arg0| Some(Path::new(&arg0).file_name()?.to_owned()));
+    Ok(match name {
+        Some(name) => exe.with_file_name(name),
+        None => exe,
+    })
+}
@@ -0,0 +1,96 @@
+use std::path::{Path, PathBuf};
+
+const XTENSA_TOOLCHAIN_PREFIX: &str = "xtensa-esp-elf-";
+const XTENSA_TOOL_PARSE_ERROR: &str = "Called tool must have pattern \"xtensa-esp*-elf-*\"";
+
+/* Toolchain files used by the wrapper named "xtensa-{chip}-elf-{tool}":
+ * bin/xtensa-esp-elf-{tool} and lib/xtensa_{chip}.so */
+pub struct Layout {
+    pub chip: String,
+    pub tool_name: String,
+    pub exec_path: PathBuf,
+    pub dynconfig_path: PathBuf,
+}
+
+impl Layout {
+    pub fn new(wrapper_path: &Path) -> Layout {
+        let wrapper_name = wrapper_path
+            .file_name()
+            .expect("Current exe has path")
+            .to_str()
+            .unwrap();
+
+        let mut chip = "";
+        let mut tool_name = Vec::<&str>::new();
+        for (i, s) in wrapper_name.split('-').enumerate() {
+            match i {
+                0 => assert_eq!(s, "xtensa", "{}", XTENSA_TOOL_PARSE_ERROR),
+                1 => chip = s,
+                2 => assert_eq!(s, "elf", "{}", XTENSA_TOOL_PARSE_ERROR),
+                _ => tool_name.push(s),
+            }
+        }
+        assert_ne!(chip, "esp", "Target chip can not be \"esp\"");
+        assert_ne!(chip, "", "{}", XTENSA_TOOL_PARSE_ERROR);
+
+        let tool_name = tool_name.join("-");
+        assert_ne!(tool_name, "", "{}", XTENSA_TOOL_PARSE_ERROR);
+
+        let bin_dir = wrapper_path
+            .parent()
+            .expect("Executable must be in some directory");
+        let exec_path = bin_dir.join(format!("{}{}", XTENSA_TOOLCHAIN_PREFIX, tool_name));
+        let dynconfig_path = bin_dir
+            .parent()
+            .expect("Toolchain must be in some directory")
+            .join("lib")
+            .join(format!("xtensa_{}.so", chip));
+
+        Layout {
+            chip: chip.to_string(),
+            tool_name,
+            exec_path,
+            dynconfig_path,
+        }
+    }
+
+    pub fn dynconfig_filename(&self) -> String {
+        format!("xtensa_{}.so", self.chip)
+    }
+
+    /* Need to add mdynconfig option for using the right multilib instance */
+    pub fn dynconfig_option(&self) -> Option<String> {
+        if is_compiler(self.tool_name.clone()) {
+            Some(format!("-mdynconfig={}", self.dynconfig_filename()))
+        } else {
+            None
+        }
+    }
+}
+
+fn is_compiler(tool_name: String) -> bool {
+    /* consider tools:
+     * xtensa-esp-elf-cc[.exe]
+     * xtensa-esp-elf-gcc[.exe]
+     * xtensa-esp-elf-g++[.exe]
+     * xtensa-esp-elf-c++[.exe]
+     * xtensa-esp-elf-gcc-13.1.0[.exe]
+     */
+    #[cfg(windows)]
+    let tool_name = match tool_name.strip_suffix(".exe") {
+        Some(s) => s.to_owned(),
+        None => tool_name,
+    };
+
+    if ["cc", "gcc", "g++", "c++"].contains(&tool_name.as_str()) {
+        return true;
+    }
+    if tool_name.starts_with("gcc-") {
+        return tool_name
+            .chars()
+            .nth("gcc-".len())
+            .unwrap()
+            .is_ascii_digit();
+    }
+    false
+}
@@ -0,0 +1,5 @@
+/* Modules of the toolchain and GDB wrappers, in one crate so the multi-call
+ * binary links them once */
+pub mod exe;
+pub mod layout;
+pub mod trace;
@@ -0,0 +1,154 @@
+use lazy_static::lazy_static;
+use std::env;
+use std::fs::{File, OpenOptions};
+use std::io::Write;
+#[cfg(unix)]
+use std::os::unix::io::AsRawFd;
+use std::path::Path;
+use std::process;
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::Mutex;
+use std::thread;
+use std::time::{SystemTime, UNIX_EPOCH};
+
+/* Chrome trace-event timeline of wrapper start-up, shared by the toolchain
+ * and GDB wrappers (the Windows GDB wrapper writes the same events).
+ * ESP_WRAPPER_TRACE_FILE names the file; every process appends complete
+ * events to it, so one file collects the launches of a whole build or test
+ * run. The JSON array is never closed, chrome://tracing and Perfetto accept
+ * that. */
+lazy_static! {
+    static ref TRACE_FILE: Option<Mutex<File>> = env::var_os("ESP_WRAPPER_TRACE_FILE")
+        .filter(|path| !path.is_empty())
+        .and_then(|path| OpenOptions::new().create(true).append(true).open(path).ok())
+        .map(Mutex::new);
+    /* Wrapper name, "xtensa-esp32-elf-gcc" */
+    static ref CATEGORY: String = env::args()
+        .next()
+        .and_then(|arg0| Some(Path::new(&arg0).file_name()?.to_string_lossy().to_string()))
+        .unwrap_or_default();
+    static ref START: u64 = now();
+}
+
+/* Microseconds since the Unix epoch, so events of different processes line up */
+fn now() -> u64 {
+    SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map_or(0, |d| d.as_micros() as u64)
+}
+
+/* Events of the main thread are on the track of the process, background
+ * threads get tracks of their own, their spans overlap the main thread ones */
+fn thread_id() -> u32 {
+    static NEXT_THREAD: AtomicU32 = AtomicU32::new(1);
+    thread_local! {
+        static THREAD: u32 = match thread::current().name() {
+            Some("main") => process::id(),
+            _ => NEXT_THREAD.fetch_add(1, Ordering::Relaxed),
+        };
+    }
+    THREAD.with(|id| *id)
+}
+
+fn json_string(s: &str) -> String {
+    let mut json = String::from("\"");
+    for c in s.chars() {
+        match c {
+            '"' => json += "\\\"",
+            '\\' => json += "\\\\",
+            c if (c as u32) < 0x20 => json += &format!("\\u{:04x}", c as u32),
+            c => json.push(c),
+        }
+    }
+    json + "\""
+}
+
+pub fn enabled() -> bool {
+    TRACE_FILE.is_some()
+}
+
+/* The event is written with one append under an exclusive lock, the lock
+ * makes the first writer of an empty file the one to open the array */
+fn write_event(name: &str, start: u64, duration: u64, detail: Option<&str>) {
+    let file = match TRACE_FILE.as_ref() {
+        Some(file) => file.lock().unwrap(),
+        None => return,
+    };
+    let mut event = format!(
+        "{{\"name\":{},\"cat\":{},\"ph\":\"X\",\"ts\":{},\"dur\":{},\"pid\":{},\"tid\":{}",
+        json_string(name),
+        json_string(&CATEGORY),
+        start,
+        duration,
+        process::id(),
+        thread_id()
+    );
+    if let Some(detail) = detail {
+        event += &format!(",\"args\":{{\"detail\":{}}}", json_string(detail));
+    }
+    event += "},\n";
+    #[cfg(unix)]
+    unsafe {
+        libc::flock(file.as_raw_fd(), libc::LOCK_EX)
+    };
+    if file.metadata().is_ok_and(|m| m.len() == 0) {
+        event.insert_str(0, "[\n");
+    }
+    let _ = (&*file).write_all(event.as_bytes());
+    #[cfg(unix)]
+    unsafe {
+        libc::flock(file.as_raw_fd(), libc::LOCK_UN)
+    };
+}
+
+/* Phase of the start-up, recorded when dropped */
+pub struct Span {
+    name: &'static str,
+    start: u64,
+    detail: Option<String>,
+}
+
+impl Span {
+    pub fn detail(&mut self, detail: &str) {
+        if enabled() {
+            self.detail = Some(detail.to_string());
+        }
+    }
+}
+
+impl Drop for Span {
+    fn drop(&mut self) {
+        if enabled() {
+            write_event(
+                self.name,
+                self.start,
+                now().saturating_sub(self.start),
+                self.detail.as_deref(),
+            );
+        }
+    }
+}
+
+pub fn span(name: &'static str) -> Span {
+    Span {
+        name,
+        start: if enabled() { now() } else { 0 },
+        detail: None,
+    }
+}
+
+/* Marks the process start, spans of the phases nest in the span "start"
+ * recorded by exec() */
+pub fn start() {
+    if enabled() {
+        lazy_static::initialize(&START);
+    }
+}
+
+/* Destructors do not run across execv(), the whole start-up up to now is
+ * recorded with the executed program */
+pub fn exec(program: &str) {
+    if enabled() {
+        write_event("start", *START, now().saturating_sub(*START), Some(program));
+    }
+}